@@ -0,0 +1,595 @@
+#pragma once
+
+#include "quadtree/quadtree.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace bvh
+{
+
+using quadtree::Box;
+
+// Dynamic bounding volume hierarchy, meant for values of mixed sizes and fast moving ones.
+// Each value is a leaf whose box is fattened by a margin and by its last displacement, so that
+// moving a value costs nothing until it leaves its fat box. Leaves are inserted next to the
+// sibling minimizing the perimeter of the tree (the surface area heuristic in 2D), and nodes
+// are rotated on the way up to keep the tree balanced.
+// Values with non finite boxes are loose: they have no leaf and are tested one by one.
+template <typename T, typename GetBox, typename Equal = std::equal_to<T>, typename Float = float>
+class AabbTree
+{
+	static_assert(std::is_convertible_v<std::invoke_result_t<GetBox, const T&>, Box<Float>>,
+		"GetBox must be a callable of signature Box<Float>(const T&)");
+	static_assert(std::is_convertible_v<std::invoke_result_t<Equal, const T&, const T&>, bool>,
+		"Equal must be a callable of signature bool(const T&, const T&)");
+	static_assert(std::is_arithmetic_v<Float>);
+
+public:
+	AabbTree(Float margin, const GetBox& getBox = GetBox(), const Equal& equal = Equal()) :
+		mMargin(margin),
+		mGetBox(getBox),
+		mEqual(equal)
+	{
+		assert(margin >= 0);
+	}
+
+	// Box of the root, it contains the fat boxes of the values
+	Box<Float> getBox() const
+	{
+		return mRoot == Null ? Box<Float>() : mNodes[mRoot].box;
+	}
+
+	std::size_t size() const
+	{
+		return mValues.size();
+	}
+
+	// Removes every value and the nodes at once
+	void clear()
+	{
+		mValues.clear();
+		mBoxes.clear();
+		mLeaves.clear();
+		mLoose.clear();
+		mNodes.clear();
+		mRoot = Null;
+		mFree = Null;
+	}
+
+	T& add(const T& value)
+	{
+		auto i = static_cast<std::uint32_t>(mValues.size());
+		mValues.push_back(value);
+		mBoxes.push_back(mGetBox(value));
+		mLeaves.push_back(Null);
+		if (isLoose(mBoxes[i]))
+			mLoose.push_back(i);
+		else
+			insert(i, fatten(mBoxes[i], Float(0), Float(0)));
+		return mValues[i];
+	}
+
+	void remove(const T& value)
+	{
+		erase(find(mGetBox(value), value));
+	}
+
+	// Moves a value whose box changed from oldBox, the value is found with its old box
+	// It is only reinserted if it left its fat box, which is then extended along the displacement
+	void update(const T& value, const Box<Float>& oldBox)
+	{
+		relocate(std::array<std::pair<T, Box<Float>>, 1> { std::pair<T, Box<Float>>(value, oldBox) });
+	}
+
+	// Same as update for a range of (value, oldBox) pairs
+	template <typename Range>
+	void relocate(const Range& moved)
+	{
+		for (const auto& [value, oldBox] : moved)
+		{
+			auto i = find(oldBox, value);
+			auto box = mGetBox(value);
+			mValues[i] = value;
+			mBoxes[i] = box;
+			auto leaf = mLeaves[i];
+			if (leaf != Null && !isLoose(box) && mNodes[leaf].box.contains(box))
+				continue;
+			// Leave the tree or the loose values, then go back in the right one
+			if (leaf != Null)
+				removeLeaf(leaf);
+			else
+				mLoose.erase(std::find(mLoose.begin(), mLoose.end(), i));
+			if (isLoose(box))
+			{
+				if (leaf != Null)
+				{
+					release(leaf);
+					mLeaves[i] = Null;
+				}
+				mLoose.push_back(i);
+			}
+			else if (leaf != Null)
+				insertLeaf(leaf, fatten(box, box.left - oldBox.left, box.top - oldBox.top));
+			else
+				insert(i, fatten(box, Float(0), Float(0)));
+		}
+	}
+
+	// Replaces the content of the tree by values
+	// The tree is built top down by splitting the values at the median of the longest axis of
+	// their bounds, which gives tighter nodes than inserting them one by one
+	template <typename Range>
+	void build(const Range& values)
+	{
+		mValues.assign(std::begin(values), std::end(values));
+		mBoxes.clear();
+		mLeaves.assign(mValues.size(), Null);
+		mLoose.clear();
+		mNodes.clear();
+		mFree = Null;
+		auto leaves = std::vector<NodeId>();
+		for (auto i = std::uint32_t(0); i < mValues.size(); ++i)
+		{
+			mBoxes.push_back(mGetBox(mValues[i]));
+			if (isLoose(mBoxes[i]))
+			{
+				mLoose.push_back(i);
+				continue;
+			}
+			auto leaf = allocate();
+			mNodes[leaf].box = fatten(mBoxes[i], Float(0), Float(0));
+			mNodes[leaf].value = i;
+			mLeaves[i] = leaf;
+			leaves.push_back(leaf);
+		}
+		mRoot = leaves.empty() ? Null : build(leaves.begin(), leaves.end());
+		if (mRoot != Null)
+			mNodes[mRoot].parent = Null;
+	}
+
+	std::vector<T> query(const Box<Float>& box) const
+	{
+		auto values = std::vector<T>();
+		forEach(box, [&values](const T& value) { values.push_back(value); });
+		return values;
+	}
+
+	// Calls fn on every value intersecting box without allocating
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn) const
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mValues[i]); return false; });
+	}
+
+	// Same as forEach but fn may modify the values in place, without changing their boxes
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn)
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mValues[i]); return false; });
+	}
+
+	std::size_t count(const Box<Float>& box) const
+	{
+		auto n = std::size_t(0);
+		visit(box, [&n](std::uint32_t) { ++n; return false; });
+		return n;
+	}
+
+	// Returns true as soon as a value intersecting box satisfies pred
+	template <typename Pred>
+	bool any(const Box<Float>& box, Pred&& pred) const
+	{
+		return visit(box, [this, &pred](std::uint32_t i) { return static_cast<bool>(pred(mValues[i])); });
+	}
+
+	bool any(const Box<Float>& box) const
+	{
+		return visit(box, [](std::uint32_t) { return true; });
+	}
+
+	std::vector<T*> access(const Box<Float>& box)
+	{
+		std::vector<T*> values {};
+		forEach(box, [&values](T& value) { values.push_back(&value); });
+		return values;
+	}
+
+	std::vector<std::pair<T, T>> findAllIntersections() const
+	{
+		auto intersections = std::vector<std::pair<T, T>>();
+		findIntersections(0, mValues.size(), intersections);
+		return intersections;
+	}
+
+	// Same pairs as findAllIntersections, the values being split between up to nbThreads threads
+	std::vector<std::pair<T, T>> findAllIntersectionsParallel(std::size_t nbThreads = std::thread::hardware_concurrency()) const
+	{
+		// One job per block of values, each with its own buffer
+		const auto nbJobs = (mValues.size() + ValuesPerJob - 1) / ValuesPerJob;
+		auto buffers = std::vector<std::vector<std::pair<T, T>>>(nbJobs);
+		auto next = std::atomic<std::size_t>(0);
+		const auto work = [this, &buffers, &next, nbJobs]() {
+			for (auto i = next++; i < nbJobs; i = next++)
+				findIntersections(i * ValuesPerJob, std::min(mValues.size(), (i + 1) * ValuesPerJob), buffers[i]);
+		};
+		auto threads = std::vector<std::thread>();
+		for (auto i = std::size_t(1); i < std::min(nbThreads, nbJobs); ++i)
+			threads.emplace_back(work);
+		work();
+		for (auto& thread : threads)
+			thread.join();
+
+		auto size = std::size_t(0);
+		for (const auto& buffer : buffers)
+			size += buffer.size();
+		auto intersections = std::vector<std::pair<T, T>>();
+		intersections.reserve(size);
+		for (auto& buffer : buffers)
+			std::move(std::begin(buffer), std::end(buffer), std::back_inserter(intersections));
+		return intersections;
+	}
+
+	//protected:
+	using NodeId = std::uint32_t;
+
+	static constexpr auto Null = std::numeric_limits<NodeId>::max();
+	// A moved value's fat box is extended by this many times its displacement
+	static constexpr auto DisplacementFactor = Float(4);
+	static constexpr auto ValuesPerJob = std::size_t(1024);
+
+	// A leaf if it has no children, free nodes are chained through parent
+	struct Node
+	{
+		Box<Float> box;
+		NodeId parent = Null;
+		NodeId left = Null;
+		NodeId right = Null;
+		// Height of the subtree, 0 for leaves
+		std::int32_t height = 0;
+		std::uint32_t value = 0;
+	};
+
+	Float mMargin;
+	std::vector<T> mValues;
+	// Tight boxes of the values, the leaves hold the fat ones
+	std::vector<Box<Float>> mBoxes;
+	std::vector<NodeId> mLeaves;
+	std::vector<std::uint32_t> mLoose;
+	std::vector<Node> mNodes;
+	NodeId mRoot = Null;
+	NodeId mFree = Null;
+	GetBox mGetBox;
+	Equal mEqual;
+
+	static bool isLoose(const Box<Float>& box)
+	{
+		return !std::isfinite(box.left) || !std::isfinite(box.top) || !std::isfinite(box.getRight()) || !std::isfinite(box.getBottom());
+	}
+
+	static Box<Float> merge(const Box<Float>& lhs, const Box<Float>& rhs)
+	{
+		auto left = std::min(lhs.left, rhs.left);
+		auto top = std::min(lhs.top, rhs.top);
+		return Box<Float>(left, top, std::max(lhs.getRight(), rhs.getRight()) - left, std::max(lhs.getBottom(), rhs.getBottom()) - top);
+	}
+
+	static Float perimeter(const Box<Float>& box)
+	{
+		return 2 * (box.width + box.height);
+	}
+
+	Box<Float> fatten(const Box<Float>& box, Float dx, Float dy) const
+	{
+		dx *= DisplacementFactor;
+		dy *= DisplacementFactor;
+		auto left = box.left - mMargin + std::min(dx, Float(0));
+		auto top = box.top - mMargin + std::min(dy, Float(0));
+		auto right = box.getRight() + mMargin + std::max(dx, Float(0));
+		auto bottom = box.getBottom() + mMargin + std::max(dy, Float(0));
+		return Box<Float>(left, top, right - left, bottom - top);
+	}
+
+	bool isLeaf(NodeId node) const
+	{
+		return mNodes[node].left == Null;
+	}
+
+	NodeId allocate()
+	{
+		if (mFree == Null)
+		{
+			mNodes.emplace_back();
+			return static_cast<NodeId>(mNodes.size() - 1);
+		}
+		auto node = mFree;
+		mFree = mNodes[node].parent;
+		mNodes[node] = Node();
+		return node;
+	}
+
+	void release(NodeId node)
+	{
+		mNodes[node].parent = mFree;
+		mNodes[node].height = -1;
+		mFree = node;
+	}
+
+	template <typename It>
+	NodeId build(It first, It last)
+	{
+		if (last - first == 1)
+			return *first;
+		auto bounds = mNodes[*first].box;
+		for (auto it = first + 1; it != last; ++it)
+			bounds = merge(bounds, mNodes[*it].box);
+		// Split at the median of the centers along the longest axis
+		const auto center = [this, horizontal = bounds.width >= bounds.height](NodeId node) {
+			const auto& box = mNodes[node].box;
+			return horizontal ? 2 * box.left + box.width : 2 * box.top + box.height;
+		};
+		auto middle = first + (last - first) / 2;
+		std::nth_element(first, middle, last, [&center](NodeId lhs, NodeId rhs) { return center(lhs) < center(rhs); });
+		auto left = build(first, middle);
+		auto right = build(middle, last);
+		auto node = allocate();
+		mNodes[node].box = bounds;
+		mNodes[node].left = left;
+		mNodes[node].right = right;
+		mNodes[node].height = 1 + std::max(mNodes[left].height, mNodes[right].height);
+		mNodes[left].parent = node;
+		mNodes[right].parent = node;
+		return node;
+	}
+
+	void insert(std::uint32_t i, const Box<Float>& fatBox)
+	{
+		auto leaf = allocate();
+		mNodes[leaf].value = i;
+		mLeaves[i] = leaf;
+		insertLeaf(leaf, fatBox);
+	}
+
+	void insertLeaf(NodeId leaf, const Box<Float>& fatBox)
+	{
+		mNodes[leaf].box = fatBox;
+		if (mRoot == Null)
+		{
+			mRoot = leaf;
+			mNodes[leaf].parent = Null;
+			return;
+		}
+		// Descend towards the sibling of least cost, a node's cost being the growth of the
+		// perimeters of its ancestors plus the perimeter of the new parent
+		auto node = mRoot;
+		while (!isLeaf(node))
+		{
+			const auto& current = mNodes[node];
+			auto combined = perimeter(merge(current.box, fatBox));
+			auto cost = 2 * combined;
+			auto inherited = 2 * (combined - perimeter(current.box));
+			const auto childCost = [this, &fatBox, inherited](NodeId child) {
+				auto grown = perimeter(merge(mNodes[child].box, fatBox));
+				return isLeaf(child) ? grown + inherited : grown - perimeter(mNodes[child].box) + inherited;
+			};
+			auto leftCost = childCost(current.left);
+			auto rightCost = childCost(current.right);
+			if (cost < leftCost && cost < rightCost)
+				break;
+			node = leftCost < rightCost ? current.left : current.right;
+		}
+
+		// Make a new parent for the sibling and the leaf
+		auto sibling = node;
+		auto oldParent = mNodes[sibling].parent;
+		auto parent = allocate();
+		mNodes[parent].parent = oldParent;
+		mNodes[parent].box = merge(fatBox, mNodes[sibling].box);
+		mNodes[parent].height = mNodes[sibling].height + 1;
+		mNodes[parent].left = sibling;
+		mNodes[parent].right = leaf;
+		mNodes[sibling].parent = parent;
+		mNodes[leaf].parent = parent;
+		if (oldParent == Null)
+			mRoot = parent;
+		else if (mNodes[oldParent].left == sibling)
+			mNodes[oldParent].left = parent;
+		else
+			mNodes[oldParent].right = parent;
+		refit(mNodes[leaf].parent);
+	}
+
+	void removeLeaf(NodeId leaf)
+	{
+		if (leaf == mRoot)
+		{
+			mRoot = Null;
+			return;
+		}
+		// The sibling takes the place of the parent
+		auto parent = mNodes[leaf].parent;
+		auto grandParent = mNodes[parent].parent;
+		auto sibling = mNodes[parent].left == leaf ? mNodes[parent].right : mNodes[parent].left;
+		release(parent);
+		mNodes[sibling].parent = grandParent;
+		if (grandParent == Null)
+		{
+			mRoot = sibling;
+			return;
+		}
+		if (mNodes[grandParent].left == parent)
+			mNodes[grandParent].left = sibling;
+		else
+			mNodes[grandParent].right = sibling;
+		refit(grandParent);
+	}
+
+	// Rebalances and refits the ancestors of a modified subtree, from node to the root
+	void refit(NodeId node)
+	{
+		while (node != Null)
+		{
+			node = rotate(node);
+			auto& current = mNodes[node];
+			current.height = 1 + std::max(mNodes[current.left].height, mNodes[current.right].height);
+			current.box = merge(mNodes[current.left].box, mNodes[current.right].box);
+			node = current.parent;
+		}
+	}
+
+	// If one child of a is two levels taller than the other, it takes the place of a, which gets
+	// its shorter child. Returns the node now at the place of a.
+	NodeId rotate(NodeId a)
+	{
+		if (isLeaf(a))
+			return a;
+		auto balance = mNodes[mNodes[a].right].height - mNodes[mNodes[a].left].height;
+		if (balance > 1)
+			return promote(a, mNodes[a].right, true);
+		if (balance < -1)
+			return promote(a, mNodes[a].left, false);
+		return a;
+	}
+
+	NodeId promote(NodeId a, NodeId c, bool right)
+	{
+		auto f = mNodes[c].left;
+		auto g = mNodes[c].right;
+		// c takes the place of a
+		mNodes[c].left = a;
+		mNodes[c].parent = mNodes[a].parent;
+		mNodes[a].parent = c;
+		if (mNodes[c].parent == Null)
+			mRoot = c;
+		else if (mNodes[mNodes[c].parent].left == a)
+			mNodes[mNodes[c].parent].left = c;
+		else
+			mNodes[mNodes[c].parent].right = c;
+		// The taller child of c stays, the other one replaces c under a
+		auto kept = mNodes[f].height > mNodes[g].height ? f : g;
+		auto given = kept == f ? g : f;
+		mNodes[c].right = kept;
+		if (right)
+			mNodes[a].right = given;
+		else
+			mNodes[a].left = given;
+		mNodes[given].parent = a;
+		auto& nodeA = mNodes[a];
+		nodeA.box = merge(mNodes[nodeA.left].box, mNodes[nodeA.right].box);
+		nodeA.height = 1 + std::max(mNodes[nodeA.left].height, mNodes[nodeA.right].height);
+		return c;
+	}
+
+	// Calls fn on the indices of the values intersecting box until it returns true
+	template <typename F>
+	bool visit(const Box<Float>& box, F&& fn) const
+	{
+		if (mRoot != Null)
+		{
+			// The stack holds at most one node per level plus one, it only goes to the heap for
+			// trees deeper than the rotations leave them
+			auto inlined = std::array<NodeId, 64>();
+			auto spilled = std::vector<NodeId>();
+			auto* stack = inlined.data();
+			const auto capacity = static_cast<std::size_t>(mNodes[mRoot].height) + 1;
+			if (capacity > inlined.size())
+			{
+				spilled.resize(capacity);
+				stack = spilled.data();
+			}
+			auto size = std::size_t(0);
+			stack[size++] = mRoot;
+			while (size > 0)
+			{
+				const auto& node = mNodes[stack[--size]];
+				if (!box.intersects(node.box))
+					continue;
+				if (node.left == Null)
+				{
+					if (box.intersects(mBoxes[node.value]) && fn(node.value))
+						return true;
+				}
+				else
+				{
+					assert(size + 2 <= std::max(capacity, inlined.size()) && "The node heights are wrong");
+					stack[size++] = node.left;
+					stack[size++] = node.right;
+				}
+			}
+		}
+		for (auto i : mLoose)
+		{
+			if (box.intersects(mBoxes[i]) && fn(i))
+				return true;
+		}
+		return false;
+	}
+
+	// Pairs of the values in [first, last), each pair being reported by its greatest index
+	void findIntersections(std::size_t first, std::size_t last, std::vector<std::pair<T, T>>& intersections) const
+	{
+		for (auto i = static_cast<std::uint32_t>(first); i < last; ++i)
+		{
+			visit(mBoxes[i], [this, i, &intersections](std::uint32_t j) {
+				if (j < i)
+					intersections.emplace_back(mValues[i], mValues[j]);
+				return false;
+			});
+		}
+	}
+
+	// Returns the index of value, looking for it around box
+	std::uint32_t find(const Box<Float>& box, const T& value) const
+	{
+		auto found = std::uint32_t(0);
+		auto present = visit(box, [this, &value, &found](std::uint32_t i) {
+			found = i;
+			return mEqual(value, mValues[i]);
+		});
+		// Boxes of width or height 0 do not intersect anything, look at every value
+		if (!present)
+		{
+			auto it = std::find_if(std::begin(mValues), std::end(mValues), [this, &value](const auto& rhs) { return mEqual(value, rhs); });
+			present = it != std::end(mValues);
+			found = static_cast<std::uint32_t>(std::distance(std::begin(mValues), it));
+		}
+		assert(present && "Trying to find a value that is not present in the tree");
+		return found;
+	}
+
+	void erase(std::uint32_t i)
+	{
+		// Drop the leaf of the value, then move the last value in its place
+		if (mLeaves[i] != Null)
+		{
+			removeLeaf(mLeaves[i]);
+			release(mLeaves[i]);
+		}
+		else
+			mLoose.erase(std::find(mLoose.begin(), mLoose.end(), i));
+		auto last = static_cast<std::uint32_t>(mValues.size() - 1);
+		if (i != last)
+		{
+			if (mLeaves[last] != Null)
+				mNodes[mLeaves[last]].value = i;
+			else
+				*std::find(mLoose.begin(), mLoose.end(), last) = i;
+			mValues[i] = std::move(mValues[last]);
+			mBoxes[i] = mBoxes[last];
+			mLeaves[i] = mLeaves[last];
+		}
+		mValues.pop_back();
+		mBoxes.pop_back();
+		mLeaves.pop_back();
+	}
+};
+
+}
@@ -0,0 +1,532 @@
+#pragma once
+
+#include "quadtree/quadtree.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace hashgrid
+{
+
+using quadtree::Box;
+
+// Uniform grid of square cells, meant for values of similar sizes close to the cell size.
+// Only non empty cells are stored, in an open addressing table keyed by the cell coordinates.
+// Each cell references the values overlapping it as a range of one array of value indices, that
+// is rebuilt from scratch by a counting sort when values are relocated.
+// Values added since the last rebuild, and values overlapping too many cells, are loose: they
+// are not referenced by the cells and are tested one by one.
+template <typename T, typename GetBox, typename Equal = std::equal_to<T>, typename Float = float>
+class HashGrid
+{
+	static_assert(std::is_convertible_v<std::invoke_result_t<GetBox, const T&>, Box<Float>>,
+		"GetBox must be a callable of signature Box<Float>(const T&)");
+	static_assert(std::is_convertible_v<std::invoke_result_t<Equal, const T&, const T&>, bool>,
+		"Equal must be a callable of signature bool(const T&, const T&)");
+	static_assert(std::is_arithmetic_v<Float>);
+
+public:
+	HashGrid(Float cellSize, const GetBox& getBox = GetBox(), const Equal& equal = Equal()) :
+		mCellSize(cellSize),
+		mGetBox(getBox),
+		mEqual(equal)
+	{
+		assert(cellSize > 0);
+	}
+
+	// Bounds of the finite boxes of the values, they only shrink when the grid is rebuilt
+	const Box<Float>& getBox() const
+	{
+		return mBox;
+	}
+
+	std::size_t size() const
+	{
+		return mValues.size();
+	}
+
+	// Removes every value and the cells at once
+	void clear()
+	{
+		mBox = Box<Float>();
+		mHasBox = false;
+		mValues.clear();
+		mBoxes.clear();
+		mRanges.clear();
+		mLoose.clear();
+		mSlots.clear();
+		mEntries.clear();
+	}
+
+	T& add(const T& value)
+	{
+		auto i = static_cast<std::uint32_t>(mValues.size());
+		mValues.push_back(value);
+		mBoxes.push_back(mGetBox(value));
+		mRanges.push_back(Range { 0, 0, -1, -1, true });
+		mLoose.push_back(i);
+		extend(mBoxes.back());
+		// Rebuild once loose values are numerous enough to pay for it
+		if (mLoose.size() > std::max(LooseThreshold, mValues.size() / 4))
+			rebuild();
+		return mValues[i];
+	}
+
+	void remove(const T& value)
+	{
+		erase(find(mGetBox(value), value));
+	}
+
+	// Same as Quadtree::update, the grid finds the value with its old box then is rebuilt
+	void update(const T& value, const Box<Float>& oldBox)
+	{
+		mValues[find(oldBox, value)] = value;
+		rebuild();
+	}
+
+	// Same as update for a range of (value, oldBox) pairs, the grid is rebuilt once
+	template <typename Range>
+	void relocate(const Range& moved)
+	{
+		for (const auto& [value, oldBox] : moved)
+			mValues[find(oldBox, value)] = value;
+		rebuild();
+	}
+
+	// Replaces the content of the grid by values
+	template <typename Range>
+	void build(const Range& values)
+	{
+		mValues.assign(std::begin(values), std::end(values));
+		rebuild();
+	}
+
+	// Reads the box of every value again and sorts them in the cells, values modified in place
+	// are found at their old box until then
+	void rebuild()
+	{
+		mBoxes.clear();
+		mRanges.clear();
+		mLoose.clear();
+		mBox = Box<Float>();
+		mHasBox = false;
+		for (auto i = std::size_t(0); i < mValues.size(); ++i)
+		{
+			mBoxes.push_back(mGetBox(mValues[i]));
+			mRanges.push_back(computeRange(mBoxes.back()));
+			if (mRanges.back().loose)
+				mLoose.push_back(static_cast<std::uint32_t>(i));
+			extend(mBoxes.back());
+		}
+		// Size the table for a load factor of at most one half
+		auto cells = std::size_t(0);
+		for (const auto& range : mRanges)
+			cells += range.loose ? 0 : static_cast<std::size_t>(range.cellCount());
+		auto capacity = std::size_t(16);
+		while (capacity < 2 * cells)
+			capacity *= 2;
+		mSlots.assign(capacity, Slot());
+		// Count the values of each cell, compute where their ranges start, then fill them
+		forEachCell([this](std::uint32_t, std::int32_t x, std::int32_t y) { ++mSlots[insert(x, y)].count; });
+		auto first = std::uint32_t(0);
+		for (auto& slot : mSlots)
+		{
+			slot.first = first;
+			first += slot.count;
+			slot.count = 0;
+		}
+		mEntries.resize(first);
+		forEachCell([this](std::uint32_t i, std::int32_t x, std::int32_t y) {
+			auto& slot = mSlots[lookup(x, y)];
+			mEntries[slot.first + slot.count++] = i;
+		});
+	}
+
+	std::vector<T> query(const Box<Float>& box) const
+	{
+		auto values = std::vector<T>();
+		forEach(box, [&values](const T& value) { values.push_back(value); });
+		return values;
+	}
+
+	// Calls fn on every value intersecting box without allocating
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn) const
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mValues[i]); return false; });
+	}
+
+	// Same as forEach but fn may modify the values in place, without changing their boxes
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn)
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mValues[i]); return false; });
+	}
+
+	std::size_t count(const Box<Float>& box) const
+	{
+		auto n = std::size_t(0);
+		visit(box, [&n](std::uint32_t) { ++n; return false; });
+		return n;
+	}
+
+	// Returns true as soon as a value intersecting box satisfies pred
+	template <typename Pred>
+	bool any(const Box<Float>& box, Pred&& pred) const
+	{
+		return visit(box, [this, &pred](std::uint32_t i) { return static_cast<bool>(pred(mValues[i])); });
+	}
+
+	bool any(const Box<Float>& box) const
+	{
+		return visit(box, [](std::uint32_t) { return true; });
+	}
+
+	std::vector<T*> access(const Box<Float>& box)
+	{
+		std::vector<T*> values {};
+		forEach(box, [&values](T& value) { values.push_back(&value); });
+		return values;
+	}
+
+	std::vector<std::pair<T, T>> findAllIntersections() const
+	{
+		auto intersections = std::vector<std::pair<T, T>>();
+		findIntersectionsInSlots(0, mSlots.size(), intersections);
+		findLooseIntersections(intersections);
+		return intersections;
+	}
+
+	// Same pairs as findAllIntersections, the cells being split between up to nbThreads threads
+	std::vector<std::pair<T, T>> findAllIntersectionsParallel(std::size_t nbThreads = std::thread::hardware_concurrency()) const
+	{
+		// One job per block of slots and one for the loose values, each with its own buffer
+		const auto nbJobs = mSlots.size() / SlotsPerJob + 1;
+		auto buffers = std::vector<std::vector<std::pair<T, T>>>(nbJobs + 1);
+		auto next = std::atomic<std::size_t>(0);
+		const auto work = [this, &buffers, &next, nbJobs]() {
+			for (auto i = next++; i <= nbJobs; i = next++)
+			{
+				if (i == nbJobs)
+					findLooseIntersections(buffers[i]);
+				else
+					findIntersectionsInSlots(i * SlotsPerJob, std::min(mSlots.size(), (i + 1) * SlotsPerJob), buffers[i]);
+			}
+		};
+		auto threads = std::vector<std::thread>();
+		for (auto i = std::size_t(1); i < std::min(nbThreads, nbJobs + 1); ++i)
+			threads.emplace_back(work);
+		work();
+		for (auto& thread : threads)
+			thread.join();
+
+		auto size = std::size_t(0);
+		for (const auto& buffer : buffers)
+			size += buffer.size();
+		auto intersections = std::vector<std::pair<T, T>>();
+		intersections.reserve(size);
+		for (auto& buffer : buffers)
+			std::move(std::begin(buffer), std::end(buffer), std::back_inserter(intersections));
+		return intersections;
+	}
+
+	//protected:
+	// Values overlapping more cells than this are loose
+	static constexpr auto MaxCellsPerValue = std::size_t(16);
+	static constexpr auto LooseThreshold = std::size_t(64);
+	static constexpr auto SlotsPerJob = std::size_t(4096);
+	// Key of the cell (INT32_MIN, INT32_MIN), cell coordinates are clamped above it
+	static constexpr auto EmptyKey = std::uint64_t(0x8000000080000000ull);
+
+	// Cells overlapped by a value, inclusive
+	struct Range
+	{
+		std::int32_t left;
+		std::int32_t top;
+		std::int32_t right;
+		std::int32_t bottom;
+		bool loose;
+
+		// As a double since clamped coordinates can span the whole range of std::int32_t
+		double cellCount() const
+		{
+			return (static_cast<double>(right) - left + 1) * (static_cast<double>(bottom) - top + 1);
+		}
+	};
+
+	// A non empty cell and the range of mEntries holding the indices of its values
+	struct Slot
+	{
+		std::uint64_t key = EmptyKey;
+		std::uint32_t first = 0;
+		std::uint32_t count = 0;
+	};
+
+	Float mCellSize;
+	Box<Float> mBox;
+	bool mHasBox = false;
+	std::vector<T> mValues;
+	std::vector<Box<Float>> mBoxes;
+	std::vector<Range> mRanges;
+	std::vector<std::uint32_t> mLoose;
+	std::vector<Slot> mSlots;
+	std::vector<std::uint32_t> mEntries;
+	GetBox mGetBox;
+	Equal mEqual;
+
+	void extend(const Box<Float>& box)
+	{
+		if (!std::isfinite(box.left) || !std::isfinite(box.top) || !std::isfinite(box.getRight()) || !std::isfinite(box.getBottom()))
+			return;
+		if (!mHasBox)
+		{
+			mBox = box;
+			mHasBox = true;
+			return;
+		}
+		auto left = std::min(mBox.left, box.left);
+		auto top = std::min(mBox.top, box.top);
+		mBox = Box<Float>(left, top, std::max(mBox.getRight(), box.getRight()) - left, std::max(mBox.getBottom(), box.getBottom()) - top);
+	}
+
+	std::int32_t toCell(Float coordinate) const
+	{
+		// The lowest coordinate is kept for EmptyKey, and the highest one so that loops over
+		// inclusive ranges of cells end
+		auto cell = std::floor(static_cast<double>(coordinate) / static_cast<double>(mCellSize));
+		return static_cast<std::int32_t>(std::clamp(cell, static_cast<double>(std::numeric_limits<std::int32_t>::min() + 1),
+			static_cast<double>(std::numeric_limits<std::int32_t>::max() - 1)));
+	}
+
+	Range computeRange(const Box<Float>& box) const
+	{
+		auto range = Range { toCell(box.left), toCell(box.top), toCell(box.getRight()), toCell(box.getBottom()), false };
+		range.loose = !std::isfinite(box.left) || !std::isfinite(box.top) || !std::isfinite(box.getRight()) || !std::isfinite(box.getBottom())
+			|| range.cellCount() > static_cast<double>(MaxCellsPerValue);
+		return range;
+	}
+
+	static std::uint64_t toKey(std::int32_t x, std::int32_t y)
+	{
+		return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32) | static_cast<std::uint32_t>(y);
+	}
+
+	std::size_t hash(std::uint64_t key) const
+	{
+		// Fibonacci hashing, the table size is a power of 2
+		return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (mSlots.size() - 1);
+	}
+
+	std::size_t insert(std::int32_t x, std::int32_t y)
+	{
+		auto key = toKey(x, y);
+		auto i = hash(key);
+		while (mSlots[i].key != EmptyKey && mSlots[i].key != key)
+			i = (i + 1) & (mSlots.size() - 1);
+		mSlots[i].key = key;
+		return i;
+	}
+
+	// Returns the slot of a cell, or mSlots.size() if the cell is empty
+	std::size_t lookup(std::int32_t x, std::int32_t y) const
+	{
+		auto key = toKey(x, y);
+		for (auto i = hash(key);; i = (i + 1) & (mSlots.size() - 1))
+		{
+			if (mSlots[i].key == key)
+				return i;
+			if (mSlots[i].key == EmptyKey)
+				return mSlots.size();
+		}
+	}
+
+	template <typename F>
+	void forEachCell(F&& fn) const
+	{
+		for (auto i = std::uint32_t(0); i < mRanges.size(); ++i)
+		{
+			const auto& range = mRanges[i];
+			if (range.loose)
+				continue;
+			for (auto y = range.top; y <= range.bottom; ++y)
+			{
+				for (auto x = range.left; x <= range.right; ++x)
+					fn(i, x, y);
+			}
+		}
+	}
+
+	// Calls fn on the indices of the values intersecting box until it returns true
+	template <typename F>
+	bool visit(const Box<Float>& box, F&& fn) const
+	{
+		if (!mSlots.empty())
+		{
+			auto query = computeRange(box);
+			// A value is reported by the first cell it shares with the query
+			const auto visitSlot = [this, &box, &query, &fn](const Slot& slot, std::int32_t x, std::int32_t y) {
+				for (auto j = slot.first; j < slot.first + slot.count; ++j)
+				{
+					auto i = mEntries[j];
+					const auto& range = mRanges[i];
+					if (x == std::max(range.left, query.left) && y == std::max(range.top, query.top) && box.intersects(mBoxes[i]) && fn(i))
+						return true;
+				}
+				return false;
+			};
+			// Walk the occupied cells instead of the query range when it is larger
+			if (query.loose || query.cellCount() > static_cast<double>(mSlots.size()))
+			{
+				for (const auto& slot : mSlots)
+				{
+					if (slot.key == EmptyKey)
+						continue;
+					auto x = static_cast<std::int32_t>(static_cast<std::uint32_t>(slot.key >> 32));
+					auto y = static_cast<std::int32_t>(static_cast<std::uint32_t>(slot.key));
+					if (x >= query.left && x <= query.right && y >= query.top && y <= query.bottom && visitSlot(slot, x, y))
+						return true;
+				}
+			}
+			else
+			{
+				for (auto y = query.top; y <= query.bottom; ++y)
+				{
+					for (auto x = query.left; x <= query.right; ++x)
+					{
+						auto i = lookup(x, y);
+						if (i != mSlots.size() && visitSlot(mSlots[i], x, y))
+							return true;
+					}
+				}
+			}
+		}
+		for (auto i : mLoose)
+		{
+			if (box.intersects(mBoxes[i]) && fn(i))
+				return true;
+		}
+		return false;
+	}
+
+	// Returns the index of value, looking for it around box
+	std::uint32_t find(const Box<Float>& box, const T& value) const
+	{
+		auto found = std::uint32_t(0);
+		auto present = visit(box, [this, &value, &found](std::uint32_t i) {
+			found = i;
+			return mEqual(value, mValues[i]);
+		});
+		// Boxes of width or height 0 do not intersect anything, look at every value
+		if (!present)
+		{
+			auto it = std::find_if(std::begin(mValues), std::end(mValues), [this, &value](const auto& rhs) { return mEqual(value, rhs); });
+			present = it != std::end(mValues);
+			found = static_cast<std::uint32_t>(std::distance(std::begin(mValues), it));
+		}
+		assert(present && "Trying to find a value that is not present in the grid");
+		return found;
+	}
+
+	void erase(std::uint32_t i)
+	{
+		// Unlink the value then move the last one in its place, cells reference values by index
+		replace(i, std::nullopt);
+		auto last = static_cast<std::uint32_t>(mValues.size() - 1);
+		if (i != last)
+		{
+			replace(last, i);
+			mValues[i] = std::move(mValues[last]);
+			mBoxes[i] = mBoxes[last];
+			mRanges[i] = mRanges[last];
+		}
+		mValues.pop_back();
+		mBoxes.pop_back();
+		mRanges.pop_back();
+	}
+
+	// Replaces the index i by to in the cells or the loose values, or removes it
+	void replace(std::uint32_t i, std::optional<std::uint32_t> to)
+	{
+		const auto replaceIn = [i, to](std::vector<std::uint32_t>& indices, std::size_t first, std::size_t& count) {
+			auto it = std::find(indices.begin() + first, indices.begin() + first + count, i);
+			assert(it != indices.begin() + first + count);
+			if (to)
+				*it = *to;
+			else
+			{
+				*it = indices[first + count - 1];
+				--count;
+			}
+		};
+		const auto& range = mRanges[i];
+		if (range.loose)
+		{
+			auto count = mLoose.size();
+			replaceIn(mLoose, 0, count);
+			mLoose.resize(count);
+			return;
+		}
+		for (auto y = range.top; y <= range.bottom; ++y)
+		{
+			for (auto x = range.left; x <= range.right; ++x)
+			{
+				auto& slot = mSlots[lookup(x, y)];
+				auto count = std::size_t(slot.count);
+				replaceIn(mEntries, slot.first, count);
+				slot.count = static_cast<std::uint32_t>(count);
+			}
+		}
+	}
+
+	void findIntersectionsInSlots(std::size_t first, std::size_t last, std::vector<std::pair<T, T>>& intersections) const
+	{
+		for (auto s = first; s < last; ++s)
+		{
+			const auto& slot = mSlots[s];
+			if (slot.key == EmptyKey)
+				continue;
+			auto x = static_cast<std::int32_t>(static_cast<std::uint32_t>(slot.key >> 32));
+			auto y = static_cast<std::int32_t>(static_cast<std::uint32_t>(slot.key));
+			for (auto j = slot.first; j < slot.first + slot.count; ++j)
+			{
+				for (auto k = slot.first; k < j; ++k)
+				{
+					// A pair is reported by the first cell its values share
+					const auto& a = mRanges[mEntries[j]];
+					const auto& b = mRanges[mEntries[k]];
+					if (x == std::max(a.left, b.left) && y == std::max(a.top, b.top) && mBoxes[mEntries[j]].intersects(mBoxes[mEntries[k]]))
+						intersections.emplace_back(mValues[mEntries[j]], mValues[mEntries[k]]);
+				}
+			}
+		}
+	}
+
+	void findLooseIntersections(std::vector<std::pair<T, T>>& intersections) const
+	{
+		// Loose values against the values of the cells, then against each other
+		for (auto j = std::size_t(0); j < mLoose.size(); ++j)
+		{
+			auto i = mLoose[j];
+			visit(mBoxes[i], [this, i, &intersections](std::uint32_t k) {
+				if (!mRanges[k].loose)
+					intersections.emplace_back(mValues[i], mValues[k]);
+				return false;
+			});
+			for (auto k = std::size_t(0); k < j; ++k)
+			{
+				if (mBoxes[i].intersects(mBoxes[mLoose[k]]))
+					intersections.emplace_back(mValues[i], mValues[mLoose[k]]);
+			}
+		}
+	}
+};
+
+}
@@ -0,0 +1,515 @@
+#pragma once
+
+#include "quadtree/quadtree.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <ranges>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace layered
+{
+
+using quadtree::Box;
+using quadtree::Layer;
+using quadtree::Vector2;
+
+// Input range over the values of a range followed by the ones of another range yielding the
+// same references, like the views of both layers of a LayeredIndex
+template <typename First, typename Second>
+class ConcatView : public std::ranges::view_interface<ConcatView<First, Second>>
+{
+public:
+	using Reference = std::ranges::range_reference_t<const First>;
+	static_assert(std::same_as<Reference, std::ranges::range_reference_t<const Second>>, "Both ranges must yield the same references");
+
+	class Iterator
+	{
+	public:
+		using iterator_concept = std::input_iterator_tag;
+		using value_type = std::ranges::range_value_t<const First>;
+		using difference_type = std::ptrdiff_t;
+
+		Iterator() = default;
+
+		explicit Iterator(const ConcatView& view) :
+			mFirst(std::ranges::begin(view.mFirst)),
+			mFirstEnd(std::ranges::end(view.mFirst)),
+			mSecond(std::ranges::begin(view.mSecond)),
+			mSecondEnd(std::ranges::end(view.mSecond))
+		{
+		}
+
+		Reference operator*() const
+		{
+			return mFirst != mFirstEnd ? *mFirst : *mSecond;
+		}
+
+		Iterator& operator++()
+		{
+			if (mFirst != mFirstEnd)
+				++mFirst;
+			else
+				++mSecond;
+			return *this;
+		}
+
+		void operator++(int)
+		{
+			++*this;
+		}
+
+		friend bool operator==(const Iterator& it, std::default_sentinel_t)
+		{
+			return it.mFirst == it.mFirstEnd && it.mSecond == it.mSecondEnd;
+		}
+
+	private:
+		std::ranges::iterator_t<const First> mFirst {};
+		std::ranges::sentinel_t<const First> mFirstEnd {};
+		std::ranges::iterator_t<const Second> mSecond {};
+		std::ranges::sentinel_t<const Second> mSecondEnd {};
+	};
+
+	ConcatView() = default;
+
+	ConcatView(First first, Second second) :
+		mFirst(std::move(first)),
+		mSecond(std::move(second))
+	{
+	}
+
+	Iterator begin() const
+	{
+		return Iterator(*this);
+	}
+
+	std::default_sentinel_t end() const
+	{
+		return std::default_sentinel;
+	}
+
+private:
+	First mFirst {};
+	Second mSecond {};
+};
+
+// Keeps the values that never move apart from the others, in two spatial indexes with the same
+// interface as quadtree::Quadtree. IsStatic tells on which side a value goes when it is added.
+// The static index is only changed by add, remove, insertAll and build, so it can use a compact
+// layout that is slow to update, and the pairs of static values are never looked for: the
+// broadphase is the dynamic pairs followed by the pairs of a dynamic value and a static one.
+// add inserts a static value on its own, static values arriving over time are better batched
+// with insertAll which builds the static index again in one pass.
+// Both indexes are constructed from the same parameters.
+template <typename T, typename IsStatic, typename Static, typename Dynamic = Static, typename Float = float>
+class LayeredIndex
+{
+public:
+	template <typename... Parameters>
+		requires std::constructible_from<Static, const Parameters&...> && std::constructible_from<Dynamic, const Parameters&...>
+	explicit LayeredIndex(const Parameters&... parameters) :
+		mStatic(parameters...),
+		mDynamic(parameters...)
+	{
+	}
+
+	LayeredIndex(Static staticIndex, Dynamic dynamicIndex) :
+		mStatic(std::move(staticIndex)),
+		mDynamic(std::move(dynamicIndex))
+	{
+	}
+
+	Box<Float> getBox() const
+	{
+		if (mStatic.size() == 0)
+			return mDynamic.getBox();
+		if (mDynamic.size() == 0)
+			return mStatic.getBox();
+		const auto lhs = mStatic.getBox();
+		const auto rhs = mDynamic.getBox();
+		const auto left = std::min(lhs.left, rhs.left);
+		const auto top = std::min(lhs.top, rhs.top);
+		return Box<Float>(left, top, std::max(lhs.getRight(), rhs.getRight()) - left, std::max(lhs.getBottom(), rhs.getBottom()) - top);
+	}
+
+	std::size_t size() const
+	{
+		return mStatic.size() + mDynamic.size();
+	}
+
+	void clear()
+	{
+		mStatic.clear();
+		mDynamic.clear();
+	}
+
+	const Static& getStatic() const
+	{
+		return mStatic;
+	}
+
+	const Dynamic& getDynamic() const
+	{
+		return mDynamic;
+	}
+
+	T& add(const T& value)
+	{
+		return mIsStatic(value) ? mStatic.add(value) : mDynamic.add(value);
+	}
+
+	void remove(const T& value)
+	{
+		if (mIsStatic(value))
+			mStatic.remove(value);
+		else
+			mDynamic.remove(value);
+	}
+
+	// Static values do not move, only dynamic ones are updated and relocated
+	void update(const T& value, const Box<Float>& oldBox)
+	{
+		assert(!mIsStatic(value) && "Trying to move a static value");
+		mDynamic.update(value, oldBox);
+	}
+
+	template <typename Range>
+	void relocate(const Range& moved)
+	{
+		mDynamic.relocate(moved);
+	}
+
+	// Adds values in one pass: the static index is built again from its values and the new
+	// static ones so that it stays compact, the dynamic ones are inserted in the dynamic index
+	template <typename Range>
+	void insertAll(const Range& values)
+	{
+		auto staticValues = std::vector<T>();
+		auto dynamicValues = std::vector<T>();
+		for (const auto& value : values)
+		{
+			if (mIsStatic(value))
+				staticValues.push_back(value);
+			else
+				dynamicValues.push_back(value);
+		}
+		if (!staticValues.empty())
+		{
+			mStatic.forEach(Everything, [&staticValues](const T& value) { staticValues.push_back(value); });
+			mStatic.build(staticValues);
+		}
+		if constexpr (requires { mDynamic.insertAll(dynamicValues); })
+			mDynamic.insertAll(dynamicValues);
+		else
+		{
+			for (const auto& value : dynamicValues)
+				mDynamic.add(value);
+		}
+	}
+
+	// Replaces the content of both indexes, the static one being built in one pass
+	template <typename Range>
+	void build(const Range& values)
+	{
+		auto staticValues = std::vector<T>();
+		auto dynamicValues = std::vector<T>();
+		for (const auto& value : values)
+		{
+			if (mIsStatic(value))
+				staticValues.push_back(value);
+			else
+				dynamicValues.push_back(value);
+		}
+		mStatic.build(staticValues);
+		mDynamic.build(dynamicValues);
+	}
+
+	// Handles of the dynamic values, for the indexes handing out handles
+	auto handles(const Box<Float>& box) const
+		requires requires(const Dynamic& index) { index.handles(box); }
+	{
+		return mDynamic.handles(box);
+	}
+
+	template <typename Handle>
+	decltype(auto) get(Handle handle)
+		requires requires(Dynamic& index) { index.get(handle); }
+	{
+		return mDynamic.get(handle);
+	}
+
+	template <typename Handle>
+	decltype(auto) get(Handle handle) const
+		requires requires(const Dynamic& index) { index.get(handle); }
+	{
+		return mDynamic.get(handle);
+	}
+
+	std::vector<T> query(const Box<Float>& box) const
+	{
+		auto values = mStatic.query(box);
+		auto dynamicValues = mDynamic.query(box);
+		std::move(dynamicValues.begin(), dynamicValues.end(), std::back_inserter(values));
+		return values;
+	}
+
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn) const
+	{
+		mStatic.forEach(box, fn);
+		mDynamic.forEach(box, fn);
+	}
+
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn)
+	{
+		mStatic.forEach(box, fn);
+		mDynamic.forEach(box, fn);
+	}
+
+	std::size_t count(const Box<Float>& box) const
+	{
+		return mStatic.count(box) + mDynamic.count(box);
+	}
+
+	template <typename Pred>
+	bool any(const Box<Float>& box, Pred&& pred) const
+	{
+		return mStatic.any(box, pred) || mDynamic.any(box, pred);
+	}
+
+	bool any(const Box<Float>& box) const
+	{
+		return mStatic.any(box) || mDynamic.any(box);
+	}
+
+	// Queries by layer, for the indexes filtering their values
+	template <typename F>
+	void forEach(const Box<Float>& box, const Layer& layer, F&& fn) const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.forEach(box, layer, fn); rhs.forEach(box, layer, fn); }
+	{
+		mStatic.forEach(box, layer, fn);
+		mDynamic.forEach(box, layer, fn);
+	}
+
+	template <typename F>
+	void forEach(const Box<Float>& box, const Layer& layer, F&& fn)
+		requires requires(Static& lhs, Dynamic& rhs) { lhs.forEach(box, layer, fn); rhs.forEach(box, layer, fn); }
+	{
+		mStatic.forEach(box, layer, fn);
+		mDynamic.forEach(box, layer, fn);
+	}
+
+	std::size_t count(const Box<Float>& box, const Layer& layer) const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.count(box, layer); rhs.count(box, layer); }
+	{
+		return mStatic.count(box, layer) + mDynamic.count(box, layer);
+	}
+
+	template <typename Pred>
+	bool any(const Box<Float>& box, const Layer& layer, Pred&& pred) const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.any(box, layer, pred); rhs.any(box, layer, pred); }
+	{
+		return mStatic.any(box, layer, pred) || mDynamic.any(box, layer, pred);
+	}
+
+	std::vector<T*> access(const Box<Float>& box)
+	{
+		auto values = mStatic.access(box);
+		auto dynamicValues = mDynamic.access(box);
+		values.insert(values.end(), dynamicValues.begin(), dynamicValues.end());
+		return values;
+	}
+
+	// Lazy ranges of the static values followed by the dynamic ones, for the indexes having them
+	auto view(const Box<Float>& box)
+		requires requires(Static& lhs, Dynamic& rhs) { lhs.view(box); rhs.view(box); }
+	{
+		return ConcatView(mStatic.view(box), mDynamic.view(box));
+	}
+
+	auto view(const Box<Float>& box) const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.view(box); rhs.view(box); }
+	{
+		return ConcatView(mStatic.view(box), mDynamic.view(box));
+	}
+
+	auto all()
+		requires requires(Static& lhs, Dynamic& rhs) { lhs.all(); rhs.all(); }
+	{
+		return ConcatView(mStatic.all(), mDynamic.all());
+	}
+
+	auto all() const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.all(); rhs.all(); }
+	{
+		return ConcatView(mStatic.all(), mDynamic.all());
+	}
+
+	// First hit of both indexes, for the indexes answering segment casts
+	template <typename Pred>
+	auto segmentCast(const Vector2<Float>& from, const Vector2<Float>& to, Pred&& pred) const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.segmentCast(from, to, pred); rhs.segmentCast(from, to, pred); }
+	{
+		auto hit = mStatic.segmentCast(from, to, pred);
+		auto dynamicHit = mDynamic.segmentCast(from, to, pred);
+		if (dynamicHit && (!hit || dynamicHit->second < hit->second))
+			hit = std::move(dynamicHit);
+		return hit;
+	}
+
+	auto segmentCast(const Vector2<Float>& from, const Vector2<Float>& to) const
+		requires requires(const LayeredIndex& index) { index.segmentCast(from, to, [](const T&) { return true; }); }
+	{
+		return segmentCast(from, to, [](const T&) { return true; });
+	}
+
+	// The k values closest to point in both indexes, closest first, for the indexes answering
+	// nearest queries
+	template <typename F>
+	void forEachNearest(const Vector2<Float>& point, std::size_t k, F&& fn) const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.forEachNearest(point, k, fn); rhs.forEachNearest(point, k, fn); }
+	{
+		for (const auto* value : nearest<const T>(*this, point, k))
+			fn(*value);
+	}
+
+	template <typename F>
+	void forEachNearest(const Vector2<Float>& point, std::size_t k, F&& fn)
+		requires requires(Static& lhs, Dynamic& rhs) { lhs.forEachNearest(point, k, fn); rhs.forEachNearest(point, k, fn); }
+	{
+		for (auto* value : nearest<T>(*this, point, k))
+			fn(*value);
+	}
+
+	// Summaries of both indexes combined, for the quadtrees keeping aggregates of the same type
+	auto summarize() const
+		requires requires(const Static& lhs, const Dynamic& rhs) { rhs.mAggregate.combine(lhs.summarize(), rhs.summarize()); }
+	{
+		return mDynamic.mAggregate.combine(mStatic.summarize(), mDynamic.summarize());
+	}
+
+	auto summarize(const Box<Float>& box) const
+		requires requires(const Static& lhs, const Dynamic& rhs) { rhs.mAggregate.combine(lhs.summarize(box), rhs.summarize(box)); }
+	{
+		return mDynamic.mAggregate.combine(mStatic.summarize(box), mDynamic.summarize(box));
+	}
+
+	// Shapes of both indexes added together, the query counters are the dynamic index's as
+	// the static one is usually built without them
+	auto getStats() const
+		requires requires(const Static& lhs, const Dynamic& rhs) { lhs.getStats(); rhs.getStats(); }
+	{
+		auto stats = mDynamic.getStats();
+		stats += mStatic.getStats();
+		return stats;
+	}
+
+	void resetStats()
+		requires requires(Static& lhs, Dynamic& rhs) { lhs.resetStats(); rhs.resetStats(); }
+	{
+		mStatic.resetStats();
+		mDynamic.resetStats();
+	}
+
+	std::vector<std::pair<T, T>> findAllIntersections() const
+	{
+		auto intersections = mDynamic.findAllIntersections();
+		const auto dynamicValues = getDynamicValues();
+		findStaticIntersections(dynamicValues.data(), dynamicValues.data() + dynamicValues.size(), intersections);
+		return intersections;
+	}
+
+	// Same pairs as findAllIntersections, in another order, the dynamic values being split
+	// between nbThreads threads to look for the static values they intersect
+	std::vector<std::pair<T, T>> findAllIntersectionsParallel(std::size_t nbThreads = std::thread::hardware_concurrency()) const
+	{
+		auto intersections = mDynamic.findAllIntersectionsParallel(nbThreads);
+		if (mStatic.size() == 0)
+			return intersections;
+		const auto dynamicValues = getDynamicValues();
+		const auto nbJobs = std::min(std::max(nbThreads, std::size_t(1)), dynamicValues.size() / ParallelCutoff + 1);
+		auto buffers = std::vector<std::vector<std::pair<T, T>>>(nbJobs);
+		const auto work = [this, &dynamicValues, &buffers, nbJobs](std::size_t job) {
+			const auto first = dynamicValues.data() + dynamicValues.size() * job / nbJobs;
+			const auto last = dynamicValues.data() + dynamicValues.size() * (job + 1) / nbJobs;
+			findStaticIntersections(first, last, buffers[job]);
+		};
+		auto threads = std::vector<std::thread>();
+		for (auto job = std::size_t(1); job < nbJobs; ++job)
+			threads.emplace_back(work, job);
+		work(0);
+		for (auto& thread : threads)
+			thread.join();
+
+		for (auto& buffer : buffers)
+			std::move(std::begin(buffer), std::end(buffer), std::back_inserter(intersections));
+		return intersections;
+	}
+
+	//protected:
+	// Number of dynamic values below which a single thread looks for the static intersections
+	static constexpr auto ParallelCutoff = std::size_t(1024);
+
+	// Intersects every box, including the infinite ones
+	static constexpr auto Everything = Box<Float>(std::numeric_limits<Float>::lowest(), std::numeric_limits<Float>::lowest(),
+		std::numeric_limits<Float>::infinity(), std::numeric_limits<Float>::infinity());
+
+	Static mStatic;
+	Dynamic mDynamic;
+	[[no_unique_address]] IsStatic mIsStatic;
+
+	// Merges the k nearest values of each index by their distance to point, the box of a value
+	// being read with the accessor of its index
+	template <typename U, typename Self>
+	static std::vector<U*> nearest(Self& self, const Vector2<Float>& point, std::size_t k)
+	{
+		const auto squaredDistance = [&point](const Box<Float>& box) {
+			const auto dx = std::max({ box.left - point.x, Float(0), point.x - box.getRight() });
+			const auto dy = std::max({ box.top - point.y, Float(0), point.y - box.getBottom() });
+			return dx * dx + dy * dy;
+		};
+		auto found = std::vector<std::pair<Float, U*>>();
+		self.mStatic.forEachNearest(point, k, [&self, &found, &squaredDistance](U& value) { found.emplace_back(squaredDistance(self.mStatic.mGetBox(value)), &value); });
+		const auto middle = found.size();
+		self.mDynamic.forEachNearest(point, k, [&self, &found, &squaredDistance](U& value) { found.emplace_back(squaredDistance(self.mDynamic.mGetBox(value)), &value); });
+		std::inplace_merge(found.begin(), found.begin() + middle, found.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+		auto values = std::vector<U*>();
+		for (auto i = std::size_t(0); i < std::min(k, found.size()); ++i)
+			values.push_back(found[i].second);
+		return values;
+	}
+
+	std::vector<const T*> getDynamicValues() const
+	{
+		auto values = std::vector<const T*>();
+		values.reserve(mDynamic.size());
+		mDynamic.forEach(Everything, [&values](const T& value) { values.push_back(&value); });
+		return values;
+	}
+
+	void findStaticIntersections(const T* const* first, const T* const* last, std::vector<std::pair<T, T>>& intersections) const
+	{
+		for (auto it = first; it != last; ++it)
+		{
+			// The values are dynamic, their box and layer come from the accessors of the dynamic index
+			const auto& value = **it;
+			const auto report = [&value, &intersections](const T& other) { intersections.emplace_back(value, other); };
+			// Both layers filtering by layer only report the static values colliding with value
+			if constexpr (requires { mStatic.forEach(mDynamic.mGetBox(value), mDynamic.mFilter.layer(value), report); })
+				mStatic.forEach(mDynamic.mGetBox(value), mDynamic.mFilter.layer(value), report);
+			else
+				mStatic.forEach(mDynamic.mGetBox(value), report);
+		}
+	}
+};
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+namespace quadtree
+{
+
+// Aggregate policies decide whether each node of a Quadtree keeps a summary of its subtree.
+// A policy exposes Enabled and, if it is true:
+//  - a Summary type whose default constructed value is the summary of no value
+//  - summarize(value, box) returning the Summary of a single value
+//  - combine(lhs, rhs) merging two summaries, it must be associative and commutative as the
+//    values and the subtrees of a node are combined in no particular order
+// The summaries are kept exact as values are added, removed, updated and relocated. A value
+// modified in place must be updated for the summaries to see the change, even if its box
+// did not change.
+
+// Nothing is summarized or stored
+struct NoAggregate
+{
+	static constexpr auto Enabled = false;
+
+	struct Summary
+	{
+	};
+};
+
+// Number of values of each subtree
+struct CountAggregate
+{
+	static constexpr auto Enabled = true;
+
+	using Summary = std::size_t;
+
+	template <typename T, typename Box>
+	Summary summarize(const T&, const Box&) const
+	{
+		return 1;
+	}
+
+	Summary combine(Summary lhs, Summary rhs) const
+	{
+		return lhs + rhs;
+	}
+};
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace quadtree
+{
+
+// Results of a batch of queries in compressed sparse rows: the values found by the i-th query
+// are values[offsets[i]] to values[offsets[i + 1]]. The buffers are kept between batches.
+template <typename V>
+struct BatchResults
+{
+	std::vector<std::size_t> offsets;
+	std::vector<V> values;
+
+	std::size_t size() const
+	{
+		return offsets.empty() ? 0 : offsets.size() - 1;
+	}
+
+	std::span<const V> operator[](std::size_t i) const
+	{
+		assert(i + 1 < offsets.size());
+		return std::span<const V>(values.data() + offsets[i], offsets[i + 1] - offsets[i]);
+	}
+
+	// Sorts the (query, value) pairs found in any order by query, with a counting sort
+	void assign(std::size_t nbQueries, const std::vector<std::pair<std::uint32_t, V>>& found)
+	{
+		offsets.assign(nbQueries + 1, 0);
+		for (const auto& [query, value] : found)
+			++offsets[query + 1];
+		for (auto i = std::size_t(1); i < offsets.size(); ++i)
+			offsets[i] += offsets[i - 1];
+		values.resize(found.size());
+		auto next = std::vector<std::size_t>(offsets.begin(), offsets.end() - 1);
+		for (const auto& [query, value] : found)
+			values[next[query]++] = value;
+	}
+};
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <ratio>
+
+namespace quadtree
+{
+
+// Bounds policies decide which values a node may hold.
+// A policy exposes Loose and, if it is true, Factor the ratio between the box of a node and its
+// cell, the quadrant of its parent it is centered on
+
+// A value is routed to the deepest cell containing it, values crossing the center lines of a
+// node stay in that node whatever their size
+struct TightBounds
+{
+	static constexpr auto Loose = false;
+};
+
+// Nodes are enlarged by Factor around their cell and a value is routed to the child whose cell
+// contains its center, as long as it still fits in the child's enlarged box. The depth of a
+// value only depends on its size, but the boxes of sibling nodes overlap.
+template <typename Ratio = std::ratio<2>>
+struct LooseBounds
+{
+	static constexpr auto Loose = true;
+	static constexpr auto Factor = static_cast<double>(Ratio::num) / static_cast<double>(Ratio::den);
+	static_assert(Ratio::num > Ratio::den, "Loose boxes must be larger than their cell");
+};
+
+}
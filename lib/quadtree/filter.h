@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+namespace quadtree
+{
+
+// Collision categories, one bit each
+using Categories = std::uint32_t;
+
+inline constexpr auto AllCategories = ~Categories(0);
+
+// Category of a value and mask of the categories it collides with. Two values collide when
+// the category of each one is in the mask of the other.
+struct Layer
+{
+	Categories category = 1;
+	Categories mask = AllCategories;
+
+	constexpr bool collides(const Layer& other) const noexcept
+	{
+		return (category & other.mask) != 0 && (other.category & mask) != 0;
+	}
+
+	friend bool operator==(const Layer&, const Layer&) = default;
+};
+
+// Collides with every value whatever its layer
+inline constexpr auto AnyLayer = Layer { AllCategories, AllCategories };
+
+// Filter policies decide whether the values of a Quadtree have layers.
+// A policy exposes Enabled and, if it is true, layer(value) returning the Layer of a value.
+// With layers, each node keeps the union of the categories of its subtree, the pairs that do
+// not collide are not reported and the queries given a layer skip the subtrees it cannot
+// collide with.
+
+// Every value collides with every other, nothing is stored
+struct NoFilter
+{
+	static constexpr auto Enabled = false;
+};
+
+// Layers read from the values by GetLayer, a callable of signature Layer(const T&)
+template <typename GetLayer>
+struct CategoryFilter
+{
+	static constexpr auto Enabled = true;
+
+	[[no_unique_address]] GetLayer getLayer;
+
+	template <typename T>
+	Layer layer(const T& value) const
+	{
+		return getLayer(value);
+	}
+};
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace quadtree
+{
+
+// Collects values added from many threads at once and adds them to a spatial index on flush.
+// Each thread appends to one of a few shards chosen by its id, each with its own lock, so
+// producers rarely wait for each other and never for the index. The values are only visible
+// to the queries of the index once flushed, and flush must not run concurrently with insert.
+template <typename T, typename Index>
+class ConcurrentInserter
+{
+public:
+	explicit ConcurrentInserter(Index& index, std::size_t nbShards = 2 * std::max(std::thread::hardware_concurrency(), 1u)) :
+		mIndex(index),
+		mShards(std::make_unique<Shard[]>(nbShards)),
+		mNbShards(nbShards)
+	{
+	}
+
+	// Safe to call from any number of threads
+	void insert(const T& value)
+	{
+		auto& shard = mShards[std::hash<std::thread::id>()(std::this_thread::get_id()) % mNbShards];
+		auto lock = std::lock_guard(shard.mutex);
+		shard.values.push_back(value);
+	}
+
+	// Adds the pending values to the index in one pass when it supports it, returns their number
+	std::size_t flush()
+	{
+		auto values = std::vector<T>();
+		for (auto i = std::size_t(0); i < mNbShards; ++i)
+		{
+			auto& shard = mShards[i];
+			values.insert(values.end(), std::make_move_iterator(shard.values.begin()), std::make_move_iterator(shard.values.end()));
+			shard.values.clear();
+		}
+		if constexpr (requires { mIndex.insertAll(values); })
+			mIndex.insertAll(values);
+		else
+		{
+			for (const auto& value : values)
+				mIndex.add(value);
+		}
+		return values.size();
+	}
+
+	//protected:
+	// Shards are kept on their own cache lines so that threads appending to neighboring shards
+	// do not share one
+	struct alignas(64) Shard
+	{
+		std::mutex mutex;
+		std::vector<T> values;
+	};
+
+	Index& mIndex;
+	std::unique_ptr<Shard[]> mShards;
+	std::size_t mNbShards;
+};
+
+}
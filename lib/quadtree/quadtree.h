@@ -1,9 +1,28 @@
 #pragma once
 
+#include "aggregate.h"
+#include "batch.h"
+#include "bounds.h"
+#include "filter.h"
+#include "simd.h"
+#include "slotmap.h"
+#include "split.h"
+#include "stats.h"
+#include "storage.h"
 #include <SFML/Graphics.hpp>
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
@@ -144,7 +163,7 @@ public:
 	}
 };
 
-template <typename T, typename GetBox, typename Equal = std::equal_to<T>, typename Float = float>
+template <typename T, typename GetBox, typename Equal = std::equal_to<T>, typename Float = float, typename Storage = PointerStorage, typename Stats = NoStats, typename Split = FixedSplit<>, typename Bounds = TightBounds, typename Filter = NoFilter, typename Aggregate = NoAggregate>
 class Quadtree
 {
 	static_assert(std::is_convertible_v<std::invoke_result_t<GetBox, const T&>, Box<Float>>,
@@ -152,66 +171,968 @@ class Quadtree
 	static_assert(std::is_convertible_v<std::invoke_result_t<Equal, const T&, const T&>, bool>,
 		"Equal must be a callable of signature bool(const T&, const T&)");
 	static_assert(std::is_arithmetic_v<Float>);
+	static_assert(!Bounds::Loose || std::is_floating_point_v<Float>, "Loose boxes need a floating point type");
 
 public:
 	Quadtree(const Box<Float>& box, const GetBox& getBox = GetBox(),
 		const Equal& equal = Equal()) :
 		mBox(box),
-		mRoot(std::make_unique<Node>()),
 		mGetBox(getBox),
 		mEqual(equal)
 	{
 	}
 
-	auto add(const T& value)
+	// The box given at construction is only the initial box of the root. The root grows when
+	// values are added outside of it and shrinks when values only remain in one of its quadrants.
+	const Box<Float>& getBox() const
 	{
-		return add(mRoot.get(), 0, mBox, value);
+		return mBox;
+	}
+
+	// Values are stored in a slot map and the nodes only hold their indices, so a handle or a
+	// reference to a value stays valid until the value is removed, whatever the tree does
+	Handle insert(const T& value)
+	{
+		auto index = mSlots.insert(value);
+		if (index >= mBoxes.size())
+			mBoxes.resize(index + 1);
+		mBoxes[index] = mGetBox(mSlots[index]);
+		cacheLayer(index);
+		place(index);
+		return mSlots.getHandle(index);
+	}
+
+	T& add(const T& value)
+	{
+		return get(insert(value));
+	}
+
+	// Same as insert for a range of values, returns their handles in the same order
+	// An empty tree is bulk loaded. Otherwise the root is grown once to fit all of them and they
+	// are added in the Morton order of their node, so that consecutive values walk the same nodes.
+	template <typename Range>
+	std::vector<Handle> insertAll(const Range& values)
+	{
+		auto handles = std::vector<Handle>();
+		if (size() == 0)
+		{
+			build(values);
+			for (auto i = std::uint32_t(0); i < mSlots.end(); ++i)
+				handles.push_back(mSlots.getHandle(i));
+			return handles;
+		}
+		auto keys = std::vector<std::pair<std::uint64_t, std::uint32_t>>();
+		for (const auto& value : values)
+		{
+			auto index = mSlots.insert(value);
+			if (index >= mBoxes.size())
+				mBoxes.resize(index + 1);
+			mBoxes[index] = mGetBox(mSlots[index]);
+			cacheLayer(index);
+			if (!fits(mBoxes[index]))
+				grow(mBoxes[index]);
+			keys.emplace_back(0, index);
+			handles.push_back(mSlots.getHandle(index));
+		}
+		for (auto& [key, index] : keys)
+			key = computeKey(mBoxes[index]);
+		radixSort(keys);
+		for (const auto& [key, index] : keys)
+			place(index);
+		return handles;
 	}
 
 	void remove(const T& value)
 	{
-		remove(mRoot.get(), nullptr, mBox, value);
+		remove(mGetBox(value), [this, &value](std::uint32_t i) { return mEqual(value, mSlots[i]); });
+	}
+
+	void remove(Handle handle)
+	{
+		assert(contains(handle) && "Trying to remove a value that is not present in the tree");
+		remove(mBoxes[handle.index], [index = handle.index](std::uint32_t i) { return i == index; });
+	}
+
+	// Moves a value whose box changed from oldBox to the node matching its current box
+	// The tree caches the box of each value, a value modified in place is still found at its
+	// old box until it is updated
+	void update(const T& value, const Box<Float>& oldBox)
+	{
+		relocate(std::array<std::pair<T, Box<Float>>, 1> { std::pair<T, Box<Float>>(value, oldBox) });
+	}
+
+	// Same as above for a value modified in place through its handle, without copying it
+	void update(Handle handle)
+	{
+		relocate(std::array<Handle, 1> { handle });
+	}
+
+	// Same as update for a range of (value, oldBox) pairs or of handles
+	// Values may already have been modified in place, so all of them are detached before
+	// any is added back, and emptied nodes are merged once at the end
+	template <typename Range>
+	void relocate(const Range& moved)
+	{
+		auto detached = std::vector<std::uint32_t>();
+		auto merges = std::vector<std::pair<std::size_t, NodeId>>();
+		for (const auto& entry : moved)
+		{
+			if constexpr (std::is_same_v<std::remove_cvref_t<decltype(entry)>, Handle>)
+			{
+				assert(contains(entry) && "Trying to relocate a value that is not present in the tree");
+				// The cached box is copied as detach replaces it
+				auto oldBox = mBoxes[entry.index];
+				detach(oldBox, [index = entry.index](std::uint32_t i) { return i == index; }, nullptr, detached, merges);
+			}
+			else
+			{
+				const auto& [value, oldBox] = entry;
+				detach(oldBox, [this, &value](std::uint32_t i) { return mEqual(value, mSlots[i]); }, &value, detached, merges);
+			}
+		}
+		// The values are added back from the root, as a later detach may have refreshed the
+		// nodes above the one a value was detached from without it. Values leaving the tree are
+		// added last as growing the root changes the nodes' depths.
+		auto outside = std::vector<std::uint32_t>();
+		for (auto index : detached)
+		{
+			if (fits(mBoxes[index]))
+				add(mNodes.root(), 0, mBox, index);
+			else
+				outside.push_back(index);
+		}
+		mergeAll(merges);
+		for (auto index : outside)
+			place(index);
+		shrink();
+		mSplit.adapt();
+	}
+
+	std::size_t size() const
+	{
+		return mSlots.size();
+	}
+
+	// Removes every value at once, the box of the root is kept
+	void clear()
+	{
+		mNodes.clear();
+		mSlots.clear();
+		mBoxes.clear();
+		mLayers.clear();
+	}
+
+	// Walks the nodes to describe the shape of the tree, the query counters are only
+	// maintained with CountStats
+	TreeStats getStats() const
+	{
+		auto stats = TreeStats();
+		stats.values = mSlots.size();
+		stats.bytes = sizeof(*this) + mNodes.bytes() + mSlots.bytes() + mBoxes.capacity() * sizeof(Box<Float>);
+		auto stack = std::vector<std::pair<NodeId, std::size_t>> { { mNodes.root(), 0 } };
+		while (!stack.empty())
+		{
+			auto [node, depth] = stack.back();
+			stack.pop_back();
+			auto nbValues = mNodes.values(node).size();
+			++stats.nodes;
+			if (depth >= stats.nodesPerDepth.size())
+				stats.nodesPerDepth.resize(depth + 1);
+			++stats.nodesPerDepth[depth];
+			if (nbValues >= stats.valuesPerNode.size())
+				stats.valuesPerNode.resize(nbValues + 1);
+			++stats.valuesPerNode[nbValues];
+			if (isLeaf(node))
+				++stats.leaves;
+			else
+			{
+				stats.interiorValues += nbValues;
+				for (auto i = std::size_t(0); i < 4; ++i)
+					stack.emplace_back(mNodes.child(node, i), depth + 1);
+			}
+		}
+		mStats.read(stats);
+		return stats;
+	}
+
+	void resetStats()
+	{
+		mStats.reset();
+	}
+
+	bool contains(Handle handle) const
+	{
+		return mSlots.contains(handle);
+	}
+
+	T& get(Handle handle)
+	{
+		assert(contains(handle));
+		return mSlots[handle.index];
+	}
+
+	const T& get(Handle handle) const
+	{
+		assert(contains(handle));
+		return mSlots[handle.index];
+	}
+
+	// Replaces the content of the tree by values, the box of the root becoming their bounds
+	// Values are sorted by the Morton code of the node they belong to with a radix sort, and
+	// the nodes are created in one pass over the sorted values instead of by repeated splits
+	template <typename Range>
+	void build(const Range& values)
+	{
+		mSlots.clear();
+		auto indices = std::vector<std::uint32_t>();
+		auto boxes = std::vector<Box<Float>>();
+		for (const auto& value : values)
+		{
+			indices.push_back(mSlots.insert(value));
+			boxes.push_back(mGetBox(mSlots[indices.back()]));
+		}
+		mBoxes.resize(mSlots.end());
+		mLayers.clear();
+		for (auto i = std::size_t(0); i < indices.size(); ++i)
+		{
+			mBoxes[indices[i]] = boxes[i];
+			cacheLayer(indices[i]);
+		}
+		fitBox(boxes);
+		load(indices);
+	}
+
+	std::vector<T> query(const Box<Float>& box) const
+	{
+		auto values = std::vector<T>();
+		forEach(box, [&values](const T& value) { values.push_back(value); });
+		return values;
+	}
+
+	// Calls fn on every value intersecting box without allocating
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn) const
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mSlots[i]); return false; });
+	}
+
+	// Same as forEach but fn may modify the values in place, without changing their boxes
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn)
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mSlots[i]); return false; });
+	}
+
+	std::size_t count(const Box<Float>& box) const
+	{
+		auto n = std::size_t(0);
+		forEach(box, [&n](const T&) { ++n; });
+		return n;
+	}
+
+	// Returns true as soon as a value intersecting box satisfies pred
+	template <typename Pred>
+	bool any(const Box<Float>& box, Pred&& pred) const
+	{
+		return visit(box, [this, &pred](std::uint32_t i) { return static_cast<bool>(pred(mSlots[i])); });
+	}
+
+	bool any(const Box<Float>& box) const
+	{
+		return any(box, [](const T&) { return true; });
+	}
+
+	// Same as above for the values colliding with layer, the subtrees without any category of
+	// its mask are skipped
+	template <typename F>
+	void forEach(const Box<Float>& box, const Layer& layer, F&& fn) const
+		requires Filter::Enabled
+	{
+		visit(box, layer, [this, &fn](std::uint32_t i) { fn(mSlots[i]); return false; });
+	}
+
+	template <typename F>
+	void forEach(const Box<Float>& box, const Layer& layer, F&& fn)
+		requires Filter::Enabled
+	{
+		visit(box, layer, [this, &fn](std::uint32_t i) { fn(mSlots[i]); return false; });
+	}
+
+	std::vector<T> query(const Box<Float>& box, const Layer& layer) const
+		requires Filter::Enabled
+	{
+		auto values = std::vector<T>();
+		forEach(box, layer, [&values](const T& value) { values.push_back(value); });
+		return values;
+	}
+
+	std::size_t count(const Box<Float>& box, const Layer& layer) const
+		requires Filter::Enabled
+	{
+		auto n = std::size_t(0);
+		forEach(box, layer, [&n](const T&) { ++n; });
+		return n;
+	}
+
+	template <typename Pred>
+	bool any(const Box<Float>& box, const Layer& layer, Pred&& pred) const
+		requires Filter::Enabled
+	{
+		return visit(box, layer, [this, &pred](std::uint32_t i) { return static_cast<bool>(pred(mSlots[i])); });
+	}
+
+	// Summary of all the values, read from the root
+	const typename Aggregate::Summary& summarize() const
+		requires Aggregate::Enabled
+	{
+		return mNodes.summary(mNodes.root());
+	}
+
+	// Summary of the values intersecting box, the children whose content lies strictly inside
+	// box are read from their summaries without being walked
+	typename Aggregate::Summary summarize(const Box<Float>& box) const
+		requires Aggregate::Enabled
+	{
+		mStats.countQuery();
+		return summarize(mNodes.root(), box);
+	}
+
+	// Walks the tree for level of detail and far field approximations. open(box, summary) is
+	// called on each non empty node with the bounds of its values and the summary of its
+	// subtree: if it returns false, fn(box, summary) stands for the whole subtree, otherwise
+	// fn(valueBox, summary) is called on each value of the node and its children are opened in
+	// turn.
+	template <typename Open, typename F>
+	void approximate(Open&& open, F&& fn) const
+		requires Aggregate::Enabled
+	{
+		mStats.countQuery();
+		approximate(mNodes.root(), open, fn);
+	}
+
+	// Calls fn on every value closer than radius to center, the distance to a value being the
+	// distance to the closest point of its box
+	template <typename F>
+	void forEachInRadius(const Vector2<Float>& center, Float radius, F&& fn) const
+	{
+		visitRadius(center, radius * radius, [this, &fn](std::uint32_t i) { fn(mSlots[i]); });
+	}
+
+	template <typename F>
+	void forEachInRadius(const Vector2<Float>& center, Float radius, F&& fn)
+	{
+		visitRadius(center, radius * radius, [this, &fn](std::uint32_t i) { fn(mSlots[i]); });
+	}
+
+	std::vector<T> queryRadius(const Vector2<Float>& center, Float radius) const
+	{
+		auto values = std::vector<T>();
+		forEachInRadius(center, radius, [&values](const T& value) { values.push_back(value); });
+		return values;
+	}
+
+	// Calls fn on the k values closest to point, closest first, with the same distance as above
+	template <typename F>
+	void forEachNearest(const Vector2<Float>& point, std::size_t k, F&& fn) const
+	{
+		for (const auto& [distance, i] : nearest(point, k))
+			fn(mSlots[i]);
+	}
+
+	template <typename F>
+	void forEachNearest(const Vector2<Float>& point, std::size_t k, F&& fn)
+	{
+		for (const auto& [distance, i] : nearest(point, k))
+			fn(mSlots[i]);
+	}
+
+	std::vector<T> findNearest(const Vector2<Float>& point, std::size_t k) const
+	{
+		auto values = std::vector<T>();
+		forEachNearest(point, k, [&values](const T& value) { values.push_back(value); });
+		return values;
+	}
+
+	// Calls fn(i, value) on every value intersecting boxes[i]
+	// The queries are sorted in the Morton order of the node they would be stored in and the
+	// tree is walked once for all of them. A node tests the queries reaching it against its
+	// values and hands each child the queries routed to it, and the ones crossing its center lines
+	template <typename F>
+	void queryBatch(std::span<const Box<Float>> boxes, F&& fn) const
+	{
+		visitBatch(boxes, [this, &fn](std::uint32_t query, std::uint32_t i) { fn(static_cast<std::size_t>(query), mSlots[i]); });
+	}
+
+	template <typename F>
+	void queryBatch(std::span<const Box<Float>> boxes, F&& fn)
+	{
+		visitBatch(boxes, [this, &fn](std::uint32_t query, std::uint32_t i) { fn(static_cast<std::size_t>(query), mSlots[i]); });
+	}
+
+	// Same as access for each box, results is reused from one batch to the next
+	void accessBatch(std::span<const Box<Float>> boxes, BatchResults<T*>& results)
+	{
+		auto found = std::vector<std::pair<std::uint32_t, T*>>();
+		queryBatch(boxes, [&found](std::size_t query, T& value) { found.emplace_back(static_cast<std::uint32_t>(query), &value); });
+		results.assign(boxes.size(), found);
+	}
+
+	BatchResults<T*> accessBatch(std::span<const Box<Float>> boxes)
+	{
+		auto results = BatchResults<T*>();
+		accessBatch(boxes, results);
+		return results;
+	}
+
+	// Returns the first value satisfying pred hit by the ray origin + t * direction for t in
+	// [0, maxTime], and the time t at which the ray enters its box. Nodes are walked front to
+	// back and the walk stops at the first node the ray enters after the closest hit.
+	template <typename Pred>
+	std::optional<std::pair<T, Float>> raycast(const Vector2<Float>& origin, const Vector2<Float>& direction, Float maxTime, Pred&& pred) const
+	{
+		static_assert(std::is_floating_point_v<Float>, "Ray casts need a floating point type");
+		auto hit = std::optional<std::pair<std::uint32_t, Float>>();
+		mStats.countQuery();
+		raycast(mNodes.root(), mBox, origin, direction, maxTime, pred, hit);
+		if (!hit)
+			return std::nullopt;
+		return std::pair<T, Float>(mSlots[hit->first], hit->second);
+	}
+
+	std::optional<std::pair<T, Float>> raycast(const Vector2<Float>& origin, const Vector2<Float>& direction, Float maxTime) const
+	{
+		return raycast(origin, direction, maxTime, [](const T&) { return true; });
+	}
+
+	// Same as raycast along the segment from from to to, the time being 0 at from and 1 at to
+	template <typename Pred>
+	std::optional<std::pair<T, Float>> segmentCast(const Vector2<Float>& from, const Vector2<Float>& to, Pred&& pred) const
+	{
+		return raycast(from, Vector2<Float>(to.x - from.x, to.y - from.y), Float(1), pred);
+	}
+
+	std::optional<std::pair<T, Float>> segmentCast(const Vector2<Float>& from, const Vector2<Float>& to) const
+	{
+		return segmentCast(from, to, [](const T&) { return true; });
+	}
+
+	std::vector<std::pair<T, T>> findAllIntersections() const
+	{
+		auto intersections = std::vector<std::pair<T, T>>();
+		findAllIntersections(mNodes.root(), intersections);
+		return intersections;
+	}
+
+	// Same pairs as findAllIntersections, in another order, found by up to nbThreads threads
+	// Subtrees holding more than ParallelCutoff values are split in jobs, each writing the pairs
+	// it finds in its own buffer, and the buffers are concatenated at the end
+	std::vector<std::pair<T, T>> findAllIntersectionsParallel(std::size_t nbThreads = std::thread::hardware_concurrency()) const
+	{
+		auto jobs = std::vector<IntersectionJob>();
+		splitIntersections(mNodes.root(), jobs);
+		auto buffers = std::vector<std::vector<std::pair<T, T>>>(jobs.size());
+		auto next = std::atomic<std::size_t>(0);
+		const auto work = [this, &jobs, &buffers, &next]() {
+			for (auto i = next++; i < jobs.size(); i = next++)
+				findIntersections(jobs[i], buffers[i]);
+		};
+		auto threads = std::vector<std::thread>();
+		for (auto i = std::size_t(1); i < std::min(nbThreads, jobs.size()); ++i)
+			threads.emplace_back(work);
+		work();
+		for (auto& thread : threads)
+			thread.join();
+
+		auto size = std::size_t(0);
+		for (const auto& buffer : buffers)
+			size += buffer.size();
+		auto intersections = std::vector<std::pair<T, T>>();
+		intersections.reserve(size);
+		for (auto& buffer : buffers)
+			std::move(std::begin(buffer), std::end(buffer), std::back_inserter(intersections));
+		return intersections;
+	}
+
+	std::vector<T*> access(const Box<Float>& box)
+	{
+		std::vector<T*> values {};
+		forEach(box, [&values](T& value) { values.push_back(&value); });
+		return values;
+	}
+
+	// Same as access but returns handles to the values
+	std::vector<Handle> handles(const Box<Float>& box) const
+	{
+		std::vector<Handle> handles {};
+		visit(box, [this, &handles](std::uint32_t i) { handles.push_back(mSlots.getHandle(i)); return false; });
+		return handles;
+	}
+
+	// Input range of the values intersecting box, in the same order as forEach. Nothing is
+	// collected: the tree is walked as the range is iterated, so it must not change meanwhile,
+	// but the values may be modified in place.
+	auto view(const Box<Float>& box)
+	{
+		return View<false>(this, box, false);
+	}
+
+	auto view(const Box<Float>& box) const
+	{
+		return View<true>(this, box, false);
+	}
+
+	// Same as view for every value, whatever its box
+	auto all()
+	{
+		return View<false>(this, mBox, true);
+	}
+
+	auto all() const
+	{
+		return View<true>(this, mBox, true);
+	}
+
+	//protected:
+	static constexpr auto MaxDepth = Split::MaxDepth;
+	static constexpr auto ParallelCutoff = std::size_t(1024);
+	// The keys of build are the Morton code of a node followed by its depth on DepthBits bits
+	static constexpr auto DepthBits = std::size_t(8);
+	static_assert(2 * MaxDepth + DepthBits <= 64, "Build keys must fit in 64 bits");
+
+	// The nodes store the indices of the values in mSlots
+	using Nodes = typename Storage::template Store<std::uint32_t, Float, typename Aggregate::Summary>;
+	using NodeId = typename Nodes::NodeId;
+
+	// Part of findAllIntersectionsParallel: all the pairs of the subtree of node if subtree is
+	// set, otherwise the pairs between the values of node if child is -1, or between the values
+	// of node and the subtree of its child-th child. With loose bounds, the pairs of the values of
+	// node are searched in the whole tree and there are no child jobs.
+	struct IntersectionJob
+	{
+		NodeId node;
+		int child;
+		bool subtree;
+	};
+
+	// Range of view and all, over the values of a const tree if Const is set
+	template <bool Const>
+	class View : public std::ranges::view_interface<View<Const>>
+	{
+	public:
+		using Tree = std::conditional_t<Const, const Quadtree, Quadtree>;
+
+		// Keeps the nodes left to visit on an explicit stack, the children of a node being
+		// pushed when it is reached and the ones whose content misses the box skipped
+		class Iterator
+		{
+		public:
+			using iterator_concept = std::input_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+
+			Iterator() = default;
+
+			Iterator(Tree* tree, const Box<Float>& box, bool all) :
+				mTree(tree),
+				mEdges(toEdges(box)),
+				mAll(all)
+			{
+				tree->mStats.countQuery();
+				if (all || box.intersects(looseBox(tree->mBox)))
+					mStack.push_back(tree->mNodes.root());
+				settle();
+			}
+
+			auto& operator*() const
+			{
+				return mTree->mSlots[mTree->mNodes.values(mNode)[mIndex]];
+			}
+
+			Iterator& operator++()
+			{
+				++mIndex;
+				settle();
+				return *this;
+			}
+
+			void operator++(int)
+			{
+				++*this;
+			}
+
+			friend bool operator==(const Iterator& it, std::default_sentinel_t)
+			{
+				return it.mIndex >= it.mSize;
+			}
+
+		private:
+			// Moves to the first value intersecting the box from the current one on
+			void settle()
+			{
+				while (true)
+				{
+					if (mIndex < mSize)
+					{
+						if (mAll)
+							return;
+						const auto edges = mTree->mNodes.edges(mNode);
+						for (; mIndex < mSize; ++mIndex)
+						{
+							if (intersects(mEdges, edges[mIndex]))
+								return;
+						}
+					}
+					if (mStack.empty())
+						return;
+					mNode = mStack.back();
+					mStack.pop_back();
+					mIndex = 0;
+					mSize = mTree->mNodes.values(mNode).size();
+					mTree->mStats.countNode(mSize);
+					if (!mTree->isLeaf(mNode))
+					{
+						// Pushed backwards so that the first child is visited first
+						for (auto i = std::size_t(4); i-- > 0;)
+						{
+							auto child = mTree->mNodes.child(mNode, i);
+							const auto& content = mTree->mNodes.content(child);
+							if (mAll ? !isEmpty(content) : intersects(mEdges, content))
+								mStack.push_back(child);
+						}
+					}
+				}
+			}
+
+			Tree* mTree = nullptr;
+			Edges<Float> mEdges {};
+			bool mAll = false;
+			std::vector<NodeId> mStack;
+			NodeId mNode {};
+			std::size_t mIndex = 0;
+			std::size_t mSize = 0;
+		};
+
+		View() = default;
+
+		View(Tree* tree, const Box<Float>& box, bool all) :
+			mTree(tree),
+			mBox(box),
+			mAll(all)
+		{
+		}
+
+		Iterator begin() const
+		{
+			return Iterator(mTree, mBox, mAll);
+		}
+
+		std::default_sentinel_t end() const
+		{
+			return std::default_sentinel;
+		}
+
+	private:
+		Tree* mTree = nullptr;
+		Box<Float> mBox {};
+		bool mAll = false;
+	};
+
+	Box<Float> mBox;
+	Nodes mNodes;
+	SlotMap<T> mSlots;
+	// Box of each value as stored in the tree, by index
+	std::vector<Box<Float>> mBoxes;
+	// Layer of each value by index, empty without a filter
+	std::vector<Layer> mLayers;
+	GetBox mGetBox;
+	Equal mEqual;
+	[[no_unique_address]] Stats mStats;
+	[[no_unique_address]] Split mSplit;
+	[[no_unique_address]] Filter mFilter;
+	[[no_unique_address]] Aggregate mAggregate;
+
+	bool isLeaf(NodeId node) const
+	{
+		return mNodes.isLeaf(node);
+	}
+
+	// Reads the layer of the value at index, returns true if it changed
+	bool cacheLayer(std::uint32_t index)
+	{
+		if constexpr (Filter::Enabled)
+		{
+			if (index >= mLayers.size())
+				mLayers.resize(index + 1);
+			auto layer = mFilter.layer(mSlots[index]);
+			auto changed = !(layer == mLayers[index]);
+			mLayers[index] = layer;
+			return changed;
+		}
+		else
+			return false;
+	}
+
+	// Whether the values at i and j collide, always true without a filter
+	bool collides(std::uint32_t i, std::uint32_t j) const
+	{
+		if constexpr (Filter::Enabled)
+			return mLayers[i].collides(mLayers[j]);
+		else
+			return true;
+	}
+
+	bool collides(const Layer& layer, std::uint32_t i) const
+	{
+		if constexpr (Filter::Enabled)
+			return layer.collides(mLayers[i]);
+		else
+			return true;
+	}
+
+	// Categories the value at index collides with, all of them without a filter
+	Categories getMask(std::uint32_t index) const
+	{
+		if constexpr (Filter::Enabled)
+			return mLayers[index].mask;
+		else
+			return AllCategories;
+	}
+
+	// Whether the subtree of node may hold a value of a category of mask
+	bool mayCollide(NodeId node, Categories mask) const
+	{
+		if constexpr (Filter::Enabled)
+			return (mNodes.categories(node) & mask) != 0;
+		else
+			return true;
+	}
+
+	void addCategories(NodeId node, std::uint32_t index)
+	{
+		if constexpr (Filter::Enabled)
+			mNodes.setCategories(node, mNodes.categories(node) | mLayers[index].category);
+	}
+
+	// The categories of a node are a superset of the ones of its subtree, kept as values are
+	// added and made exact again from its values and its children as they are removed
+	void refreshCategories(NodeId node)
+	{
+		if constexpr (Filter::Enabled)
+		{
+			auto categories = Categories(0);
+			for (auto index : mNodes.values(node))
+				categories |= mLayers[index].category;
+			if (!isLeaf(node))
+			{
+				for (auto i = std::size_t(0); i < 4; ++i)
+					categories |= mNodes.categories(mNodes.child(node, i));
+			}
+			mNodes.setCategories(node, categories);
+		}
+	}
+
+	// The content of a node bounds the values of its subtree. Like the categories, it is
+	// extended as values are added and made exact again from its values and its children as
+	// they are removed.
+	void addContent(NodeId node, std::uint32_t index)
+	{
+		mNodes.setContent(node, unite(mNodes.content(node), toEdges(mBoxes[index])));
+	}
+
+	void refreshContent(NodeId node)
+	{
+		auto content = NoEdges<Float>;
+		auto edges = mNodes.edges(node);
+		for (auto i = std::size_t(0); i < mNodes.values(node).size(); ++i)
+			content = unite(content, edges[i]);
+		if (!isLeaf(node))
+		{
+			for (auto i = std::size_t(0); i < 4; ++i)
+				content = unite(content, mNodes.content(mNodes.child(node, i)));
+		}
+		mNodes.setContent(node, content);
+	}
+
+	// Adds the value at index to the categories, the content and the summary of node
+	void include(NodeId node, std::uint32_t index)
+	{
+		addCategories(node, index);
+		addContent(node, index);
+		addAggregate(node, index);
+	}
+
+	// Makes the categories, the content and the summary of node exact again
+	void refresh(NodeId node)
+	{
+		refreshCategories(node);
+		refreshContent(node);
+		refreshAggregate(node);
+	}
+
+	typename Aggregate::Summary summaryOf(std::uint32_t index) const
+	{
+		return mAggregate.summarize(mSlots[index], mBoxes[index]);
+	}
+
+	void addAggregate(NodeId node, std::uint32_t index)
+	{
+		if constexpr (Aggregate::Enabled)
+			mNodes.setSummary(node, mAggregate.combine(mNodes.summary(node), summaryOf(index)));
 	}
 
-	std::vector<T> query(const Box<Float>& box) const
+	// Unlike the categories, the summary of a node is exact, it is made again from its values
+	// and its children whenever one of them is removed or changes
+	void refreshAggregate(NodeId node)
 	{
-		auto values = std::vector<T>();
-		query(mRoot.get(), mBox, box, values);
-		return values;
+		if constexpr (Aggregate::Enabled)
+		{
+			auto summary = typename Aggregate::Summary();
+			for (auto index : mNodes.values(node))
+				summary = mAggregate.combine(summary, summaryOf(index));
+			if (!isLeaf(node))
+			{
+				for (auto i = std::size_t(0); i < 4; ++i)
+					summary = mAggregate.combine(summary, mNodes.summary(mNodes.child(node, i)));
+			}
+			mNodes.setSummary(node, std::move(summary));
+		}
 	}
 
-	std::vector<std::pair<T, T>> findAllIntersections() const
+	// Every value of a node is inside its content, so they all intersect a box strictly
+	// containing it, even the empty ones on its edges
+	typename Aggregate::Summary summarize(NodeId node, const Box<Float>& queryBox) const
 	{
-		auto intersections = std::vector<std::pair<T, T>>();
-		findAllIntersections(mRoot.get(), intersections);
-		return intersections;
+		auto summary = typename Aggregate::Summary();
+		auto values = mNodes.values(node);
+		mStats.countNode(values.size());
+		for (auto index : values)
+		{
+			if (queryBox.intersects(mBoxes[index]))
+				summary = mAggregate.combine(summary, summaryOf(index));
+		}
+		if (!isLeaf(node))
+		{
+			for (auto i = std::size_t(0); i < 4; ++i)
+			{
+				auto child = mNodes.child(node, i);
+				const auto& content = mNodes.content(child);
+				if (!intersects(toEdges(queryBox), content))
+					continue;
+				if (queryBox.left < content.left && content.right < queryBox.getRight() && queryBox.top < content.top && content.bottom < queryBox.getBottom())
+					summary = mAggregate.combine(summary, mNodes.summary(child));
+				else
+					summary = mAggregate.combine(summary, summarize(child, queryBox));
+			}
+		}
+		return summary;
 	}
 
-	std::vector<T*> access(const Box<Float>& box)
+	template <typename Open, typename F>
+	void approximate(NodeId node, Open& open, F& fn) const
 	{
-		std::vector<T*> values {};
-		access(mRoot.get(), mBox, box, values);
-		return values;
+		const auto& content = mNodes.content(node);
+		if (isEmpty(content))
+			return;
+		auto bounds = Box<Float>(content.left, content.top, content.right - content.left, content.bottom - content.top);
+		if (!open(bounds, mNodes.summary(node)))
+		{
+			fn(bounds, mNodes.summary(node));
+			return;
+		}
+		auto values = mNodes.values(node);
+		mStats.countNode(values.size());
+		for (auto index : values)
+			fn(mBoxes[index], summaryOf(index));
+		if (!isLeaf(node))
+		{
+			for (auto i = std::size_t(0); i < 4; ++i)
+				approximate(mNodes.child(node, i), open, fn);
+		}
 	}
 
-	//protected:
-	static constexpr auto Threshold = std::size_t(16);
-	static constexpr auto MaxDepth = std::size_t(8);
+	// Whether a value is routed inside box, the right and bottom edges are excluded as in
+	// getQuadrant so that a value touching them is not moved up when the root grows
+	// With loose bounds, its center must be in box and the value in the loose box
+	static bool fits(const Box<Float>& box, const Box<Float>& valueBox)
+	{
+		if constexpr (Bounds::Loose)
+		{
+			auto center = valueBox.getCenter();
+			return box.left <= center.x && center.x < box.getRight() && box.top <= center.y && center.y < box.getBottom() && looseBox(box).contains(valueBox);
+		}
+		else
+			return box.left <= valueBox.left && valueBox.getRight() < box.getRight() && box.top <= valueBox.top && valueBox.getBottom() < box.getBottom();
+	}
 
-	struct Node
+	// Box the values of the node of cell box lie in
+	static Box<Float> looseBox(const Box<Float>& box)
 	{
-		std::array<std::unique_ptr<Node>, 4> children;
-		std::vector<T> values;
-	};
+		if constexpr (Bounds::Loose)
+		{
+			constexpr auto margin = static_cast<Float>((Bounds::Factor - 1) / 2);
+			return Box<Float>(box.left - margin * box.width, box.top - margin * box.height, box.width + 2 * margin * box.width, box.height + 2 * margin * box.height);
+		}
+		else
+			return box;
+	}
 
-	Box<Float> mBox;
-	std::unique_ptr<Node> mRoot;
-	GetBox mGetBox;
-	Equal mEqual;
+	bool fits(const Box<Float>& valueBox) const
+	{
+		return fits(mBox, valueBox);
+	}
+
+	static Edges<Float> toEdges(const Box<Float>& box)
+	{
+		return Edges<Float> { box.left, box.top, box.getRight(), box.getBottom() };
+	}
+
+	// Same test as Box::intersects
+	static bool intersects(const Edges<Float>& lhs, const Edges<Float>& rhs)
+	{
+		return !(lhs.left >= rhs.right || lhs.right <= rhs.left || lhs.top >= rhs.bottom || lhs.bottom <= rhs.top);
+	}
+
+	// Whether edges bound no box, like the content of an empty subtree
+	static bool isEmpty(const Edges<Float>& edges)
+	{
+		return edges.left > edges.right;
+	}
+
+	static Edges<Float> unite(const Edges<Float>& lhs, const Edges<Float>& rhs)
+	{
+		return Edges<Float> { std::min(lhs.left, rhs.left), std::min(lhs.top, rhs.top), std::max(lhs.right, rhs.right), std::max(lhs.bottom, rhs.bottom) };
+	}
+
+	// Time in [0, maxTime] at which the ray origin + t * direction enters the closed box of edges
+	static std::optional<Float> enterTime(const Edges<Float>& edges, const Vector2<Float>& origin, const Vector2<Float>& direction, Float maxTime)
+	{
+		auto enter = Float(0);
+		auto exit = maxTime;
+		for (const auto& [low, high, start, speed] : { std::array<Float, 4> { edges.left, edges.right, origin.x, direction.x }, std::array<Float, 4> { edges.top, edges.bottom, origin.y, direction.y } })
+		{
+			// Parallel to the slab, the ray is either always or never between its sides
+			if (speed == Float(0))
+			{
+				if (!(low <= start && start <= high))
+					return std::nullopt;
+				continue;
+			}
+			auto t0 = (low - start) / speed;
+			auto t1 = (high - start) / speed;
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+			if (!(enter <= exit))
+				return std::nullopt;
+		}
+		return enter;
+	}
 
-	bool isLeaf(const Node* node) const
+	// Squared distance from point to the closest point of edges, 0 inside
+	static Float squaredDistance(const Edges<Float>& edges, const Vector2<Float>& point)
 	{
-		return !static_cast<bool>(node->children[0]);
+		auto dx = std::max({ edges.left - point.x, Float(0), point.x - edges.right });
+		auto dy = std::max({ edges.top - point.y, Float(0), point.y - edges.bottom });
+		return dx * dx + dy * dy;
 	}
 
 	Box<Float> computeBox(const Box<Float>& box, int i) const
@@ -241,6 +1162,13 @@ public:
 	int getQuadrant(const Box<Float>& nodeBox, const Box<Float>& valueBox) const
 	{
 		auto center = nodeBox.getCenter();
+		if constexpr (Bounds::Loose)
+		{
+			// The quadrant of the center of the value, if the value fits in its loose box
+			auto valueCenter = valueBox.getCenter();
+			auto i = (valueCenter.x < center.x ? 0 : 1) + (valueCenter.y < center.y ? 0 : 2);
+			return looseBox(computeBox(nodeBox, i)).contains(valueBox) ? i : -1;
+		}
 		// West
 		if (valueBox.getRight() < center.x)
 		{
@@ -272,193 +1200,827 @@ public:
 			return -1;
 	}
 
-	auto& add(Node* node, std::size_t depth, const Box<Float>& box, const T& value)
+	void place(std::uint32_t index)
 	{
-		assert(node != nullptr);
-		assert(box.contains(mGetBox(value)));
-		if (isLeaf(node))
+		const auto& box = mBoxes[index];
+		if (!fits(box))
+			grow(box);
+		// Values that cannot be contained, like non finite boxes, are kept in the root
+		if (!fits(box))
 		{
-			// Insert the value in this node if possible
-			if (depth >= MaxDepth || node->values.size() < Threshold)
-				return node->values.emplace_back(value);
-			// Otherwise, we split and we try again
-			else
-			{
-				split(node, box);
-				return add(node, depth, box, value);
-			}
+			mNodes.push(mNodes.root(), index, toEdges(box));
+			include(mNodes.root(), index);
 		}
+		else
+			add(mNodes.root(), 0, mBox, index);
+	}
+
+	void add(NodeId node, std::size_t depth, const Box<Float>& box, std::uint32_t index)
+	{
+		const auto& valueBox = mBoxes[index];
+		assert(looseBox(box).contains(valueBox));
+		include(node, index);
+		// Split a full leaf before routing the value, the value is only counted once in node
+		if (isLeaf(node) && depth < MaxDepth && mNodes.values(node).size() >= mSplit.threshold(depth))
+			split(node, box);
+		// Insert the value in this node if it is still a leaf
+		if (isLeaf(node))
+			mNodes.push(node, index, toEdges(valueBox));
 		else
 		{
-			auto i = getQuadrant(box, mGetBox(value));
+			auto i = getQuadrant(box, valueBox);
 			// Add the value in a child if the value is entirely contained in it
 			if (i != -1)
-				return add(node->children[static_cast<std::size_t>(i)].get(), depth + 1, computeBox(box, i), value);
+				add(mNodes.child(node, static_cast<std::size_t>(i)), depth + 1, computeBox(box, i), index);
 			// Otherwise, we add the value in the current node
 			else
-				return node->values.emplace_back(value);
+				mNodes.push(node, index, toEdges(valueBox));
 		}
 	}
 
-	void split(Node* node, const Box<Float>& box)
+	void split(NodeId node, const Box<Float>& box)
 	{
-		assert(node != nullptr);
 		assert(isLeaf(node) && "Only leaves can be split");
 		// Create children
-		for (auto& child : node->children)
-			child = std::make_unique<Node>();
-		// Assign values to children
-		auto newValues = std::vector<T>(); // New values for this node
-		for (const auto& value : node->values)
+		mNodes.split(node);
+		// Assign values to children, backwards as erase swaps the last value in
+		for (auto j = mNodes.values(node).size(); j-- > 0;)
 		{
-			auto i = getQuadrant(box, mGetBox(value));
-			if (i != -1)
-				node->children[static_cast<std::size_t>(i)]->values.push_back(value);
-			else
-				newValues.push_back(value);
+			auto valueBox = mBoxes[mNodes.values(node)[j]];
+			auto i = getQuadrant(box, valueBox);
+			if (i != -1 && looseBox(box).contains(valueBox))
+			{
+				auto child = mNodes.child(node, static_cast<std::size_t>(i));
+				include(child, mNodes.values(node)[j]);
+				mNodes.push(child, mNodes.values(node)[j], toEdges(valueBox));
+				mNodes.erase(node, j);
+			}
 		}
-		node->values = std::move(newValues);
 	}
 
-	void remove(Node* node, Node* parent, const Box<Float>& box, const T& value)
+	// Removes the value stored at valueBox whose index satisfies match
+	template <typename Match>
+	void remove(const Box<Float>& valueBox, const Match& match)
+	{
+		auto index = fits(valueBox) ? remove(mNodes.root(), 0, mBox, valueBox, match) : removeValue(mNodes.root(), match);
+		refresh(mNodes.root());
+		mSlots.erase(index);
+		shrink();
+	}
+
+	template <typename Match>
+	std::uint32_t remove(NodeId node, std::size_t depth, const Box<Float>& box, const Box<Float>& valueBox, const Match& match)
 	{
-		assert(node != nullptr);
-		assert(box.contains(mGetBox(value)));
+		assert(looseBox(box).contains(valueBox));
 		if (isLeaf(node))
 		{
 			// Remove the value from node
-			removeValue(node, value);
-			// Try to merge the parent
-			if (parent != nullptr)
-				tryMerge(parent);
+			return removeValue(node, match);
 		}
 		else
 		{
 			// Remove the value in a child if the value is entirely contained in it
-			auto i = getQuadrant(box, mGetBox(value));
+			auto i = getQuadrant(box, valueBox);
 			if (i != -1)
-				remove(node->children[static_cast<std::size_t>(i)].get(), node, computeBox(box, i), value);
-			// Otherwise, we remove the value from the current node
+			{
+				auto child = mNodes.child(node, static_cast<std::size_t>(i));
+				auto index = remove(child, depth + 1, computeBox(box, i), valueBox, match);
+				refresh(child);
+				// Try to merge this node if the value was removed from a leaf
+				if (isLeaf(child))
+					tryMerge(node, depth);
+				return index;
+			}
+			// Otherwise, we remove the value from the current node and try to merge it
 			else
-				removeValue(node, value);
+			{
+				auto index = removeValue(node, match);
+				tryMerge(node, depth);
+				return index;
+			}
 		}
 	}
 
-	void removeValue(Node* node, const T& value)
+	template <typename Match>
+	std::uint32_t removeValue(NodeId node, const Match& match)
 	{
-		// Find the value in node->values
-		auto it = std::find_if(std::begin(node->values), std::end(node->values), [this, &value](const auto& rhs) { return mEqual(value, rhs); });
-		assert(it != std::end(node->values) && "Trying to remove a value that is not present in the node");
+		// Find the value in the values of node
+		auto values = mNodes.values(node);
+		auto it = std::find_if(std::begin(values), std::end(values), match);
+		assert(it != std::end(values) && "Trying to remove a value that is not present in the node");
+		auto index = *it;
 		// Swap with the last element and pop back
-		*it = std::move(node->values.back());
-		node->values.pop_back();
+		mNodes.erase(node, static_cast<std::size_t>(std::distance(std::begin(values), it)));
+		return index;
 	}
 
-	void tryMerge(Node* node)
+	// Finds the value stored at oldBox whose index satisfies match, copies value over it if given,
+	// then either keeps it in place or removes it for relocate to add it back
+	template <typename Match>
+	void detach(const Box<Float>& oldBox, const Match& match, const T* value, std::vector<std::uint32_t>& detached, std::vector<std::pair<std::size_t, NodeId>>& merges)
 	{
-		assert(node != nullptr);
-		assert(!isLeaf(node) && "Only interior nodes can be merged");
-		auto nbValues = node->values.size();
-		for (const auto& child : node->children)
+		// Find the node storing the value, remembering the path from the root
+		auto path = std::array<std::pair<NodeId, Box<Float>>, MaxDepth + 1>();
+		auto depth = std::size_t(0);
+		path[0] = { mNodes.root(), mBox };
+		while (!isLeaf(path[depth].first) && fits(oldBox))
+		{
+			auto i = getQuadrant(path[depth].second, oldBox);
+			if (i == -1)
+				break;
+			path[depth + 1] = { mNodes.child(path[depth].first, static_cast<std::size_t>(i)), computeBox(path[depth].second, i) };
+			++depth;
+		}
+		auto [node, box] = path[depth];
+		auto values = mNodes.values(node);
+		auto it = std::find_if(std::begin(values), std::end(values), match);
+		assert(it != std::end(values) && "Trying to relocate a value that is not present in the tree");
+		auto index = *it;
+		if (value != nullptr)
+			mSlots[index] = *value;
+		// Find the deepest node of the path the new box is still routed through
+		// Boxes outside of the tree are routed to the root
+		auto newBox = mGetBox(mSlots[index]);
+		mBoxes[index] = newBox;
+		// A value whose category changed adds it to the nodes above it
+		if (cacheLayer(index))
+		{
+			for (auto d = std::size_t(0); d <= depth; ++d)
+				addCategories(path[d].first, index);
+		}
+		mNodes.setEdges(node, static_cast<std::size_t>(std::distance(std::begin(values), it)), toEdges(newBox));
+		auto inside = fits(newBox);
+		auto common = std::size_t(0);
+		while (inside && common < depth && getQuadrant(path[common].second, newBox) == getQuadrant(path[common].second, oldBox))
+			++common;
+		// Keep the value in place if it still belongs to this node, its summary may still have
+		// changed and the content of the nodes above must hold its new box. A value leaving the
+		// root is added back by relocate once the root grew.
+		if (inside && common == depth && (isLeaf(node) || getQuadrant(box, newBox) == -1))
+		{
+			refreshContent(node);
+			for (auto d = std::size_t(0); d < depth; ++d)
+				addContent(path[d].first, index);
+			for (auto d = depth + 1; d-- > 0;)
+				refreshAggregate(path[d].first);
+			return;
+		}
+		// Otherwise, remove it and remember to try merging the node, or its parent for a leaf
+		mNodes.erase(node, static_cast<std::size_t>(std::distance(std::begin(values), it)));
+		for (auto d = depth; d > common; --d)
+		{
+			refreshCategories(path[d].first);
+			refreshContent(path[d].first);
+		}
+		// The nodes above common still summarize its old state, so it leaves all of them
+		if constexpr (Aggregate::Enabled)
+		{
+			for (auto d = depth + 1; d-- > 0;)
+				refreshAggregate(path[d].first);
+		}
+		if (!isLeaf(node))
+			merges.emplace_back(depth, node);
+		else if (depth > 0)
+			merges.emplace_back(depth - 1, path[depth - 1].first);
+		detached.push_back(index);
+	}
+
+	void grow(const Box<Float>& valueBox)
+	{
+		// Double the root towards the value until it contains it, the old root becoming one of the children
+		// The values of the root that do not fit it are taken out first, they must stay in the new root
+		auto stray = std::vector<std::uint32_t>();
+		auto grown = false;
+		// Whether the values must be sorted again in new nodes, see below
+		auto resort = false;
+		while (!fits(valueBox) && std::isfinite(valueBox.getRight()) && std::isfinite(valueBox.getBottom()))
+		{
+			// A loose root must reach the center of the value, growing makes its loose box large enough
+			auto corner = Bounds::Loose ? valueBox.getCenter() : valueBox.getTopLeft();
+			auto west = corner.x < mBox.left;
+			auto north = corner.y < mBox.top;
+			auto box = Box<Float>(west ? mBox.left - mBox.width : mBox.left, north ? mBox.top - mBox.height : mBox.top,
+				2 * mBox.width, 2 * mBox.height);
+			// Give up on empty or overflowing boxes
+			if (!(box.width > mBox.width && box.height > mBox.height) || !std::isfinite(box.getRight()) || !std::isfinite(box.getBottom()))
+				break;
+			if (!grown)
+			{
+				auto root = mNodes.root();
+				for (auto j = mNodes.values(root).size(); j-- > 0;)
+				{
+					auto index = mNodes.values(root)[j];
+					if (!fits(mBoxes[index]))
+					{
+						stray.push_back(index);
+						mNodes.erase(root, j);
+					}
+				}
+				refresh(root);
+			}
+			// The old root only becomes a child if the new box gives its box back exactly. Otherwise
+			// the cells below it move by a rounding error and their values would be looked for in
+			// other nodes, so they are sorted again once the root is large enough.
+			auto i = (west ? 1 : 0) + (north ? 2 : 0);
+			auto child = computeBox(box, i);
+			resort = resort || child.left != mBox.left || child.top != mBox.top || child.width != mBox.width || child.height != mBox.height;
+			if (!resort)
+			{
+				mNodes.reparent(static_cast<std::size_t>(i));
+				refresh(mNodes.root());
+			}
+			mBox = box;
+			grown = true;
+		}
+		if (!grown)
+			return;
+		if (resort)
+			load(collect());
+		// Every node is now deeper, merge the ones that went past MaxDepth
+		else
+			collapse(mNodes.root(), 0);
+		for (auto index : stray)
+		{
+			if (fits(mBoxes[index]))
+				add(mNodes.root(), 0, mBox, index);
+			else
+			{
+				mNodes.push(mNodes.root(), index, toEdges(mBoxes[index]));
+				include(mNodes.root(), index);
+			}
+		}
+	}
+
+	// Indices of the values stored in the nodes
+	std::vector<std::uint32_t> collect() const
+	{
+		auto indices = std::vector<std::uint32_t>();
+		auto stack = std::vector<NodeId> { mNodes.root() };
+		while (!stack.empty())
+		{
+			auto node = stack.back();
+			stack.pop_back();
+			for (auto index : mNodes.values(node))
+				indices.push_back(index);
+			if (!isLeaf(node))
+			{
+				for (auto i = std::size_t(0); i < 4; ++i)
+					stack.push_back(mNodes.child(node, i));
+			}
+		}
+		return indices;
+	}
+
+	void collapse(NodeId node, std::size_t depth)
+	{
+		if (isLeaf(node))
+			return;
+		// Children first, as only the parents of leaves can be merged
+		for (auto i = std::size_t(0); i < 4; ++i)
+			collapse(mNodes.child(node, i), depth + 1);
+		if (depth >= MaxDepth)
+			mNodes.merge(node);
+	}
+
+	void shrink()
+	{
+		// Make the only child of the root holding values the new root
+		while (!isLeaf(mNodes.root()) && mNodes.values(mNodes.root()).empty())
 		{
-			if (!isLeaf(child.get()))
+			auto nonEmpty = -1;
+			for (auto i = 0; i < 4; ++i)
+			{
+				auto child = mNodes.child(mNodes.root(), static_cast<std::size_t>(i));
+				if (!isLeaf(child) || !mNodes.values(child).empty())
+				{
+					if (nonEmpty != -1)
+						return;
+					nonEmpty = i;
+				}
+			}
+			if (nonEmpty == -1)
+			{
+				mNodes.merge(mNodes.root());
 				return;
-			nbValues += child->values.size();
+			}
+			mNodes.reroot(static_cast<std::size_t>(nonEmpty));
+			mBox = computeBox(mBox, nonEmpty);
+		}
+	}
+
+	void fitBox(const std::vector<Box<Float>>& boxes)
+	{
+		// Bounds of the finite boxes, other values are kept in the root
+		auto found = false;
+		auto left = Float(0), top = Float(0), right = Float(0), bottom = Float(0);
+		for (const auto& box : boxes)
+		{
+			if (!std::isfinite(box.left) || !std::isfinite(box.top) || !std::isfinite(box.getRight()) || !std::isfinite(box.getBottom()))
+				continue;
+			left = found ? std::min(left, box.left) : box.left;
+			top = found ? std::min(top, box.top) : box.top;
+			right = found ? std::max(right, box.getRight()) : box.getRight();
+			bottom = found ? std::max(bottom, box.getBottom()) : box.getBottom();
+			found = true;
 		}
-		if (nbValues <= Threshold)
+		if (!found)
+			return;
+		// Keep the box non empty so that it can still be grown, and past the right and bottom
+		// edges of the values so that they fit
+		auto width = std::max(right - left, Float(1));
+		auto height = std::max(bottom - top, Float(1));
+		while (!(left + width > right))
+			width = std::nextafter(width, std::numeric_limits<Float>::infinity());
+		while (!(top + height > bottom))
+			height = std::nextafter(height, std::numeric_limits<Float>::infinity());
+		mBox = Box<Float>(left, top, width, height);
+	}
+
+	// Replaces the nodes by new ones holding the values at indices, routed in the box of the root
+	void load(const std::vector<std::uint32_t>& indices)
+	{
+		auto keys = std::vector<std::pair<std::uint64_t, std::uint32_t>>(indices.size());
+		for (auto i = std::size_t(0); i < indices.size(); ++i)
+			keys[i] = { computeKey(mBoxes[indices[i]]), indices[i] };
+		radixSort(keys);
+		mNodes.clear();
+		build(mNodes.root(), 0, mBox, std::span<const std::pair<std::uint64_t, std::uint32_t>>(keys));
+	}
+
+	std::uint64_t computeKey(const Box<Float>& valueBox) const
+	{
+		// Follow the quadrants the value is routed through, as add does
+		auto code = std::uint64_t(0);
+		auto depth = std::size_t(0);
+		auto box = mBox;
+		if (fits(valueBox))
 		{
-			node->values.reserve(nbValues);
-			// Merge the values of all the children
-			for (const auto& child : node->children)
+			for (; depth < MaxDepth; ++depth)
 			{
-				for (const auto& value : child->values)
-					node->values.push_back(value);
+				auto i = getQuadrant(box, valueBox);
+				if (i == -1)
+					break;
+				code = (code << 2) | static_cast<std::uint64_t>(i);
+				box = computeBox(box, i);
 			}
-			// Remove the children
-			for (auto& child : node->children)
-				child.reset();
 		}
+		code <<= 2 * (MaxDepth - depth);
+		return (code << DepthBits) | depth;
+	}
+
+	static void radixSort(std::vector<std::pair<std::uint64_t, std::uint32_t>>& keys)
+	{
+		// Least significant digit first, one byte per pass
+		auto buffer = std::vector<std::pair<std::uint64_t, std::uint32_t>>(keys.size());
+		for (auto shift = std::size_t(0); shift < 2 * MaxDepth + DepthBits; shift += 8)
+		{
+			auto offsets = std::array<std::size_t, 257>();
+			for (const auto& key : keys)
+				++offsets[((key.first >> shift) & 0xFF) + 1];
+			for (auto i = std::size_t(1); i < offsets.size(); ++i)
+				offsets[i] += offsets[i - 1];
+			for (const auto& key : keys)
+				buffer[offsets[(key.first >> shift) & 0xFF]++] = key;
+			keys.swap(buffer);
+		}
+	}
+
+	void build(NodeId node, std::size_t depth, const Box<Float>& box, std::span<const std::pair<std::uint64_t, std::uint32_t>> keys)
+	{
+		// Keys are sorted, so the values stopping at this node come first and a node only keeps
+		// values if the last key stops there as well
+		constexpr auto depthMask = (std::uint64_t(1) << DepthBits) - 1;
+		if (keys.size() <= mSplit.threshold(depth) || depth >= MaxDepth || (keys.back().first & depthMask) == depth)
+		{
+			for (const auto& [key, index] : keys)
+				mNodes.push(node, index, toEdges(mBoxes[index]));
+			refresh(node);
+			return;
+		}
+		mNodes.split(node);
+		auto first = std::size_t(0);
+		for (; first < keys.size() && (keys[first].first & depthMask) == depth; ++first)
+			mNodes.push(node, keys[first].second, toEdges(mBoxes[keys[first].second]));
+		// The children follow in Morton order
+		const auto shift = 2 * (MaxDepth - depth - 1) + DepthBits;
+		for (auto i = std::size_t(0); i < 4; ++i)
+		{
+			auto last = first;
+			while (last < keys.size() && ((keys[last].first >> shift) & 3) == i)
+				++last;
+			build(mNodes.child(node, i), depth + 1, computeBox(box, static_cast<int>(i)), keys.subspan(first, last - first));
+			first = last;
+		}
+		refresh(node);
+	}
+
+	void mergeAll(std::vector<std::pair<std::size_t, NodeId>>& merges)
+	{
+		// Merge the deepest nodes first, a merge only frees nodes deeper than the merged one
+		std::sort(std::begin(merges), std::end(merges), std::greater<>());
+		merges.erase(std::unique(std::begin(merges), std::end(merges)), std::end(merges));
+		for (const auto& [depth, node] : merges)
+		{
+			if (!isLeaf(node))
+				tryMerge(node, depth);
+		}
+	}
+
+	void tryMerge(NodeId node, std::size_t depth)
+	{
+		assert(!isLeaf(node) && "Only interior nodes can be merged");
+		auto nbValues = mNodes.values(node).size();
+		for (auto i = std::size_t(0); i < 4; ++i)
+		{
+			auto child = mNodes.child(node, i);
+			if (!isLeaf(child))
+				return;
+			nbValues += mNodes.values(child).size();
+		}
+		// Merge the values of all the children and remove them
+		if (nbValues <= mSplit.threshold(depth))
+		{
+			mNodes.merge(node);
+			refreshCategories(node);
+		}
+	}
+
+	// Calls fn on the indices of the values intersecting queryBox until it returns true
+	template <typename F>
+	bool visit(const Box<Float>& queryBox, F&& fn) const
+	{
+		return visit(queryBox, AnyLayer, fn);
+	}
+
+	// Same as above for the values colliding with layer
+	template <typename F>
+	bool visit(const Box<Float>& queryBox, const Layer& layer, F&& fn) const
+	{
+		mStats.countQuery();
+		return queryBox.intersects(looseBox(mBox)) && mayCollide(mNodes.root(), layer.mask) && visit(mNodes.root(), 0, mBox, queryBox, layer, fn);
 	}
 
-	void query(Node* node, const Box<Float>& box, const Box<Float>& queryBox, std::vector<T>& values) const
+	template <typename F>
+	bool visit(NodeId node, std::size_t depth, const Box<Float>& box, const Box<Float>& queryBox, const Layer& layer, F& fn) const
 	{
-		assert(node != nullptr);
-		assert(queryBox.intersects(box));
-		for (const auto& value : node->values)
+		assert(queryBox.intersects(looseBox(box)));
+		auto values = mNodes.values(node);
+		mStats.countNode(values.size());
+		if constexpr (Split::Observes)
 		{
-			if (queryBox.intersects(mGetBox(value)))
-				values.push_back(value);
+			// Leaves tell the split policy how many of their boxes were worth testing
+			if (isLeaf(node))
+			{
+				auto nbFound = std::size_t(0);
+				auto found = simd::forEachIntersecting(mNodes.edges(node), values.size(), toEdges(queryBox), [this, &values, &layer, &fn, &nbFound](std::size_t i) { ++nbFound; return collides(layer, values[i]) && fn(values[i]); });
+				mSplit.countLeaf(depth, values.size(), nbFound);
+				return found;
+			}
 		}
+		if (simd::forEachIntersecting(mNodes.edges(node), values.size(), toEdges(queryBox), [this, &values, &layer, &fn](std::size_t i) { return collides(layer, values[i]) && fn(values[i]); }))
+			return true;
 		if (!isLeaf(node))
 		{
-			for (auto i = std::size_t(0); i < node->children.size(); ++i)
+			for (auto i = std::size_t(0); i < 4; ++i)
 			{
+				auto child = mNodes.child(node, i);
 				auto childBox = computeBox(box, static_cast<int>(i));
-				if (queryBox.intersects(childBox))
-					query(node->children[i].get(), childBox, queryBox, values);
+				if (intersects(toEdges(queryBox), mNodes.content(child)) && mayCollide(child, layer.mask) && visit(child, depth + 1, childBox, queryBox, layer, fn))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// Calls fn(query, index) for the values intersecting each query
+	template <typename F>
+	void visitBatch(std::span<const Box<Float>> boxes, F&& fn) const
+	{
+		auto active = std::vector<std::pair<std::uint64_t, std::uint32_t>>();
+		active.reserve(2 * boxes.size());
+		for (auto i = std::size_t(0); i < boxes.size(); ++i)
+		{
+			mStats.countQuery();
+			if (boxes[i].intersects(looseBox(mBox)))
+				active.emplace_back(computeKey(boxes[i]), static_cast<std::uint32_t>(i));
+		}
+		radixSort(active);
+		visitBatch(mNodes.root(), 0, mBox, boxes, active, 0, active.size(), fn);
+	}
+
+	// active[first, last) holds the keys of the queries reaching node, the lists of the children
+	// are appended to it and removed once they are visited
+	template <typename F>
+	void visitBatch(NodeId node, std::size_t depth, const Box<Float>& box, std::span<const Box<Float>> boxes, std::vector<std::pair<std::uint64_t, std::uint32_t>>& active, std::size_t first, std::size_t last, F& fn) const
+	{
+		auto values = mNodes.values(node);
+		mStats.countNode(values.size() * (last - first));
+		if (!values.empty())
+		{
+			auto edges = mNodes.edges(node);
+			for (auto j = first; j < last; ++j)
+			{
+				auto query = active[j].second;
+				simd::forEachIntersecting(edges, values.size(), toEdges(boxes[query]), [&fn, &values, query](std::size_t i) { fn(query, values[i]); return false; });
+			}
+		}
+		if (isLeaf(node))
+			return;
+		// The queries stopping at this node or above come first and are tested against each
+		// child. The others are sorted by the child they are routed to and only reach that
+		// one, unless loose boxes make them overlap the other children as well.
+		constexpr auto depthMask = (std::uint64_t(1) << DepthBits) - 1;
+		auto crossing = Bounds::Loose ? last : first;
+		while (crossing < last && (active[crossing].first & depthMask) <= depth)
+			++crossing;
+		auto routed = crossing;
+		const auto shift = 2 * (MaxDepth - depth - 1) + DepthBits;
+		for (auto i = std::size_t(0); i < 4; ++i)
+		{
+			auto childBox = computeBox(box, static_cast<int>(i));
+			const auto& content = mNodes.content(mNodes.child(node, i));
+			auto childFirst = active.size();
+			for (auto j = first; j < crossing; ++j)
+			{
+				auto entry = active[j];
+				if (intersects(toEdges(boxes[entry.second]), content))
+					active.push_back(entry);
+			}
+			for (; routed < last && ((active[routed].first >> shift) & 3) == i; ++routed)
+			{
+				auto entry = active[routed];
+				if (intersects(toEdges(boxes[entry.second]), content))
+					active.push_back(entry);
 			}
+			if (active.size() > childFirst)
+				visitBatch(mNodes.child(node, i), depth + 1, childBox, boxes, active, childFirst, active.size(), fn);
+			active.resize(childFirst);
 		}
 	}
 
-	void access(Node* node, const Box<Float>& box, const Box<Float>& queryBox, std::vector<T*>& values)
+	// Calls fn on the indices of the values closer than the square root of squaredRadius to center
+	template <typename F>
+	void visitRadius(const Vector2<Float>& center, Float squaredRadius, F&& fn) const
+	{
+		mStats.countQuery();
+		visitRadius(mNodes.root(), mBox, center, squaredRadius, fn);
+	}
+
+	template <typename F>
+	void visitRadius(NodeId node, const Box<Float>& box, const Vector2<Float>& center, Float squaredRadius, F& fn) const
 	{
-		assert(node != nullptr);
-		assert(queryBox.intersects(box));
-		for (auto& value : node->values)
+		auto values = mNodes.values(node);
+		auto edges = mNodes.edges(node);
+		mStats.countNode(values.size());
+		for (auto i = std::size_t(0); i < values.size(); ++i)
 		{
-			if (queryBox.intersects(mGetBox(value)))
-				values.push_back(&value);
+			if (squaredDistance(edges[i], center) < squaredRadius)
+				fn(values[i]);
 		}
 		if (!isLeaf(node))
 		{
-			for (auto i = std::size_t(0); i < node->children.size(); ++i)
+			for (auto i = std::size_t(0); i < 4; ++i)
 			{
+				auto child = mNodes.child(node, i);
 				auto childBox = computeBox(box, static_cast<int>(i));
-				if (queryBox.intersects(childBox))
-					access(node->children[i].get(), childBox, queryBox, values);
+				if (!isEmpty(mNodes.content(child)) && squaredDistance(mNodes.content(child), center) < squaredRadius)
+					visitRadius(child, childBox, center, squaredRadius, fn);
 			}
 		}
 	}
 
-	void findAllIntersections(Node* node, std::vector<std::pair<T, T>>& intersections) const
+	template <typename Pred>
+	void raycast(NodeId node, const Box<Float>& box, const Vector2<Float>& origin, const Vector2<Float>& direction, Float maxTime, Pred& pred, std::optional<std::pair<std::uint32_t, Float>>& hit) const
 	{
-		// Find intersections between values stored in this node
-		// Make sure to not report the same intersection twice
-		for (auto i = std::size_t(0); i < node->values.size(); ++i)
+		auto values = mNodes.values(node);
+		auto edges = mNodes.edges(node);
+		mStats.countNode(values.size());
+		for (auto i = std::size_t(0); i < values.size(); ++i)
+		{
+			auto time = enterTime(edges[i], origin, direction, hit ? hit->second : maxTime);
+			if (time && (!hit || *time < hit->second) && pred(mSlots[values[i]]))
+				hit = std::pair<std::uint32_t, Float>(values[i], *time);
+		}
+		if (isLeaf(node))
+			return;
+		// Visit the children the ray enters, in the order it enters them
+		auto children = std::array<std::pair<Float, int>, 4>();
+		auto nbChildren = std::size_t(0);
+		for (auto i = 0; i < 4; ++i)
+		{
+			const auto& content = mNodes.content(mNodes.child(node, static_cast<std::size_t>(i)));
+			if (isEmpty(content))
+				continue;
+			if (auto time = enterTime(content, origin, direction, hit ? hit->second : maxTime))
+				children[nbChildren++] = { *time, i };
+		}
+		std::sort(std::begin(children), std::begin(children) + static_cast<std::ptrdiff_t>(nbChildren));
+		for (auto j = std::size_t(0); j < nbChildren; ++j)
+		{
+			auto [time, i] = children[j];
+			if (hit && !(time < hit->second))
+				break;
+			raycast(mNodes.child(node, static_cast<std::size_t>(i)), computeBox(box, i), origin, direction, maxTime, pred, hit);
+		}
+	}
+
+	// Returns the squared distances and indices of the k values closest to point, closest first
+	// Nodes are explored by increasing distance and the k closest values found so far are kept
+	// in a max-heap, the search stops at the first node farther than all of them
+	std::vector<std::pair<Float, std::uint32_t>> nearest(const Vector2<Float>& point, std::size_t k) const
+	{
+		struct Pending
 		{
-			for (auto j = std::size_t(0); j < i; ++j)
+			Float distance;
+			NodeId node;
+			Box<Float> box;
+		};
+		const auto farther = [](const Pending& lhs, const Pending& rhs) { return lhs.distance > rhs.distance; };
+		auto found = std::vector<std::pair<Float, std::uint32_t>>();
+		if (k == 0)
+			return found;
+		mStats.countQuery();
+		// The root is explored first whatever its distance as it holds the values that do not fit
+		auto pending = std::vector<Pending> { Pending { Float(0), mNodes.root(), mBox } };
+		while (!pending.empty())
+		{
+			std::pop_heap(std::begin(pending), std::end(pending), farther);
+			auto [distance, node, box] = pending.back();
+			pending.pop_back();
+			if (found.size() == k && !(distance < found.front().first))
+				break;
+			auto values = mNodes.values(node);
+			auto edges = mNodes.edges(node);
+			mStats.countNode(values.size());
+			for (auto i = std::size_t(0); i < values.size(); ++i)
+			{
+				auto d = squaredDistance(edges[i], point);
+				if (found.size() < k)
+				{
+					found.emplace_back(d, values[i]);
+					std::push_heap(std::begin(found), std::end(found));
+				}
+				else if (d < found.front().first)
+				{
+					std::pop_heap(std::begin(found), std::end(found));
+					found.back() = { d, values[i] };
+					std::push_heap(std::begin(found), std::end(found));
+				}
+			}
+			if (!isLeaf(node))
 			{
-				if (mGetBox(node->values[i]).intersects(mGetBox(node->values[j])))
-					intersections.emplace_back(node->values[i], node->values[j]);
+				for (auto i = std::size_t(0); i < 4; ++i)
+				{
+					auto child = mNodes.child(node, i);
+					if (isEmpty(mNodes.content(child)))
+						continue;
+					auto childBox = computeBox(box, static_cast<int>(i));
+					auto d = squaredDistance(mNodes.content(child), point);
+					if (found.size() < k || d < found.front().first)
+					{
+						pending.push_back(Pending { d, child, childBox });
+						std::push_heap(std::begin(pending), std::end(pending), farther);
+					}
+				}
 			}
 		}
-		if (!isLeaf(node))
+		std::sort_heap(std::begin(found), std::end(found));
+		return found;
+	}
+
+	void findAllIntersections(NodeId node, std::vector<std::pair<T, T>>& intersections) const
+	{
+		findIntersectionsInNode(node, intersections);
+		auto values = mNodes.values(node);
+		if constexpr (Bounds::Loose)
+		{
+			if (!isLeaf(node))
+			{
+				for (auto i = std::size_t(0); i < 4; ++i)
+					findAllIntersections(mNodes.child(node, i), intersections);
+			}
+		}
+		else if (!isLeaf(node))
 		{
 			// Values in this node can intersect values in descendants
-			for (const auto& child : node->children)
+			for (auto i = std::size_t(0); i < 4; ++i)
 			{
-				for (const auto& value : node->values)
-					findIntersectionsInDescendants(child.get(), value, intersections);
+				for (auto j = std::size_t(0); j < values.size(); ++j)
+					findIntersectionsInDescendants(mNodes.child(node, i), values[j], mNodes.edges(node)[j], intersections);
 			}
 			// Find intersections in children
-			for (const auto& child : node->children)
-				findAllIntersections(child.get(), intersections);
+			for (auto i = std::size_t(0); i < 4; ++i)
+				findAllIntersections(mNodes.child(node, i), intersections);
 		}
 	}
 
-	void findIntersectionsInDescendants(Node* node, const T& value, std::vector<std::pair<T, T>>& intersections) const
+	void findIntersectionsInNode(NodeId node, std::vector<std::pair<T, T>>& intersections) const
 	{
-		// Test against the values stored in this node
-		for (const auto& other : node->values)
+		// Loose boxes overlap and values of other subtrees may intersect the values of node, they
+		// are searched from the root and a pair is only reported by the value of lower index
+		if constexpr (Bounds::Loose)
+		{
+			for (auto index : mNodes.values(node))
+				findLooseIntersections(mNodes.root(), mBox, index, intersections);
+			return;
+		}
+		// Find intersections between values stored in this node
+		// Make sure to not report the same intersection twice
+		auto values = mNodes.values(node);
+		auto edges = mNodes.edges(node);
+		for (auto i = std::size_t(0); i < values.size(); ++i)
 		{
-			if (mGetBox(value).intersects(mGetBox(other)))
-				intersections.emplace_back(value, other);
+			simd::forEachIntersecting(edges, i, edges[i], [&](std::size_t j) {
+				if (collides(values[i], values[j]))
+					intersections.emplace_back(mSlots[values[i]], mSlots[values[j]]);
+				return false;
+			});
 		}
+	}
+
+	void splitIntersections(NodeId node, std::vector<IntersectionJob>& jobs) const
+	{
+		// Small subtrees are handled by a single job
+		if (isLeaf(node) || countValues(node, ParallelCutoff) < ParallelCutoff)
+		{
+			jobs.push_back(IntersectionJob { node, -1, true });
+			return;
+		}
+		jobs.push_back(IntersectionJob { node, -1, false });
+		if (!Bounds::Loose && !mNodes.values(node).empty())
+		{
+			for (auto i = 0; i < 4; ++i)
+				jobs.push_back(IntersectionJob { node, i, false });
+		}
+		for (auto i = std::size_t(0); i < 4; ++i)
+			splitIntersections(mNodes.child(node, i), jobs);
+	}
+
+	void findIntersections(const IntersectionJob& job, std::vector<std::pair<T, T>>& intersections) const
+	{
+		if (job.subtree)
+			findAllIntersections(job.node, intersections);
+		else if (job.child == -1)
+			findIntersectionsInNode(job.node, intersections);
+		else
+		{
+			auto values = mNodes.values(job.node);
+			for (auto j = std::size_t(0); j < values.size(); ++j)
+				findIntersectionsInDescendants(mNodes.child(job.node, static_cast<std::size_t>(job.child)), values[j], mNodes.edges(job.node)[j], intersections);
+		}
+	}
+
+	// Counts the values in the subtree of node, stopping once limit is reached
+	std::size_t countValues(NodeId node, std::size_t limit) const
+	{
+		auto n = mNodes.values(node).size();
+		if (!isLeaf(node))
+		{
+			for (auto i = std::size_t(0); i < 4 && n < limit; ++i)
+				n += countValues(mNodes.child(node, i), limit - n);
+		}
+		return n;
+	}
+
+	void findIntersectionsInDescendants(NodeId node, std::uint32_t index, const Edges<Float>& edges, std::vector<std::pair<T, T>>& intersections) const
+	{
+		// Subtrees without any category the value collides with, or whose values all lie away
+		// from it, are skipped
+		if (!mayCollide(node, getMask(index)) || !intersects(edges, mNodes.content(node)))
+			return;
+		// Test against the values stored in this node
+		auto values = mNodes.values(node);
+		simd::forEachIntersecting(mNodes.edges(node), values.size(), edges, [&](std::size_t i) {
+			if (collides(index, values[i]))
+				intersections.emplace_back(mSlots[index], mSlots[values[i]]);
+			return false;
+		});
 		// Test against values stored into descendants of this node
 		if (!isLeaf(node))
 		{
-			for (const auto& child : node->children)
-				findIntersectionsInDescendants(child.get(), value, intersections);
+			for (auto i = std::size_t(0); i < 4; ++i)
+				findIntersectionsInDescendants(mNodes.child(node, i), index, edges, intersections);
+		}
+	}
+
+	void findLooseIntersections(NodeId node, const Box<Float>& box, std::uint32_t index, std::vector<std::pair<T, T>>& intersections) const
+	{
+		auto values = mNodes.values(node);
+		simd::forEachIntersecting(mNodes.edges(node), values.size(), toEdges(mBoxes[index]), [&](std::size_t i) {
+			if (values[i] > index && collides(index, values[i]))
+				intersections.emplace_back(mSlots[index], mSlots[values[i]]);
+			return false;
+		});
+		// Only the neighboring nodes whose loose box overlaps the value are visited
+		if (!isLeaf(node))
+		{
+			for (auto i = std::size_t(0); i < 4; ++i)
+			{
+				auto child = mNodes.child(node, i);
+				auto childBox = computeBox(box, static_cast<int>(i));
+				if (intersects(toEdges(mBoxes[index]), mNodes.content(child)) && mayCollide(child, getMask(index)))
+					findLooseIntersections(child, childBox, index, intersections);
+			}
 		}
 	}
 };
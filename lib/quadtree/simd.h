@@ -0,0 +1,96 @@
+#pragma once
+
+#include "storage.h"
+#include <bit>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	#include <immintrin.h>
+	#define QUADTREE_SIMD_X86
+#endif
+
+namespace quadtree::simd
+{
+
+// Tests a block of Width boxes against a query box, bit i of the result is set if the i-th box
+// intersects it. The query edges are given in the order left, top, right, bottom.
+// Boxes with NaN edges intersect everything, as with Box::intersects.
+struct Kernel
+{
+	std::size_t width = 0;
+	std::uint32_t (*block)(const float* left, const float* top, const float* right, const float* bottom, const float* query) = nullptr;
+};
+
+#ifdef QUADTREE_SIMD_X86
+
+__attribute__((target("avx2"))) inline std::uint32_t intersectAvx2(const float* left, const float* top, const float* right, const float* bottom, const float* query)
+{
+	// Negated comparisons are unordered so that NaN edges behave as in Box::intersects
+	auto mask = _mm256_cmp_ps(_mm256_set1_ps(query[0]), _mm256_loadu_ps(right), _CMP_NGE_UQ);
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_set1_ps(query[2]), _mm256_loadu_ps(left), _CMP_NLE_UQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_set1_ps(query[1]), _mm256_loadu_ps(bottom), _CMP_NGE_UQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_set1_ps(query[3]), _mm256_loadu_ps(top), _CMP_NLE_UQ));
+	return static_cast<std::uint32_t>(_mm256_movemask_ps(mask));
+}
+
+__attribute__((target("avx512f"))) inline std::uint32_t intersectAvx512(const float* left, const float* top, const float* right, const float* bottom, const float* query)
+{
+	auto mask = _mm512_cmp_ps_mask(_mm512_set1_ps(query[0]), _mm512_loadu_ps(right), _CMP_NGE_UQ);
+	mask = _mm512_mask_cmp_ps_mask(mask, _mm512_set1_ps(query[2]), _mm512_loadu_ps(left), _CMP_NLE_UQ);
+	mask = _mm512_mask_cmp_ps_mask(mask, _mm512_set1_ps(query[1]), _mm512_loadu_ps(bottom), _CMP_NGE_UQ);
+	mask = _mm512_mask_cmp_ps_mask(mask, _mm512_set1_ps(query[3]), _mm512_loadu_ps(top), _CMP_NLE_UQ);
+	return static_cast<std::uint32_t>(mask);
+}
+
+#endif
+
+// Widest kernel supported by the CPU, a kernel without block means only the scalar loop is used
+inline const Kernel& getKernel()
+{
+	static const auto kernel = []() {
+#ifdef QUADTREE_SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return Kernel { 16, intersectAvx512 };
+		if (__builtin_cpu_supports("avx2"))
+			return Kernel { 8, intersectAvx2 };
+#endif
+		return Kernel {};
+	}();
+	return kernel;
+}
+
+// Calls fn(i) for the first n boxes of edges intersecting query until it returns true
+// Blocks of boxes are tested with the SIMD kernel for floats, the rest one by one
+template <typename Float, typename F>
+bool forEachIntersecting(const EdgeColumns<Float>& edges, std::size_t n, const Edges<Float>& query, F&& fn)
+{
+	auto i = std::size_t(0);
+	if constexpr (std::is_same_v<Float, float>)
+	{
+		const auto& kernel = getKernel();
+		if (kernel.block != nullptr)
+		{
+			const float q[] = { query.left, query.top, query.right, query.bottom };
+			for (; i + kernel.width <= n; i += kernel.width)
+			{
+				auto mask = kernel.block(edges.left + i, edges.top + i, edges.right + i, edges.bottom + i, q);
+				while (mask != 0)
+				{
+					if (fn(i + static_cast<std::size_t>(std::countr_zero(mask))))
+						return true;
+					mask &= mask - 1;
+				}
+			}
+		}
+	}
+	for (; i < n; ++i)
+	{
+		if (!(query.left >= edges.right[i] || query.right <= edges.left[i] || query.top >= edges.bottom[i] || query.bottom <= edges.top[i]) && fn(i))
+			return true;
+	}
+	return false;
+}
+
+}
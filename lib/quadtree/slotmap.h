@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace quadtree
+{
+
+// Refers to a value of a SlotMap, the generation tells a handle to a removed value from a handle
+// to the value that reused its slot
+struct Handle
+{
+	std::uint32_t index = std::numeric_limits<std::uint32_t>::max();
+	std::uint32_t generation = 0;
+
+	friend bool operator==(const Handle&, const Handle&) = default;
+};
+
+// Values addressed by a 32 bit index, stored in pages that are never moved so that references to
+// a value stay valid until it is erased. Erased slots are reused by the next insertions.
+template <typename T>
+class SlotMap
+{
+public:
+	// Returns the index of the slot holding value
+	std::uint32_t insert(T value)
+	{
+		auto index = mFree;
+		if (index == Null)
+		{
+			index = mEnd++;
+			if (index / PageSize == mPages.size())
+				mPages.push_back(std::make_unique<Slot[]>(PageSize));
+			slot(index).generation = mFirstGeneration;
+		}
+		else
+			mFree = slot(index).nextFree;
+		slot(index).value.emplace(std::move(value));
+		++mSize;
+		return index;
+	}
+
+	void erase(std::uint32_t index)
+	{
+		auto& erased = slot(index);
+		assert(erased.value && "Trying to erase an empty slot");
+		erased.value.reset();
+		++erased.generation;
+		mLastGeneration = std::max(mLastGeneration, erased.generation);
+		erased.nextFree = mFree;
+		mFree = index;
+		--mSize;
+	}
+
+	// Erases every value and frees the pages without visiting the free list
+	// New slots start past every generation handed out so far, so older handles stay invalid
+	void clear()
+	{
+		mPages.clear();
+		mEnd = 0;
+		mFree = Null;
+		mSize = 0;
+		mFirstGeneration = ++mLastGeneration;
+	}
+
+	bool contains(const Handle& handle) const
+	{
+		return handle.index < mEnd && slot(handle.index).value && slot(handle.index).generation == handle.generation;
+	}
+
+	Handle getHandle(std::uint32_t index) const
+	{
+		assert(slot(index).value);
+		return Handle { index, slot(index).generation };
+	}
+
+	T& operator[](std::uint32_t index)
+	{
+		return *slot(index).value;
+	}
+
+	const T& operator[](std::uint32_t index) const
+	{
+		return *slot(index).value;
+	}
+
+	std::size_t size() const
+	{
+		return mSize;
+	}
+
+	std::size_t bytes() const
+	{
+		return mPages.size() * PageSize * sizeof(Slot) + mPages.capacity() * sizeof(std::unique_ptr<Slot[]>);
+	}
+
+	// One past the greatest index in use
+	std::uint32_t end() const
+	{
+		return mEnd;
+	}
+
+	//protected:
+	static constexpr auto PageSize = std::uint32_t(1024);
+	static constexpr auto Null = std::numeric_limits<std::uint32_t>::max();
+
+	struct Slot
+	{
+		std::optional<T> value;
+		std::uint32_t generation = 0;
+		std::uint32_t nextFree = Null;
+	};
+
+	std::vector<std::unique_ptr<Slot[]>> mPages;
+	std::uint32_t mEnd = 0;
+	std::uint32_t mFree = Null;
+	std::size_t mSize = 0;
+	// Generation of new slots and greatest generation of any slot
+	std::uint32_t mFirstGeneration = 0;
+	std::uint32_t mLastGeneration = 0;
+
+	Slot& slot(std::uint32_t index)
+	{
+		return mPages[index / PageSize][index % PageSize];
+	}
+
+	const Slot& slot(std::uint32_t index) const
+	{
+		return mPages[index / PageSize][index % PageSize];
+	}
+};
+
+}
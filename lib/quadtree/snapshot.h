@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace quadtree
+{
+
+// Read-only versions of a value, typically a copy of a spatial index, published by one writer
+// and read by any number of threads without locks.
+// A reader pins the epoch it starts in, in one of MaxReaders slots, and sees the version that
+// was current then until it is done. A replaced version is retired with the epoch it was
+// replaced in, and freed by the writer once no reader is pinned to that epoch or an earlier one.
+template <typename T, std::size_t MaxReaders = 64>
+class Snapshots
+{
+	struct Version
+	{
+		T value;
+		std::uint64_t number;
+	};
+
+	struct alignas(64) Slot
+	{
+		std::atomic<std::uint64_t> epoch = 0;
+	};
+
+public:
+	// Keeps a version alive while it exists, empty if nothing was published yet
+	class Reader
+	{
+	public:
+		Reader(Reader&& other) noexcept :
+			mVersion(std::exchange(other.mVersion, nullptr)),
+			mSlot(std::exchange(other.mSlot, nullptr))
+		{
+		}
+
+		Reader& operator=(Reader&& other) noexcept
+		{
+			std::swap(mVersion, other.mVersion);
+			std::swap(mSlot, other.mSlot);
+			return *this;
+		}
+
+		~Reader()
+		{
+			if (mSlot)
+				mSlot->store(0);
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return mVersion != nullptr;
+		}
+
+		const T& operator*() const noexcept
+		{
+			return mVersion->value;
+		}
+
+		const T* operator->() const noexcept
+		{
+			return &mVersion->value;
+		}
+
+		// Number of the version read, 0 if nothing was published yet
+		std::uint64_t version() const noexcept
+		{
+			return mVersion ? mVersion->number : 0;
+		}
+
+	private:
+		friend class Snapshots;
+
+		Reader(const Version* version, std::atomic<std::uint64_t>* slot) :
+			mVersion(version),
+			mSlot(slot)
+		{
+		}
+
+		const Version* mVersion;
+		std::atomic<std::uint64_t>* mSlot;
+	};
+
+	Snapshots() = default;
+	Snapshots(const Snapshots&) = delete;
+	Snapshots& operator=(const Snapshots&) = delete;
+
+	// No reader may outlive the snapshots
+	~Snapshots()
+	{
+		delete mCurrent.load();
+	}
+
+	// Safe to call from any number of threads, waits only if MaxReaders readers already exist
+	Reader read() const
+	{
+		while (true)
+		{
+			const auto epoch = mEpoch.load();
+			for (auto& slot : mSlots)
+			{
+				// The epoch is pinned before the version is loaded, so the version cannot be
+				// retired in an earlier epoch
+				auto expected = std::uint64_t(0);
+				if (slot.epoch.compare_exchange_strong(expected, epoch))
+					return Reader(mCurrent.load(), &slot.epoch);
+			}
+			std::this_thread::yield();
+		}
+	}
+
+	// Makes value the version seen by the next readers and frees the versions no reader sees
+	// anymore, returns the number of the new version. Only one thread may publish.
+	std::uint64_t publish(T value)
+	{
+		auto version = new Version { std::move(value), ++mPublished };
+		auto retired = std::unique_ptr<Version>(mCurrent.exchange(version));
+		if (retired)
+			mRetired.emplace_back(std::move(retired), mEpoch.fetch_add(1));
+		reclaim();
+		return version->number;
+	}
+
+	// Frees the retired versions no reader sees anymore, returns their number.
+	// Only the publishing thread may call it.
+	std::size_t reclaim()
+	{
+		auto oldest = std::numeric_limits<std::uint64_t>::max();
+		for (const auto& slot : mSlots)
+		{
+			const auto epoch = slot.epoch.load();
+			if (epoch != 0)
+				oldest = std::min(oldest, epoch);
+		}
+		return std::erase_if(mRetired, [oldest](const auto& retired) { return retired.second < oldest; });
+	}
+
+	// Number of the last version published, 0 if none
+	std::uint64_t version() const noexcept
+	{
+		return mPublished;
+	}
+
+	// Number of replaced versions still kept for their readers
+	std::size_t retired() const noexcept
+	{
+		return mRetired.size();
+	}
+
+	//protected:
+	std::atomic<Version*> mCurrent = nullptr;
+	// Starts at 1, a slot holding 0 is free
+	std::atomic<std::uint64_t> mEpoch = 1;
+	mutable std::array<Slot, MaxReaders> mSlots;
+	std::uint64_t mPublished = 0;
+	std::vector<std::pair<std::unique_ptr<Version>, std::uint64_t>> mRetired;
+};
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace quadtree
+{
+
+// Split policies decide when the leaves of a Quadtree are split and merged back.
+// A policy exposes:
+//  - static constexpr MaxDepth, the depth below which no leaf is split
+//  - threshold(depth), the number of values a leaf at depth holds before being split, and the
+//    number of values 4 sibling leaves must hold at most to be merged back into their parent
+//  - Observes, and if it is true countLeaf(depth, nbTested, nbFound) called by the queries on
+//    each leaf they test, then adapt() called by Quadtree::relocate to update the thresholds
+
+// Same threshold at every depth, known at compile time
+template <std::size_t Threshold = 16, std::size_t Depth = 8>
+struct FixedSplit
+{
+	static constexpr auto MaxDepth = Depth;
+	static constexpr auto Observes = false;
+
+	static constexpr std::size_t threshold(std::size_t)
+	{
+		return Threshold;
+	}
+
+	void countLeaf(std::size_t, std::size_t, std::size_t) const
+	{
+	}
+
+	void adapt()
+	{
+	}
+};
+
+// Learns the threshold of each depth from the queries. When few of the boxes tested in the
+// leaves of a depth intersect the queries, these leaves are too coarse and their threshold is
+// halved. When most of them do, splitting would not save any test and only add nodes to
+// visit, so the threshold is doubled. Leaves are split or merged as values are added,
+// removed and relocated, so the tree follows the thresholds as the values move.
+template <std::size_t Depth = 8, std::size_t MinThreshold = 4, std::size_t MaxThreshold = 256>
+class AdaptiveSplit
+{
+public:
+	static constexpr auto MaxDepth = Depth;
+	static constexpr auto Observes = true;
+	static_assert(0 < MinThreshold && MinThreshold <= MaxThreshold);
+
+	AdaptiveSplit()
+	{
+		mThresholds.fill(std::clamp(std::size_t(16), MinThreshold, MaxThreshold));
+	}
+
+	AdaptiveSplit(const AdaptiveSplit& other) :
+		mThresholds(other.mThresholds)
+	{
+		copyCounters(other);
+	}
+
+	AdaptiveSplit& operator=(const AdaptiveSplit& other)
+	{
+		mThresholds = other.mThresholds;
+		copyCounters(other);
+		return *this;
+	}
+
+	std::size_t threshold(std::size_t depth) const
+	{
+		return mThresholds[std::min(depth, MaxDepth)];
+	}
+
+	void countLeaf(std::size_t depth, std::size_t nbTested, std::size_t nbFound) const
+	{
+		auto& counters = mCounters[std::min(depth, MaxDepth)];
+		counters.tested.fetch_add(nbTested, std::memory_order_relaxed);
+		counters.found.fetch_add(nbFound, std::memory_order_relaxed);
+	}
+
+	void adapt()
+	{
+		for (auto depth = std::size_t(0); depth <= MaxDepth; ++depth)
+		{
+			auto& counters = mCounters[depth];
+			auto tested = counters.tested.load(std::memory_order_relaxed);
+			if (tested < MinSamples)
+				continue;
+			auto found = counters.found.load(std::memory_order_relaxed);
+			auto& threshold = mThresholds[depth];
+			if (4 * found < tested)
+				threshold = std::max(MinThreshold, threshold / 2);
+			else if (4 * found > 3 * tested)
+				threshold = std::min(MaxThreshold, threshold * 2);
+			counters.tested.store(0, std::memory_order_relaxed);
+			counters.found.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	//protected:
+	// Boxes to test at a depth before its threshold changes
+	static constexpr auto MinSamples = std::size_t(4096);
+
+	struct Counters
+	{
+		std::atomic<std::size_t> tested = 0;
+		std::atomic<std::size_t> found = 0;
+	};
+
+	std::array<std::size_t, MaxDepth + 1> mThresholds;
+	mutable std::array<Counters, MaxDepth + 1> mCounters;
+
+	void copyCounters(const AdaptiveSplit& other)
+	{
+		for (auto depth = std::size_t(0); depth <= MaxDepth; ++depth)
+		{
+			mCounters[depth].tested.store(other.mCounters[depth].tested.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			mCounters[depth].found.store(other.mCounters[depth].found.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+};
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace quadtree
+{
+
+// Shape of a Quadtree and work of its queries, returned by Quadtree::getStats
+struct TreeStats
+{
+	std::size_t nodes = 0;
+	std::size_t leaves = 0;
+	std::size_t values = 0;
+	// Values kept by interior nodes as they straddle the quadrants of their node
+	std::size_t interiorValues = 0;
+	// Number of nodes at each depth
+	std::vector<std::size_t> nodesPerDepth;
+	// Number of nodes holding each number of values
+	std::vector<std::size_t> valuesPerNode;
+	// Memory used by the nodes, the values and their cached boxes
+	std::size_t bytes = 0;
+	// Work of the queries since the last reset, always 0 with NoStats
+	std::size_t queries = 0;
+	std::size_t nodesVisited = 0;
+	std::size_t boxesTested = 0;
+
+	// Adds the stats of another tree, as if both were a single index
+	TreeStats& operator+=(const TreeStats& other)
+	{
+		nodes += other.nodes;
+		leaves += other.leaves;
+		values += other.values;
+		interiorValues += other.interiorValues;
+		const auto addCounts = [](std::vector<std::size_t>& counts, const std::vector<std::size_t>& otherCounts) {
+			counts.resize(std::max(counts.size(), otherCounts.size()));
+			for (auto i = std::size_t(0); i < otherCounts.size(); ++i)
+				counts[i] += otherCounts[i];
+		};
+		addCounts(nodesPerDepth, other.nodesPerDepth);
+		addCounts(valuesPerNode, other.valuesPerNode);
+		bytes += other.bytes;
+		queries += other.queries;
+		nodesVisited += other.nodesVisited;
+		boxesTested += other.boxesTested;
+		return *this;
+	}
+};
+
+// Stats policies decide whether the queries of a Quadtree count their work
+// A policy has countQuery(), countNode(nbBoxes), read(TreeStats&) and reset()
+
+// Counts nothing, the calls are empty and compile away
+struct NoStats
+{
+	static constexpr bool Enabled = false;
+
+	void countQuery() const
+	{
+	}
+
+	void countNode(std::size_t) const
+	{
+	}
+
+	void read(TreeStats&) const
+	{
+	}
+
+	void reset()
+	{
+	}
+};
+
+// Counts with relaxed atomics so that concurrent queries can share the counters
+struct CountStats
+{
+	static constexpr bool Enabled = true;
+
+	CountStats() = default;
+
+	CountStats(const CountStats& other) :
+		mQueries(other.mQueries.load(std::memory_order_relaxed)),
+		mNodesVisited(other.mNodesVisited.load(std::memory_order_relaxed)),
+		mBoxesTested(other.mBoxesTested.load(std::memory_order_relaxed))
+	{
+	}
+
+	CountStats& operator=(const CountStats& other)
+	{
+		mQueries.store(other.mQueries.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		mNodesVisited.store(other.mNodesVisited.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		mBoxesTested.store(other.mBoxesTested.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		return *this;
+	}
+
+	void countQuery() const
+	{
+		mQueries.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void countNode(std::size_t nbBoxes) const
+	{
+		mNodesVisited.fetch_add(1, std::memory_order_relaxed);
+		mBoxesTested.fetch_add(nbBoxes, std::memory_order_relaxed);
+	}
+
+	void read(TreeStats& stats) const
+	{
+		stats.queries = mQueries.load(std::memory_order_relaxed);
+		stats.nodesVisited = mNodesVisited.load(std::memory_order_relaxed);
+		stats.boxesTested = mBoxesTested.load(std::memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		mQueries.store(0, std::memory_order_relaxed);
+		mNodesVisited.store(0, std::memory_order_relaxed);
+		mBoxesTested.store(0, std::memory_order_relaxed);
+	}
+
+	//protected:
+	mutable std::atomic<std::size_t> mQueries = 0;
+	mutable std::atomic<std::size_t> mNodesVisited = 0;
+	mutable std::atomic<std::size_t> mBoxesTested = 0;
+};
+
+}
@@ -0,0 +1,592 @@
+#pragma once
+
+#include "aggregate.h"
+#include "filter.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace quadtree
+{
+
+// Box of a value cached by the storage, as edges to test intersections without any addition
+template <typename Float>
+struct Edges
+{
+	Float left;
+	Float top;
+	Float right;
+	Float bottom;
+};
+
+// Edges of no box, uniting them with a box gives that box
+template <typename Float>
+inline constexpr auto NoEdges = Edges<Float> { std::numeric_limits<Float>::max(), std::numeric_limits<Float>::max(), std::numeric_limits<Float>::lowest(), std::numeric_limits<Float>::lowest() };
+
+// Cached edges of the values of a node, one contiguous array per edge
+template <typename Float>
+struct EdgeColumns
+{
+	const Float* left;
+	const Float* top;
+	const Float* right;
+	const Float* bottom;
+
+	Edges<Float> operator[](std::size_t i) const
+	{
+		return Edges<Float> { left[i], top[i], right[i], bottom[i] };
+	}
+};
+
+// Storage policies decide how the nodes of a Quadtree and their values are laid out in memory.
+// A policy exposes a Store<T, Float, Summary> class with:
+//  - NodeId root(), bool isLeaf(NodeId), NodeId child(NodeId, i) to walk the tree
+//  - values(NodeId) to read and modify the values of a node as a span
+//  - edges(NodeId) to read the cached edges of these values, and setEdges(NodeId, i, Edges)
+//  - categories(NodeId) and setCategories(NodeId, Categories) to keep the union of the
+//    categories of the subtree of a node, 0 for new nodes and left to the Quadtree otherwise
+//  - summary(NodeId) and setSummary(NodeId, Summary) to keep the aggregate of the subtree of a
+//    node in the same way, default constructed for new nodes
+//  - content(NodeId) and setContent(NodeId, Edges) to keep the bounds of the values of the
+//    subtree of a node in the same way, NoEdges for new nodes
+//  - push(NodeId, T, Edges) and erase(NodeId, i) to add and swap-and-pop values
+//  - split(NodeId) to create 4 empty children and merge(NodeId) to move their values back up
+//  - reparent(i) to make the root the i-th child of a new empty root, and reroot(i) to make
+//    the i-th child of the root the new root when the others are empty leaves
+//  - clear() to go back to an empty root
+//  - bytes() to tell the memory used by the nodes, their values and edges
+
+// Each node owns its children and its values, one heap allocation per node and per value array
+struct PointerStorage
+{
+	template <typename T, typename Float, typename Summary = NoAggregate::Summary>
+	class Store
+	{
+	public:
+		struct Node
+		{
+			std::array<std::unique_ptr<Node>, 4> children;
+			std::vector<T> values;
+			std::array<std::vector<Float>, 4> edges;
+			Categories categories = 0;
+			Edges<Float> content = NoEdges<Float>;
+			[[no_unique_address]] Summary summary {};
+		};
+
+		using NodeId = Node*;
+
+		Store() :
+			mRoot(std::make_unique<Node>())
+		{
+		}
+
+		NodeId root() const
+		{
+			return mRoot.get();
+		}
+
+		bool isLeaf(NodeId node) const
+		{
+			return !static_cast<bool>(node->children[0]);
+		}
+
+		NodeId child(NodeId node, std::size_t i) const
+		{
+			return node->children[i].get();
+		}
+
+		std::span<T> values(NodeId node)
+		{
+			return node->values;
+		}
+
+		std::span<const T> values(NodeId node) const
+		{
+			return node->values;
+		}
+
+		EdgeColumns<Float> edges(NodeId node) const
+		{
+			return EdgeColumns<Float> { node->edges[0].data(), node->edges[1].data(), node->edges[2].data(), node->edges[3].data() };
+		}
+
+		void setEdges(NodeId node, std::size_t i, const Edges<Float>& edges)
+		{
+			node->edges[0][i] = edges.left;
+			node->edges[1][i] = edges.top;
+			node->edges[2][i] = edges.right;
+			node->edges[3][i] = edges.bottom;
+		}
+
+		Categories categories(NodeId node) const
+		{
+			return node->categories;
+		}
+
+		void setCategories(NodeId node, Categories categories)
+		{
+			node->categories = categories;
+		}
+
+		const Edges<Float>& content(NodeId node) const
+		{
+			return node->content;
+		}
+
+		void setContent(NodeId node, const Edges<Float>& content)
+		{
+			node->content = content;
+		}
+
+		const Summary& summary(NodeId node) const
+		{
+			return node->summary;
+		}
+
+		void setSummary(NodeId node, Summary summary)
+		{
+			node->summary = std::move(summary);
+		}
+
+		T& push(NodeId node, T value, const Edges<Float>& edges)
+		{
+			node->edges[0].push_back(edges.left);
+			node->edges[1].push_back(edges.top);
+			node->edges[2].push_back(edges.right);
+			node->edges[3].push_back(edges.bottom);
+			return node->values.emplace_back(std::move(value));
+		}
+
+		void erase(NodeId node, std::size_t i)
+		{
+			assert(i < node->values.size());
+			// Swap with the last element and pop back
+			if (i + 1 != node->values.size())
+				node->values[i] = std::move(node->values.back());
+			node->values.pop_back();
+			for (auto& edge : node->edges)
+			{
+				edge[i] = edge.back();
+				edge.pop_back();
+			}
+		}
+
+		void split(NodeId node)
+		{
+			assert(isLeaf(node) && "Only leaves can be split");
+			for (auto& child : node->children)
+				child = std::make_unique<Node>();
+		}
+
+		void merge(NodeId node)
+		{
+			assert(!isLeaf(node) && "Only interior nodes can be merged");
+			auto nbValues = node->values.size();
+			for (const auto& child : node->children)
+				nbValues += child->values.size();
+			node->values.reserve(nbValues);
+			for (auto& edge : node->edges)
+				edge.reserve(nbValues);
+			for (auto& child : node->children)
+			{
+				assert(isLeaf(child.get()));
+				for (auto& value : child->values)
+					node->values.push_back(std::move(value));
+				for (auto k = std::size_t(0); k < 4; ++k)
+					node->edges[k].insert(node->edges[k].end(), child->edges[k].begin(), child->edges[k].end());
+				child.reset();
+			}
+		}
+
+		void reparent(std::size_t i)
+		{
+			auto root = std::make_unique<Node>();
+			split(root.get());
+			root->children[i] = std::move(mRoot);
+			mRoot = std::move(root);
+		}
+
+		void reroot(std::size_t i)
+		{
+			assert(!isLeaf(mRoot.get()) && mRoot->values.empty());
+			auto root = std::move(mRoot->children[i]);
+			mRoot = std::move(root);
+		}
+
+		void clear()
+		{
+			mRoot = std::make_unique<Node>();
+		}
+
+		std::size_t bytes() const
+		{
+			auto bytes = std::size_t(0);
+			auto stack = std::vector<const Node*> { mRoot.get() };
+			while (!stack.empty())
+			{
+				const auto* node = stack.back();
+				stack.pop_back();
+				bytes += sizeof(Node) + node->values.capacity() * sizeof(T);
+				for (const auto& edge : node->edges)
+					bytes += edge.capacity() * sizeof(Float);
+				if (node->children[0])
+				{
+					for (const auto& child : node->children)
+						stack.push_back(child.get());
+				}
+			}
+			return bytes;
+		}
+
+	private:
+		std::unique_ptr<Node> mRoot;
+	};
+};
+
+// All nodes live in one contiguous array and reference their children by the 32-bit index of
+// the first one, the 4 children being adjacent in Morton order (NW, NE, SW, SE).
+// The values of a node are a contiguous slab of a single pool, and their cached edges are the
+// same slab of 4 pools parallel to it. A full slab grows in place when it ends the pool and is
+// moved to the end with twice the capacity otherwise. Once abandoned
+// slabs make up half of the pool, the values are rewritten in depth-first order, which is the
+// Morton order of the nodes. pack() also renumbers the nodes in that order, it invalidates
+// NodeIds and must not be called while the tree is being modified.
+struct FlatStorage
+{
+	template <typename T, typename Float, typename Summary = NoAggregate::Summary>
+	class Store
+	{
+	public:
+		using NodeId = std::uint32_t;
+
+		Store()
+		{
+			clear();
+		}
+
+		NodeId root() const
+		{
+			return 0;
+		}
+
+		bool isLeaf(NodeId node) const
+		{
+			// The root is never a child so 0 can mark leaves
+			return mNodes[node].firstChild == 0;
+		}
+
+		NodeId child(NodeId node, std::size_t i) const
+		{
+			return mNodes[node].firstChild + static_cast<NodeId>(i);
+		}
+
+		std::span<T> values(NodeId node)
+		{
+			const auto& n = mNodes[node];
+			return std::span<T>(mValues.data() + n.first, n.size);
+		}
+
+		std::span<const T> values(NodeId node) const
+		{
+			const auto& n = mNodes[node];
+			return std::span<const T>(mValues.data() + n.first, n.size);
+		}
+
+		EdgeColumns<Float> edges(NodeId node) const
+		{
+			auto first = mNodes[node].first;
+			return EdgeColumns<Float> { mEdges[0].data() + first, mEdges[1].data() + first, mEdges[2].data() + first, mEdges[3].data() + first };
+		}
+
+		void setEdges(NodeId node, std::size_t i, const Edges<Float>& edges)
+		{
+			writeEdges(mNodes[node].first + i, edges);
+		}
+
+		Categories categories(NodeId node) const
+		{
+			return mNodes[node].categories;
+		}
+
+		void setCategories(NodeId node, Categories categories)
+		{
+			mNodes[node].categories = categories;
+		}
+
+		const Edges<Float>& content(NodeId node) const
+		{
+			return mNodes[node].content;
+		}
+
+		void setContent(NodeId node, const Edges<Float>& content)
+		{
+			mNodes[node].content = content;
+		}
+
+		const Summary& summary(NodeId node) const
+		{
+			return mNodes[node].summary;
+		}
+
+		void setSummary(NodeId node, Summary summary)
+		{
+			mNodes[node].summary = std::move(summary);
+		}
+
+		T& push(NodeId node, T value, const Edges<Float>& edges)
+		{
+			auto& n = mNodes[node];
+			// Reuse a free slot of the slab
+			if (n.size < n.capacity)
+			{
+				writeEdges(n.first + n.size, edges);
+				auto& slot = mValues[n.first + n.size++];
+				slot = std::move(value);
+				return slot;
+			}
+			// Grow the slab in place if it ends the pool
+			if (n.first + n.capacity == mValues.size())
+			{
+				++n.capacity;
+				++n.size;
+				mEdges[0].push_back(edges.left);
+				mEdges[1].push_back(edges.top);
+				mEdges[2].push_back(edges.right);
+				mEdges[3].push_back(edges.bottom);
+				return mValues.emplace_back(std::move(value));
+			}
+			return moveSlab(node, std::move(value), edges);
+		}
+
+		void erase(NodeId node, std::size_t i)
+		{
+			auto& n = mNodes[node];
+			assert(i < n.size);
+			// Swap with the last element, the slot stays in the slab for the next push
+			auto last = n.first + --n.size;
+			if (n.first + i != last)
+			{
+				mValues[n.first + i] = std::move(mValues[last]);
+				for (auto& edge : mEdges)
+					edge[n.first + i] = edge[last];
+			}
+		}
+
+		void split(NodeId node)
+		{
+			assert(isLeaf(node) && "Only leaves can be split");
+			auto firstChild = allocateBlock();
+			mNodes[node].firstChild = firstChild;
+		}
+
+		void merge(NodeId node)
+		{
+			assert(!isLeaf(node) && "Only interior nodes can be merged");
+			auto firstChild = mNodes[node].firstChild;
+			for (auto child = firstChild; child < firstChild + 4; ++child)
+			{
+				assert(isLeaf(child));
+				// Slabs are re-read on each iteration as push may move or pack them
+				for (auto i = std::uint32_t(0); i < mNodes[child].size; ++i)
+					push(node, std::move(mValues[mNodes[child].first + i]), edges(child)[i]);
+				mGarbage += mNodes[child].capacity;
+				mNodes[child] = Node();
+			}
+			mNodes[node].firstChild = 0;
+			mFreeBlocks.push_back(firstChild);
+		}
+
+		void reparent(std::size_t i)
+		{
+			// The root must stay at index 0, so the old one is copied into the new block
+			auto firstChild = allocateBlock();
+			mNodes[firstChild + i] = mNodes[root()];
+			mNodes[root()] = Node();
+			mNodes[root()].firstChild = firstChild;
+		}
+
+		void reroot(std::size_t i)
+		{
+			assert(!isLeaf(root()) && mNodes[root()].size == 0);
+			auto firstChild = mNodes[root()].firstChild;
+			mGarbage += mNodes[root()].capacity;
+			mNodes[root()] = mNodes[firstChild + i];
+			for (auto child = firstChild; child < firstChild + 4; ++child)
+			{
+				if (child != firstChild + i)
+					mGarbage += mNodes[child].capacity;
+				mNodes[child] = Node();
+			}
+			mFreeBlocks.push_back(firstChild);
+		}
+
+		void clear()
+		{
+			mNodes.assign(1, Node());
+			mValues.clear();
+			for (auto& edge : mEdges)
+				edge.clear();
+			mFreeBlocks.clear();
+			mGarbage = 0;
+		}
+
+		// Abandoned slabs and free blocks are counted as they are still allocated
+		std::size_t bytes() const
+		{
+			auto bytes = mNodes.capacity() * sizeof(Node) + mValues.capacity() * sizeof(T) + mFreeBlocks.capacity() * sizeof(NodeId);
+			for (const auto& edge : mEdges)
+				bytes += edge.capacity() * sizeof(Float);
+			return bytes;
+		}
+
+		// Rewrites the nodes and their values in depth-first order and drops abandoned slabs
+		void pack()
+		{
+			auto nodes = std::vector<Node>(1);
+			nodes.reserve(mNodes.size() - 4 * mFreeBlocks.size());
+			auto stack = std::vector<std::pair<NodeId, NodeId>> { { root(), root() } };
+			while (!stack.empty())
+			{
+				auto [from, to] = stack.back();
+				stack.pop_back();
+				nodes[to].first = mNodes[from].first;
+				nodes[to].size = mNodes[from].size;
+				nodes[to].capacity = mNodes[from].capacity;
+				nodes[to].categories = mNodes[from].categories;
+				nodes[to].content = mNodes[from].content;
+				nodes[to].summary = mNodes[from].summary;
+				if (mNodes[from].firstChild != 0)
+				{
+					auto firstChild = static_cast<NodeId>(nodes.size());
+					nodes.resize(nodes.size() + 4);
+					nodes[to].firstChild = firstChild;
+					// Pushed in reverse so that the north west child is visited first
+					for (auto i = NodeId(4); i-- > 0;)
+						stack.emplace_back(mNodes[from].firstChild + i, firstChild + i);
+				}
+			}
+			mNodes = std::move(nodes);
+			mFreeBlocks.clear();
+			packValues();
+		}
+
+	private:
+		struct Node
+		{
+			NodeId firstChild = 0;
+			std::uint32_t first = 0;
+			std::uint32_t size = 0;
+			std::uint32_t capacity = 0;
+			Categories categories = 0;
+			Edges<Float> content = NoEdges<Float>;
+			[[no_unique_address]] Summary summary {};
+		};
+
+		std::vector<Node> mNodes;
+		std::vector<T> mValues;
+		std::array<std::vector<Float>, 4> mEdges;
+		std::vector<NodeId> mFreeBlocks;
+		std::size_t mGarbage = 0;
+
+		NodeId allocateBlock()
+		{
+			if (!mFreeBlocks.empty())
+			{
+				auto firstChild = mFreeBlocks.back();
+				mFreeBlocks.pop_back();
+				return firstChild;
+			}
+			auto firstChild = static_cast<NodeId>(mNodes.size());
+			mNodes.resize(mNodes.size() + 4);
+			return firstChild;
+		}
+
+		// Reserves geometrically, reserve alone allocates the exact size and would copy the pool
+		// each time a slab is moved
+		template <typename U>
+		static void reserve(std::vector<U>& pool, std::size_t size)
+		{
+			if (pool.capacity() < size)
+				pool.reserve(std::max(size, 2 * pool.capacity()));
+		}
+
+		void writeEdges(std::size_t i, const Edges<Float>& edges)
+		{
+			mEdges[0][i] = edges.left;
+			mEdges[1][i] = edges.top;
+			mEdges[2][i] = edges.right;
+			mEdges[3][i] = edges.bottom;
+		}
+
+		void packValues()
+		{
+			auto values = std::vector<T>();
+			values.reserve(mValues.size() - mGarbage);
+			auto edges = std::array<std::vector<Float>, 4>();
+			for (auto& edge : edges)
+				edge.reserve(mValues.size() - mGarbage);
+			auto stack = std::vector<NodeId> { root() };
+			while (!stack.empty())
+			{
+				auto& n = mNodes[stack.back()];
+				stack.pop_back();
+				auto first = static_cast<std::uint32_t>(values.size());
+				for (auto i = std::uint32_t(0); i < n.size; ++i)
+					values.push_back(std::move(mValues[n.first + i]));
+				for (auto k = std::size_t(0); k < 4; ++k)
+					edges[k].insert(edges[k].end(), mEdges[k].begin() + n.first, mEdges[k].begin() + n.first + n.size);
+				n.first = first;
+				n.capacity = n.size;
+				if (n.firstChild != 0)
+				{
+					for (auto i = NodeId(4); i-- > 0;)
+						stack.push_back(n.firstChild + i);
+				}
+			}
+			mValues = std::move(values);
+			mEdges = std::move(edges);
+			mGarbage = 0;
+		}
+
+		T& moveSlab(NodeId node, T value, const Edges<Float>& edges)
+		{
+			// Reclaim abandoned slabs once they make up half of the pool
+			if (mGarbage > mValues.size() / 2)
+			{
+				packValues();
+				if (mNodes[node].first + mNodes[node].capacity == mValues.size())
+					return push(node, std::move(value), edges);
+			}
+			auto& n = mNodes[node];
+			auto first = static_cast<std::uint32_t>(mValues.size());
+			auto capacity = std::max(std::uint32_t(4), 2 * n.capacity);
+			// Reserve first so that moving values within the pool never reallocates it
+			reserve(mValues, first + capacity);
+			for (auto i = std::uint32_t(0); i < n.size; ++i)
+				mValues.push_back(std::move(mValues[n.first + i]));
+			mValues.push_back(std::move(value));
+			// Free slots of a slab must hold valid values, fill them with copies
+			mValues.resize(first + capacity, mValues.back());
+			for (auto& edge : mEdges)
+			{
+				reserve(edge, first + capacity);
+				for (auto i = std::uint32_t(0); i < n.size; ++i)
+					edge.push_back(edge[n.first + i]);
+				edge.resize(first + capacity);
+			}
+			writeEdges(first + n.size, edges);
+			mGarbage += n.capacity;
+			n.first = first;
+			n.capacity = capacity;
+			return mValues[first + n.size++];
+		}
+	};
+};
+
+}
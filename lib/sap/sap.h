@@ -0,0 +1,508 @@
+#pragma once
+
+#include "quadtree/quadtree.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+namespace sap
+{
+
+using quadtree::Box;
+
+// Sweep and prune over both axes, meant for values that move little between two relocations.
+// The endpoints of the boxes are kept sorted on each axis from one call to the next, so that
+// sorting them again after a relocation is an insertion sort whose swaps are exactly the
+// intervals that started or stopped overlapping. The overlapping pairs are maintained with
+// these swaps instead of being searched for.
+// Values with non finite boxes are loose: they have no endpoints and are tested one by one.
+template <typename T, typename GetBox, typename Equal = std::equal_to<T>, typename Float = float>
+class SweepAndPrune
+{
+	static_assert(std::is_convertible_v<std::invoke_result_t<GetBox, const T&>, Box<Float>>,
+		"GetBox must be a callable of signature Box<Float>(const T&)");
+	static_assert(std::is_convertible_v<std::invoke_result_t<Equal, const T&, const T&>, bool>,
+		"Equal must be a callable of signature bool(const T&, const T&)");
+	static_assert(std::is_arithmetic_v<Float>);
+
+public:
+	explicit SweepAndPrune(const GetBox& getBox = GetBox(), const Equal& equal = Equal()) :
+		mGetBox(getBox),
+		mEqual(equal)
+	{
+	}
+
+	// Bounds of the values with endpoints
+	Box<Float> getBox() const
+	{
+		if (mAxes[0].empty())
+			return Box<Float>();
+		return Box<Float>(mAxes[0].front().value, mAxes[1].front().value, mAxes[0].back().value - mAxes[0].front().value,
+			mAxes[1].back().value - mAxes[1].front().value);
+	}
+
+	std::size_t size() const
+	{
+		return mValues.size();
+	}
+
+	// Removes every value and the endpoints at once, no pair is reported as removed
+	void clear()
+	{
+		clearPairEvents();
+		mValues.clear();
+		mBoxes.clear();
+		mLoose.clear();
+		for (auto& axis : mAxes)
+			axis.clear();
+		mMaxWidth = Float(0);
+		mPairs.clear();
+	}
+
+	T& add(const T& value)
+	{
+		clearPairEvents();
+		auto i = static_cast<std::uint32_t>(mValues.size());
+		mValues.push_back(value);
+		mBoxes.push_back(mGetBox(value));
+		if (isLoose(mBoxes[i]))
+			mLoose.push_back(i);
+		else
+		{
+			link(i);
+			sort();
+		}
+		return mValues[i];
+	}
+
+	void remove(const T& value)
+	{
+		clearPairEvents();
+		erase(find(mGetBox(value), value));
+	}
+
+	// Moves a value whose box changed from oldBox, the value is found with its old box
+	void update(const T& value, const Box<Float>& oldBox)
+	{
+		relocate(std::array<std::pair<T, Box<Float>>, 1> { std::pair<T, Box<Float>>(value, oldBox) });
+	}
+
+	// Same as update for a range of (value, oldBox) pairs, the endpoints are sorted once
+	template <typename Range>
+	void relocate(const Range& moved)
+	{
+		clearPairEvents();
+		// Endpoints are only added after every value is found, as finding them needs the axes sorted
+		auto linked = std::vector<std::uint32_t>();
+		auto unlinked = false;
+		for (const auto& [value, oldBox] : moved)
+		{
+			auto i = find(oldBox, value);
+			auto box = mGetBox(value);
+			if (!isLoose(mBoxes[i]) && isLoose(box))
+			{
+				unlink(i);
+				mLoose.push_back(i);
+				unlinked = true;
+			}
+			else if (isLoose(mBoxes[i]) && !isLoose(box))
+			{
+				mLoose.erase(std::find(mLoose.begin(), mLoose.end(), i));
+				linked.push_back(i);
+			}
+			mValues[i] = value;
+			mBoxes[i] = box;
+		}
+		// Loose values do not take part in the pairs
+		if (unlinked)
+		{
+			for (auto it = mPairs.begin(); it != mPairs.end();)
+			{
+				auto [a, b] = fromKey(*it);
+				if (isLoose(mBoxes[a]) || isLoose(mBoxes[b]))
+				{
+					mRemovedPairs.emplace_back(mValues[a], mValues[b]);
+					it = mPairs.erase(it);
+				}
+				else
+					++it;
+			}
+		}
+		for (auto i : linked)
+			link(i);
+		sort();
+	}
+
+	// Replaces the content by values, the endpoints being sorted and the pairs found from scratch
+	// Pairs found by build are not reported as added
+	template <typename Range>
+	void build(const Range& values)
+	{
+		clearPairEvents();
+		mValues.assign(std::begin(values), std::end(values));
+		mBoxes.clear();
+		mLoose.clear();
+		mPairs.clear();
+		for (auto& axis : mAxes)
+			axis.clear();
+		mMaxWidth = Float(0);
+		for (auto i = std::uint32_t(0); i < mValues.size(); ++i)
+		{
+			mBoxes.push_back(mGetBox(mValues[i]));
+			if (isLoose(mBoxes[i]))
+				mLoose.push_back(i);
+			else
+				link(i);
+		}
+		for (auto& axis : mAxes)
+			std::sort(axis.begin(), axis.end(), before);
+		computeMaxWidth();
+		// Sweep the first axis, keeping the values whose interval is open
+		auto open = std::vector<std::uint32_t>();
+		for (const auto& endpoint : mAxes[0])
+		{
+			auto i = endpoint.index & IndexMask;
+			if (endpoint.index & MaxBit)
+			{
+				// The max endpoint of an empty interval comes first, it was never opened
+				auto it = std::find(open.begin(), open.end(), i);
+				if (it != open.end())
+					open.erase(it);
+			}
+			else
+			{
+				for (auto j : open)
+				{
+					if (mBoxes[i].intersects(mBoxes[j]))
+						mPairs.insert(toKey(i, j));
+				}
+				if (mBoxes[i].getRight() > mBoxes[i].left)
+					open.push_back(i);
+			}
+		}
+	}
+
+	// Pairs that started or stopped overlapping during the last call to add, remove, update or
+	// relocate, loose values excluded
+	const std::vector<std::pair<T, T>>& getAddedPairs() const
+	{
+		return mAddedPairs;
+	}
+
+	const std::vector<std::pair<T, T>>& getRemovedPairs() const
+	{
+		return mRemovedPairs;
+	}
+
+	std::vector<T> query(const Box<Float>& box) const
+	{
+		auto values = std::vector<T>();
+		forEach(box, [&values](const T& value) { values.push_back(value); });
+		return values;
+	}
+
+	// Calls fn on every value intersecting box without allocating
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn) const
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mValues[i]); return false; });
+	}
+
+	// Same as forEach but fn may modify the values in place, without changing their boxes
+	template <typename F>
+	void forEach(const Box<Float>& box, F&& fn)
+	{
+		visit(box, [this, &fn](std::uint32_t i) { fn(mValues[i]); return false; });
+	}
+
+	std::size_t count(const Box<Float>& box) const
+	{
+		auto n = std::size_t(0);
+		visit(box, [&n](std::uint32_t) { ++n; return false; });
+		return n;
+	}
+
+	// Returns true as soon as a value intersecting box satisfies pred
+	template <typename Pred>
+	bool any(const Box<Float>& box, Pred&& pred) const
+	{
+		return visit(box, [this, &pred](std::uint32_t i) { return static_cast<bool>(pred(mValues[i])); });
+	}
+
+	bool any(const Box<Float>& box) const
+	{
+		return visit(box, [](std::uint32_t) { return true; });
+	}
+
+	std::vector<T*> access(const Box<Float>& box)
+	{
+		std::vector<T*> values {};
+		forEach(box, [&values](T& value) { values.push_back(&value); });
+		return values;
+	}
+
+	// The maintained pairs, and the pairs of the loose values which are searched for
+	std::vector<std::pair<T, T>> findAllIntersections() const
+	{
+		auto intersections = std::vector<std::pair<T, T>>();
+		intersections.reserve(mPairs.size());
+		for (auto key : mPairs)
+		{
+			auto [a, b] = fromKey(key);
+			intersections.emplace_back(mValues[a], mValues[b]);
+		}
+		for (auto j = std::size_t(0); j < mLoose.size(); ++j)
+		{
+			auto i = mLoose[j];
+			visit(mBoxes[i], [this, i, &intersections](std::uint32_t k) {
+				if (!isLoose(mBoxes[k]))
+					intersections.emplace_back(mValues[i], mValues[k]);
+				return false;
+			});
+			for (auto k = std::size_t(0); k < j; ++k)
+			{
+				if (mBoxes[i].intersects(mBoxes[mLoose[k]]))
+					intersections.emplace_back(mValues[i], mValues[mLoose[k]]);
+			}
+		}
+		return intersections;
+	}
+
+	// The pairs are already known, there is nothing worth splitting between threads
+	std::vector<std::pair<T, T>> findAllIntersectionsParallel(std::size_t = std::thread::hardware_concurrency()) const
+	{
+		return findAllIntersections();
+	}
+
+	//protected:
+	// The top bit of Endpoint::index tells the max endpoint of a value from its min endpoint
+	static constexpr auto MaxBit = std::uint32_t(1) << 31;
+	static constexpr auto IndexMask = MaxBit - 1;
+
+	struct Endpoint
+	{
+		Float value;
+		std::uint32_t index;
+	};
+
+	std::vector<T> mValues;
+	std::vector<Box<Float>> mBoxes;
+	std::vector<std::uint32_t> mLoose;
+	// Endpoints sorted along x then y
+	std::array<std::vector<Endpoint>, 2> mAxes;
+	// Upper bound of the widths, queries start this far left of their box
+	Float mMaxWidth = Float(0);
+	std::unordered_set<std::uint64_t> mPairs;
+	std::vector<std::pair<T, T>> mAddedPairs;
+	std::vector<std::pair<T, T>> mRemovedPairs;
+	GetBox mGetBox;
+	Equal mEqual;
+
+	static bool isLoose(const Box<Float>& box)
+	{
+		return !std::isfinite(box.left) || !std::isfinite(box.top) || !std::isfinite(box.getRight()) || !std::isfinite(box.getBottom());
+	}
+
+	// Endpoints are ordered by value, max endpoints first so that touching boxes do not overlap
+	static bool before(const Endpoint& lhs, const Endpoint& rhs)
+	{
+		return lhs.value < rhs.value || (lhs.value == rhs.value && (lhs.index & MaxBit) && !(rhs.index & MaxBit));
+	}
+
+	static Float getEdge(const Box<Float>& box, std::size_t axis, bool max)
+	{
+		if (axis == 0)
+			return max ? box.getRight() : box.left;
+		return max ? box.getBottom() : box.top;
+	}
+
+	static std::uint64_t toKey(std::uint32_t a, std::uint32_t b)
+	{
+		return (static_cast<std::uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	}
+
+	static std::pair<std::uint32_t, std::uint32_t> fromKey(std::uint64_t key)
+	{
+		return { static_cast<std::uint32_t>(key >> 32), static_cast<std::uint32_t>(key) };
+	}
+
+	void clearPairEvents()
+	{
+		mAddedPairs.clear();
+		mRemovedPairs.clear();
+	}
+
+	// Appends the endpoints of i, sort puts them in place
+	void link(std::uint32_t i)
+	{
+		for (auto axis = std::size_t(0); axis < 2; ++axis)
+		{
+			mAxes[axis].push_back(Endpoint { getEdge(mBoxes[i], axis, false), i });
+			mAxes[axis].push_back(Endpoint { getEdge(mBoxes[i], axis, true), i | MaxBit });
+		}
+	}
+
+	// Removes the endpoints of i, its pairs are left to the caller
+	void unlink(std::uint32_t i)
+	{
+		for (auto& axis : mAxes)
+			axis.erase(std::remove_if(axis.begin(), axis.end(), [i](const Endpoint& endpoint) { return (endpoint.index & IndexMask) == i; }), axis.end());
+	}
+
+	// Reads the cached boxes into the endpoints then sorts them again
+	void sort()
+	{
+		for (auto axis = std::size_t(0); axis < 2; ++axis)
+		{
+			for (auto& endpoint : mAxes[axis])
+				endpoint.value = getEdge(mBoxes[endpoint.index & IndexMask], axis, endpoint.index & MaxBit);
+		}
+		computeMaxWidth();
+		sortAxis(mAxes[0]);
+		sortAxis(mAxes[1]);
+	}
+
+	// Widest box with endpoints, which visit looks this far left of its box for
+	void computeMaxWidth()
+	{
+		mMaxWidth = Float(0);
+		for (const auto& endpoint : mAxes[0])
+		{
+			const auto& box = mBoxes[endpoint.index & IndexMask];
+			mMaxWidth = std::max(mMaxWidth, box.getRight() - box.left);
+		}
+		// Round up so that queries do not miss values because of the subtraction in visit
+		mMaxWidth = std::nextafter(mMaxWidth, std::numeric_limits<Float>::infinity());
+	}
+
+	void sortAxis(std::vector<Endpoint>& endpoints)
+	{
+		for (auto j = std::size_t(1); j < endpoints.size(); ++j)
+		{
+			auto endpoint = endpoints[j];
+			auto k = j;
+			for (; k > 0 && before(endpoint, endpoints[k - 1]); --k)
+			{
+				const auto& other = endpoints[k - 1];
+				auto a = endpoint.index & IndexMask;
+				auto b = other.index & IndexMask;
+				// A min endpoint passing a max one starts an overlap on this axis, the other way
+				// around ends it, and endpoints of the same kind do not change anything
+				if ((endpoint.index & MaxBit) != (other.index & MaxBit) && a != b)
+				{
+					if (!(endpoint.index & MaxBit))
+					{
+						if (mBoxes[a].intersects(mBoxes[b]) && mPairs.insert(toKey(a, b)).second)
+							mAddedPairs.emplace_back(mValues[a], mValues[b]);
+					}
+					else if (mPairs.erase(toKey(a, b)) > 0)
+						mRemovedPairs.emplace_back(mValues[a], mValues[b]);
+				}
+				endpoints[k] = other;
+			}
+			endpoints[k] = endpoint;
+		}
+	}
+
+	// Calls fn on the indices of the values intersecting box until it returns true
+	template <typename F>
+	bool visit(const Box<Float>& box, F&& fn) const
+	{
+		// Values intersecting box start less than the widest width left of it
+		const auto& endpoints = mAxes[0];
+		auto it = std::lower_bound(endpoints.begin(), endpoints.end(), box.left - mMaxWidth,
+			[](const Endpoint& endpoint, Float value) { return endpoint.value < value; });
+		for (; it != endpoints.end() && !(it->value >= box.getRight()); ++it)
+		{
+			auto i = it->index & IndexMask;
+			if (!(it->index & MaxBit) && box.intersects(mBoxes[i]) && fn(i))
+				return true;
+		}
+		for (auto i : mLoose)
+		{
+			if (box.intersects(mBoxes[i]) && fn(i))
+				return true;
+		}
+		return false;
+	}
+
+	// Returns the index of value, looking for it around box
+	std::uint32_t find(const Box<Float>& box, const T& value) const
+	{
+		auto found = std::uint32_t(0);
+		auto present = visit(box, [this, &value, &found](std::uint32_t i) {
+			found = i;
+			return mEqual(value, mValues[i]);
+		});
+		// Boxes of width or height 0 do not intersect anything, look at every value
+		if (!present)
+		{
+			auto it = std::find_if(std::begin(mValues), std::end(mValues), [this, &value](const auto& rhs) { return mEqual(value, rhs); });
+			present = it != std::end(mValues);
+			found = static_cast<std::uint32_t>(std::distance(std::begin(mValues), it));
+		}
+		assert(present && "Trying to find a value that is not present");
+		return found;
+	}
+
+	// Pairs of a linked value, found with its box as they are exactly the values it intersects
+	template <typename F>
+	void forEachPartner(std::uint32_t i, F&& fn) const
+	{
+		visit(mBoxes[i], [this, i, &fn](std::uint32_t j) {
+			if (j != i && !isLoose(mBoxes[j]))
+				fn(j);
+			return false;
+		});
+	}
+
+	void erase(std::uint32_t i)
+	{
+		// Drop the pairs and endpoints of the value, then move the last one in its place
+		if (isLoose(mBoxes[i]))
+			mLoose.erase(std::find(mLoose.begin(), mLoose.end(), i));
+		else
+		{
+			forEachPartner(i, [this, i](std::uint32_t j) {
+				mPairs.erase(toKey(i, j));
+				mRemovedPairs.emplace_back(mValues[i], mValues[j]);
+			});
+			unlink(i);
+		}
+		auto last = static_cast<std::uint32_t>(mValues.size() - 1);
+		if (i != last)
+		{
+			if (isLoose(mBoxes[last]))
+				*std::find(mLoose.begin(), mLoose.end(), last) = i;
+			else
+			{
+				forEachPartner(last, [this, i, last](std::uint32_t j) {
+					mPairs.erase(toKey(last, j));
+					mPairs.insert(toKey(i, j));
+				});
+				for (auto& axis : mAxes)
+				{
+					for (auto& endpoint : axis)
+					{
+						if ((endpoint.index & IndexMask) == last)
+							endpoint.index = i | (endpoint.index & MaxBit);
+					}
+				}
+			}
+			mValues[i] = std::move(mValues[last]);
+			mBoxes[i] = mBoxes[last];
+		}
+		mValues.pop_back();
+		mBoxes.pop_back();
+	}
+};
+
+}
@@ -11,8 +11,10 @@
 #include <SFML/OpenGL.hpp>
 #include <SFML/System/Clock.hpp>
 #include <cmath>
+#include <future>
 #include <memory>
 #include <sstream>
+#include <variant>
 
 class Application
 {
@@ -20,7 +22,8 @@ public:
 	Application(AppConfig config) :
 		config { config },
 		render_window { sf::VideoMode(config.width, config.height), config.title.c_str(), sf::Style::Default, config.renderSettings },
-		sfgui {}
+		sfgui {},
+		elements { makeElements(config.broadphase) }
 	{
 		loadFonts();
 		configure();
@@ -86,6 +89,12 @@ public:
 	}
 
 	int run()
+	{
+		return std::visit([this](auto& elements) { return this->run(elements); }, this->elements);
+	}
+
+	template <typename Elements>
+	int run(Elements& elements)
 	{
 		sf::Texture m_background_texture;
 		sf::Sprite m_background_sprite;
@@ -189,15 +198,15 @@ public:
 		const auto toggleElementBool = [&](std::string const& setting) {
 			if (setting == "collide_all")
 			{
-				this->elements.collide_all = !this->elements.collide_all;
+				elements.collide_all = !elements.collide_all;
 			}
 			else if (setting == "show_bounds")
 			{
-				this->elements.show_bounds = !this->elements.show_bounds;
+				elements.show_bounds = !elements.show_bounds;
 			}
 			else if (setting == "show_collisions")
 			{
-				this->elements.show_collisions = !this->elements.show_collisions;
+				elements.show_collisions = !elements.show_collisions;
 			}
 			else
 			{
@@ -219,8 +228,8 @@ public:
 		buttons_frame->Add(buttons);
 
 		// Update the currently selected element
-		clear_button->GetSignal(sfg::Notebook::OnLeftClick).Connect([this] {
-			this->elements.clear();
+		clear_button->GetSignal(sfg::Notebook::OnLeftClick).Connect([&elements] {
+			elements.clear();
 		});
 
 		auto layout = sfg::Box::Create(sfg::Box::Orientation::VERTICAL);
@@ -235,12 +244,39 @@ public:
 		info_frame->Add(info_layout);
 		auto info_table = sfg::Table::Create();
 
-		const auto get_debug_values = [this]() -> std::map<std::string, std::string> {
-			return {
-				{ "Total Elements", std::to_string(this->elements.size()) },
-				{ "Drawn Elements", std::to_string(this->elements.query(this->elements.screen_size).size()) },
+		const auto get_debug_values = [this, &elements]() -> std::map<std::string, std::string> {
+			auto values = std::map<std::string, std::string> {
+				{ "Total Elements", std::to_string(elements.size()) },
+				{ "Drawn Elements", std::to_string(elements.count(elements.screen_size)) },
 				{ "Last Element ID", this->last_element.id },
 			};
+			// Shape of the tree and work of the queries since the previous frame
+			if constexpr (requires { elements.getStats(); })
+			{
+				const auto stats = elements.getStats();
+				std::ostringstream depths;
+				for (auto count : stats.nodesPerDepth)
+					depths << count << ' ';
+				values["Tree Nodes"] = std::to_string(stats.nodes) + " (" + std::to_string(stats.leaves) + " leaves)";
+				values["Nodes per Depth"] = depths.str();
+				values["Values per Node"] = "max " + std::to_string(stats.valuesPerNode.size() - 1) + ", " + std::to_string(stats.interiorValues) + " interior";
+				values["Tree Memory"] = std::to_string(stats.bytes / 1024) + " KiB";
+				values["Queries"] = std::to_string(stats.queries);
+				values["Nodes Visited"] = std::to_string(stats.nodesVisited);
+				values["Boxes Tested"] = std::to_string(stats.boxesTested);
+				elements.resetStats();
+			}
+			// Read from the summaries of the roots, without visiting the elements
+			if constexpr (requires { elements.summarize(); })
+			{
+				const auto summary = elements.summarize();
+				const auto center = summary.getCenterOfMass();
+				std::ostringstream center_text;
+				center_text << center.x << ", " << center.y;
+				values["Total Mass"] = std::to_string(summary.mass);
+				values["Center of Mass"] = center_text.str();
+			}
+			return values;
 		};
 
 		for (size_t idx = 0; auto& [key, value] : get_debug_values())
@@ -278,12 +314,12 @@ public:
 			Element element { this->element_types.at(this->active_element_name) };
 			element.setPosition(pos);
 			element.shape.setScale(sf::Vector2f(element_size, element_size));
-			this->last_element = this->elements.emplace(element);
+			this->last_element = elements.emplace(element);
 			last_placed_pos = pos;
 		};
 
 		canvas->GetSignal(sfg::Canvas::OnMouseMove).Connect([&] {
-			this->elements.screen_size = this->window_canvas->GetClientRect();
+			elements.screen_size = this->window_canvas->GetClientRect();
 			const auto mouse_pos = getRelMousePos();
 			const auto left_held = sf::Mouse::isButtonPressed(sf::Mouse::Button::Left);
 			const auto placed_difference = sf::Vector2f(std::abs(last_placed_pos.x - mouse_pos.x), std::abs(last_placed_pos.y - mouse_pos.y));
@@ -308,6 +344,8 @@ public:
 
 		std::fill(std::begin(frame_times), std::end(frame_times), 0);
 
+		std::future<void> step;
+
 		desktop.Update(0.f);
 		while (render_window.isOpen())
 		{
@@ -327,8 +365,13 @@ public:
 				auto dT = float(clock.getElapsedTime().asMicroseconds()) / 1000000.f;
 				// Update() takes the elapsed time in seconds.
 				desktop.Update(dT);
+				// The elements move and their next snapshot is built on another thread while the
+				// last snapshot is drawn, events are only handled once they are done
 				// FIXME: Why slow if not * 10!?
-				elements.update(dT * 10);
+				step = std::async(std::launch::async, [&elements, dT] {
+					elements.update(dT * 10);
+					elements.publish();
+				});
 
 				clock.restart();
 			}
@@ -344,6 +387,11 @@ public:
 			canvas->Display();
 			canvas->Unbind();
 
+			if (step.valid())
+			{
+				step.get();
+			}
+
 			// Update debug info
 			for (auto& [key, value] : get_debug_values())
 			{
@@ -416,9 +464,28 @@ protected:
 	const std::unordered_map<std::string, Element> element_types {
 		{ "sand", Element { .color = sf::Color::Yellow } },
 		{ "grass", Element { .color = sf::Color::Green, .fixed = true } },
-		{ "water", Element { .color = sf::Color::Blue } },
-		{ "fire", Element { .color = sf::Color::Red, .mass = -1.5 } },
+		{ "water", Element { .color = sf::Color::Blue, .category = LIQUID } },
+		// Fire rises through water and other fire, only solids stop it
+		{ "fire", Element { .color = sf::Color::Red, .mass = -1.5, .category = GAS, .mask = SOLID } },
 	};
 
-	ElementTree elements {};
+	std::variant<ElementTree, ElementGrid, ElementSweep, ElementBvh> elements;
+
+	static std::variant<ElementTree, ElementGrid, ElementSweep, ElementBvh> makeElements(std::string const& broadphase)
+	{
+		if (broadphase == "grid")
+		{
+			return ElementGrid { GRID_CELL_SIZE };
+		}
+		if (broadphase == "sap")
+		{
+			return ElementSweep {};
+		}
+		if (broadphase == "bvh")
+		{
+			return ElementBvh { AABB_MARGIN };
+		}
+		// AppConfig::loadFile reports any other value and replaces it by "quadtree"
+		return ElementTree { INITIAL_SIZE };
+	}
 };
\ No newline at end of file
@@ -15,6 +15,9 @@ struct AppConfig
 	std::string title = "Kessler Syndrome";
 	sf::ContextSettings renderSettings { 0, 0, 4 };
 
+	// Spatial index of the elements, "quadtree", "grid", "sap" or "bvh"
+	std::string broadphase = "quadtree";
+
 	static AppConfig loadFile(util::fs::path path)
 	{
 		std::ifstream conf_file(path.c_str());
@@ -24,6 +27,16 @@ struct AppConfig
 			conf_file >> config.width;
 			conf_file >> config.height;
 			conf_file >> config.frame_rate;
+			// Optional, older files stop at the frame rate
+			if (!(conf_file >> config.broadphase))
+			{
+				config.broadphase = "quadtree";
+			}
+			else if (config.broadphase != "quadtree" && config.broadphase != "grid" && config.broadphase != "sap" && config.broadphase != "bvh")
+			{
+				std::cout << "Unknown broadphase " << config.broadphase << " in " << path << ", loading quadtree" << std::endl;
+				config.broadphase = "quadtree";
+			}
 		}
 		else
 		{
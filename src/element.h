@@ -5,14 +5,22 @@
 #include <vector>
 
 #include "./uuid.h"
+#include "bvh/bvh.h"
+#include "hashgrid/hashgrid.h"
+#include "layered/layered.h"
 #include "quadtree/quadtree.h"
+#include "quadtree/snapshot.h"
+#include "sap/sap.h"
 #include <algorithm>
 #include <cassert>
+#include <concepts>
 #include <cstdio>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <random>
 #include <ranges>
+#include <set>
 #include <type_traits>
 #include <vector>
 
@@ -48,8 +56,14 @@ static bool random_bool()
 
 static sf::Vector2f DEFAULT_POSITION { std::numeric_limits<float>::min(), std::numeric_limits<float>::min() };
 
+// Collision categories of the elements, an element only collides with the categories of its mask
+static constexpr quadtree::Categories SOLID = 1 << 0;
+static constexpr quadtree::Categories LIQUID = 1 << 1;
+static constexpr quadtree::Categories GAS = 1 << 2;
+
 struct Element;
-class ElementTree;
+template <typename Index>
+class BasicElementTree;
 using ElementList = std::vector<Element>;
 
 struct Element
@@ -71,27 +85,43 @@ struct Element
 	// True if this block should render
 	bool visible { true };
 
+	// Collision category of this block and the categories it collides with
+	quadtree::Categories category { SOLID };
+	quadtree::Categories mask { quadtree::AllCategories };
+
 	// Holds transformable properties such as position and scale
 	Element::Shape shape { sf::Vector2f(1, 1) };
 
 	// A unique element id
 	uuid::uuid4 id = uuid::generate_uuid_v4();
 
+	quadtree::Layer getLayer() const
+	{
+		return quadtree::Layer { this->category, this->mask };
+	}
+
 	bool collides(Element element, sf::Vector2f position = DEFAULT_POSITION) const
 	{
+		if (!this->getLayer().collides(element.getLayer()))
+		{
+			return false;
+		}
 		auto next_draw = Element::Shape(this->shape);
 		next_draw.setPosition(position == DEFAULT_POSITION ? this->shape.getPosition() : position);
 		return element.shape.getGlobalBounds().intersects(next_draw.getGlobalBounds());
 	}
 
-	bool canMove(const sf::Vector2f& next_pos, const std::vector<Element*>& elements)
+	// Tests every element of a range, such as the lazy view of a tree, at its current bounds
+	template <std::ranges::input_range Elements>
+		requires std::same_as<std::ranges::range_value_t<Elements>, Element>
+	bool canMove(const sf::Vector2f& next_pos, const Elements& elements, float = 0.f) const
 	{
-		auto not_self = [this](const Element* e) { return e->id != this->id; };
-		for (auto element : elements | std::views::filter(not_self))
+		auto not_self = [this](const Element& e) { return e.id != this->id; };
+		for (const auto& element : elements | std::views::filter(not_self))
 		{
-			if (this->collides(*element, next_pos))
+			if (this->collides(element, next_pos))
 			{
-				if (element->fixed)
+				if (element.fixed)
 				{
 					return false;
 				}
@@ -104,6 +134,44 @@ struct Element
 		return true;
 	}
 
+	// Same as above against every element of a tree, stopping at the first collision
+	// Elements moved earlier in the frame are still indexed at their old box, at most reach away
+	// from their current bounds, so the tree is queried that much around the next bounds and
+	// the collision is tested again against the current bounds
+	template <typename Tree>
+		requires(!std::ranges::range<Tree>)
+	bool canMove(const sf::Vector2f& next_pos, const Tree& tree, float reach = 0.f) const
+	{
+		auto next_draw = Element::Shape(this->shape);
+		next_draw.setPosition(next_pos);
+		const auto next_bounds = next_draw.getGlobalBounds();
+		// An element moving by more than half its size could step over a thin fixed element,
+		// the path of its center is cast first when the tree supports it
+		if constexpr (requires { tree.segmentCast(quadtree::Vector2<float>(), quadtree::Vector2<float>(), [](const Element&) { return true; }); })
+		{
+			const auto bounds = this->shape.getGlobalBounds();
+			const auto step = next_pos - this->getPosition();
+			if (2 * std::abs(step.x) > bounds.width || 2 * std::abs(step.y) > bounds.height)
+			{
+				const auto from = quadtree::Box<float>(bounds).getCenter();
+				const auto to = quadtree::Box<float>(next_bounds).getCenter();
+				if (tree.segmentCast(from, to, [this](const Element& e) { return e.fixed && e.id != this->id && this->getLayer().collides(e.getLayer()); }))
+					return false;
+			}
+		}
+		const auto blocks = [this, &next_bounds](const Element& e) { return e.id != this->id && e.shape.getGlobalBounds().intersects(next_bounds); };
+		const auto window = quadtree::Box<float>(next_bounds.left - reach, next_bounds.top - reach, next_bounds.width + 2 * reach, next_bounds.height + 2 * reach);
+		// Trees filtering by layer skip the subtrees without any category of the mask
+		if constexpr (requires { tree.any(window, this->getLayer(), blocks); })
+		{
+			return !tree.any(window, this->getLayer(), blocks);
+		}
+		else
+		{
+			return !tree.any(window, [this, &blocks](const Element& e) { return this->getLayer().collides(e.getLayer()) && blocks(e); });
+		}
+	}
+
 	// All beacause sf::Transformable defines a useless explicit default ctor...
 	template <typename... Args>
 	auto setPosition(Args&&... args)
@@ -116,8 +184,10 @@ struct Element
 		return this->shape.getPosition();
 	}
 
-	// Update block physics
-	void update(double dT, const std::vector<Element*>& elements)
+	// Update block physics, elements is either a list of neighbors or a whole tree in which the
+	// elements that already moved may be up to reach away from their indexed box
+	template <typename Neighbors>
+	void update(double dT, const Neighbors& elements, float reach = 0.f)
 	{
 		if (!this->fixed)
 		{
@@ -135,7 +205,7 @@ struct Element
 
 			auto dPos = sf::Vector2f(next_velocity.x * dT, next_velocity.y * dT);
 			auto next_pos = this->getPosition() + dPos;
-			if (this->canMove(next_pos, elements))
+			if (this->canMove(next_pos, elements, reach))
 			{
 				this->velocity = next_velocity;
 				this->setPosition(next_pos);
@@ -146,7 +216,7 @@ struct Element
 				auto checkDir = [&](float dir) {
 					auto next_v = this->velocity + sf::Vector2f(dV.x + dir * (dV.y / 2), 0);
 					auto next_p = this->getPosition() + sf::Vector2f(next_v.x * dT, next_v.y * dT);
-					if (this->canMove(next_p, elements))
+					if (this->canMove(next_p, elements, reach))
 					{
 						this->velocity = next_v;
 						this->setPosition(next_p);
@@ -163,7 +233,7 @@ struct Element
 				{
 				}
 				// Check if stuck
-				else if (!this->canMove(this->getPosition(), elements))
+				else if (!this->canMove(this->getPosition(), elements, reach))
 				{
 					this->velocity = next_velocity;
 					this->setPosition(next_pos);
@@ -176,15 +246,25 @@ struct Element
 		}
 	}
 
-	// Render a block on screen
-	void draw(sfg::Canvas::Ptr canvas)
+	// Render a block on screen, its shape is filled with its color once it is emplaced in a tree
+	void draw(sfg::Canvas::Ptr canvas) const
 	{
 		if (this->visible)
 		{
-			this->shape.setFillColor(this->color);
 			canvas->Draw(this->shape);
 		}
 	}
+
+	// Same in another color, through a shape reused from one call to the next
+	void draw(sfg::Canvas::Ptr canvas, const sf::Color& color, Element::Shape& brush) const
+	{
+		if (this->visible)
+		{
+			brush = this->shape;
+			brush.setFillColor(color);
+			canvas->Draw(brush);
+		}
+	}
 };
 
 static quadtree::Box<float> getElementBox(Element const& element)
@@ -194,44 +274,143 @@ static quadtree::Box<float> getElementBox(Element const& element)
 
 static quadtree::Box<float> MAX_SIZE { sf::Vector2f { 0, 0 }, sf::Vector2f { std::numeric_limits<float>::max(), std::numeric_limits<float>::max() } };
 
+// Intersects every element, wherever it is
+static constexpr quadtree::Box<float> EVERYTHING { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+	std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity() };
+
+// Initial bounds of the tree, it grows and shrinks to fit the elements
+static quadtree::Box<float> INITIAL_SIZE { sf::Vector2f { 0, 0 }, sf::Vector2f { 16, 16 } };
+
+// Cell size of the grid, elements are placed with a scale of 10
+static constexpr float GRID_CELL_SIZE = 16.f;
+
+// Margin of the boxes in the aabb tree, elements move by a few pixels per frame
+static constexpr float AABB_MARGIN = 2.f;
+
 static bool operator==(Element const& lhs, Element const& rhs) noexcept
 {
 	return lhs.id == rhs.id;
 }
 
-class ElementTree : public quadtree::Quadtree<Element, decltype(getElementBox)*>
+// Fixed elements are kept in the static layer of the layered index
+struct IsFixed
+{
+	bool operator()(Element const& element) const
+	{
+		return element.fixed;
+	}
+};
+
+struct GetElementLayer
+{
+	quadtree::Layer operator()(Element const& element) const
+	{
+		return element.getLayer();
+	}
+};
+
+// Mass of the elements of a subtree and their moment about the origin, for its center of mass
+struct ElementAggregate
+{
+	static constexpr auto Enabled = true;
+
+	struct Summary
+	{
+		float mass = 0.f;
+		sf::Vector2f moment { 0.f, 0.f };
+
+		sf::Vector2f getCenterOfMass() const
+		{
+			return mass != 0.f ? moment / mass : sf::Vector2f { 0.f, 0.f };
+		}
+	};
+
+	Summary summarize(Element const& element, quadtree::Box<float> const& box) const
+	{
+		const auto center = box.getCenter();
+		return Summary { element.mass, sf::Vector2f { center.x, center.y } * element.mass };
+	}
+
+	Summary combine(Summary const& lhs, Summary const& rhs) const
+	{
+		return Summary { lhs.mass + rhs.mass, lhs.moment + rhs.moment };
+	}
+};
+
+// The quadtrees filter the pairs and the collision tests by layer and keep the mass of each
+// subtree
+template <typename Storage, typename Stats = quadtree::NoStats>
+using ElementQuadtree = quadtree::Quadtree<Element, decltype(getElementBox)*, std::equal_to<Element>, float, Storage, Stats, quadtree::FixedSplit<>, quadtree::TightBounds, quadtree::CategoryFilter<GetElementLayer>, ElementAggregate>;
+
+// Elements stored in a spatial index, either a quadtree::Quadtree, a hashgrid::HashGrid, a
+// sap::SweepAndPrune, a bvh::AabbTree or a layered::LayeredIndex of them. They are constructed from their parameters, the initial
+// box, the cell size, nothing or the margin, followed by getElementBox. size() and clear() are
+// the index's own, they do not visit the elements.
+// With a layered index, fixed elements are held back until the next update and added in one
+// batch, so that its static layer is built again once per step instead of once per element.
+// Queries do not see them before that, and neither do the snapshots drawn meanwhile.
+template <typename Index>
+class BasicElementTree : public Index
 {
 public:
 	using BoxType = Element::Shape;
 
 	decltype(MAX_SIZE) screen_size = MAX_SIZE;
 
-	ElementTree(decltype(MAX_SIZE) world_size = MAX_SIZE) :
-		quadtree::Quadtree<Element, decltype(getElementBox)*>(world_size, getElementBox)
+	template <typename... Parameters>
+	explicit BasicElementTree(const Parameters&... parameters) :
+		Index(parameters..., getElementBox),
+		snapshots(std::make_unique<quadtree::Snapshots<Snapshot>>())
+	{
+		publish();
+	}
+
+	// Read-only copy of the elements drawn while the next step moves them
+	using Snapshot = ElementQuadtree<quadtree::FlatStorage>;
+
+	// Copies the elements into a new snapshot, called once per step by the thread moving them
+	std::uint64_t publish()
 	{
-		screen_size = world_size;
+		auto snapshot = Snapshot(INITIAL_SIZE, getElementBox);
+		if constexpr (requires { this->all(); })
+			snapshot.build(this->all());
+		else
+			snapshot.build(this->query(EVERYTHING));
+		return snapshots->publish(std::move(snapshot));
 	}
 
-	auto emplace(const Element& value)
+	// The last snapshot published, safe to call from any thread
+	auto readSnapshot() const
+	{
+		return snapshots->read();
+	}
+
+	// The element returned for a held back fixed element is only valid until the next emplace
+	Element& emplace(const Element& value)
 	{
 		Element el { value };
 		el.id = uuid::generate_uuid_v4();
-		return this->add(mRoot.get(), 0, mBox, el);
+		el.shape.setFillColor(el.color);
+		if constexpr (requires { this->getStatic(); })
+		{
+			if (el.fixed)
+			{
+				placed.push_back(el);
+				return placed.back();
+			}
+		}
+		return this->add(el);
 	}
 
 	std::size_t size() const
 	{
-		auto children = this->query(MAX_SIZE);
-		return children.size();
+		return Index::size() + placed.size();
 	}
 
 	void clear()
 	{
-		auto children = this->query(MAX_SIZE);
-		for (auto child : children)
-		{
-			this->remove(child);
-		}
+		placed.clear();
+		Index::clear();
 	}
 
 	bool show_bounds = false;
@@ -258,30 +437,36 @@ public:
 		return this->access(getSearchWindowForElement(element).getGlobalBounds());
 	}
 
+	// The k elements closest to element, closest first, for the indexes answering nearest queries
+	std::vector<Element*> accessNearest(const Element& element, std::size_t k)
+		requires requires(Index& index) { index.forEachNearest(quadtree::Vector2<float>(), k, [](Element&) {}); }
+	{
+		std::vector<Element*> nearest {};
+		const auto bounds = getElementBox(element);
+		this->forEachNearest(bounds.getCenter(), k + 1, [&](Element& other) {
+			if (other.id != element.id && nearest.size() < k)
+				nearest.push_back(&other);
+		});
+		return nearest;
+	}
+
+	// Draws the last snapshot, so that it can run while another thread updates the elements
 	void draw(sfg::Canvas::Ptr canvas)
 	{
-		auto children = this->access(screen_size);
+		const auto snapshot = readSnapshot();
 
-		auto intersection_pairs = this->findAllIntersections();
-		std::map<decltype(Element::id), Element*> intersections {};
-		for (auto& pair : intersection_pairs)
+		std::set<decltype(Element::id)> intersections {};
+		if (show_collisions)
 		{
-			for (auto& child : { pair.first, pair.second })
+			for (const auto& [first, second] : snapshot->findAllIntersectionsParallel())
 			{
-				if (!intersections.contains(child.id))
-				{
-					auto found = std::find_if(children.begin(), children.end(), [&child](const auto& e) { return e->id == child.id; });
-					if (found != children.end())
-					{
-						intersections[child.id] = *found;
-					}
-				}
+				intersections.insert(first.id);
+				intersections.insert(second.id);
 			}
 		}
-		for (auto& child : children)
-		{
-
-			auto search_box = getSearchWindowForElement(*child);
+		Element::Shape brush {};
+		snapshot->forEach(screen_size, [&](const Element& child) {
+			auto search_box = getSearchWindowForElement(child);
 			if (show_bounds)
 			{
 				search_box.setOutlineThickness(0.1);
@@ -290,33 +475,100 @@ public:
 				canvas->Draw(search_box);
 			}
 
-			if (show_collisions && intersections.contains(child->id))
+			if (intersections.contains(child.id))
 			{
-				auto orig_color = child->color;
-				child->color = sf::Color::White;
-				child->draw(canvas);
-				child->color = orig_color;
+				child.draw(canvas, sf::Color::White, brush);
 			}
 			else
 			{
-				child->draw(canvas);
+				child.draw(canvas);
 			}
-		}
+		});
 	}
 
 	void update(double dT)
 	{
-
-		auto children = this->access(screen_size);
-		auto intersections = this->findAllIntersections();
-		// For every child, only pass nearest neighbors for collision detection
-		for (auto& child : children)
+		if constexpr (requires { this->insertAll(placed); })
 		{
-			// Only update moveable elements
-			if (!child->fixed)
+			if (!placed.empty())
 			{
-				child->update(dT, collide_all ? children : this->accessNeighbors(*child));
+				this->insertAll(placed);
+				placed.clear();
+			}
+		}
+		// Largest move so far in this step, the moved elements are only relocated at the end
+		auto reach = 0.f;
+		if constexpr (requires { this->handles(screen_size); })
+		{
+			// Walked lazily by the elements colliding with all the others, the tree does not
+			// change until the moved elements are relocated
+			const auto children = this->view(screen_size);
+			// The tree caches the box of each element, so moved elements are relocated by handle
+			// without being copied
+			std::vector<quadtree::Handle> moved {};
+			for (auto handle : this->handles(screen_size))
+			{
+				if (updateElement(this->get(handle), children, dT, reach))
+				{
+					moved.push_back(handle);
+				}
+			}
+			this->relocate(moved);
+		}
+		else
+		{
+			// Elements move in place, remember their previous box so the index can relocate them afterwards
+			std::vector<std::pair<Element, quadtree::Box<float>>> moved {};
+			auto elements = this->access(screen_size);
+			const auto children = elements | std::views::transform([](Element* element) -> Element& { return *element; });
+			for (auto& child : children)
+			{
+				const auto old_box = getElementBox(child);
+				if (updateElement(child, children, dT, reach))
+				{
+					moved.emplace_back(child, old_box);
+				}
 			}
+			this->relocate(moved);
 		}
 	}
-};
\ No newline at end of file
+
+private:
+	// Kept behind a pointer so the tree can still be moved
+	std::unique_ptr<quadtree::Snapshots<Snapshot>> snapshots;
+
+	// Fixed elements waiting for the next update to be added to the index
+	std::vector<Element> placed;
+
+	// Returns true if the element moved, reach is raised to the length of its move on each axis
+	template <typename Children>
+	bool updateElement(Element& child, const Children& children, double dT, float& reach)
+	{
+		// Only update moveable elements
+		if (child.fixed)
+		{
+			return false;
+		}
+		const auto old_position = child.getPosition();
+		if (collide_all)
+		{
+			child.update(dT, children);
+		}
+		else
+		{
+			// Collisions are tested directly against the tree, without collecting neighbors
+			child.update(dT, static_cast<const BasicElementTree&>(*this), reach);
+		}
+		const auto step = child.getPosition() - old_position;
+		reach = std::max({ reach, std::abs(step.x), std::abs(step.y) });
+		return child.getPosition() != old_position;
+	}
+};
+
+// Fixed elements never move, they are kept in a flat quadtree that is never relocated and
+// their pairs are not looked for. Both quadtrees count the work of their queries for the Info
+// frame
+using ElementTree = BasicElementTree<layered::LayeredIndex<Element, IsFixed, ElementQuadtree<quadtree::FlatStorage, quadtree::CountStats>, ElementQuadtree<quadtree::PointerStorage, quadtree::CountStats>>>;
+using ElementGrid = BasicElementTree<hashgrid::HashGrid<Element, decltype(getElementBox)*>>;
+using ElementSweep = BasicElementTree<sap::SweepAndPrune<Element, decltype(getElementBox)*>>;
+using ElementBvh = BasicElementTree<bvh::AabbTree<Element, decltype(getElementBox)*>>;
\ No newline at end of file
@@ -10,7 +10,7 @@ static std::uniform_int_distribution<> dis2(8, 11);
 
 using uuid4 = std::string;
 
-std::string generate_uuid_v4()
+inline std::string generate_uuid_v4()
 {
 	std::stringstream ss;
 	int i;
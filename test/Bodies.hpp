@@ -0,0 +1,78 @@
+#ifndef TEST_BODIES_HPP
+#define TEST_BODIES_HPP
+
+#include "quadtree/quadtree.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Minimal values used to exercise the spatial indexes without SFML shapes
+struct Body
+{
+	int id;
+	quadtree::Box<float> box;
+};
+
+inline quadtree::Box<float> getBodyBox(const Body& body)
+{
+	return body.box;
+}
+
+inline bool operator==(const Body& lhs, const Body& rhs)
+{
+	return lhs.id == rhs.id;
+}
+
+template <typename Storage = quadtree::PointerStorage, typename Stats = quadtree::NoStats>
+using BodyTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, Storage, Stats>;
+
+// Spreads count bodies of the given size over a world of worldSize x worldSize
+inline std::vector<Body> makeBodies(int count, float worldSize = 1000.f, float size = 10.f)
+{
+	auto bodies = std::vector<Body>();
+	const auto cells = static_cast<long long>(worldSize - size);
+	for (auto i = 0; i < count; ++i)
+	{
+		const auto x = static_cast<float>((i * 7919ll) % cells);
+		const auto y = static_cast<float>((i * 6271ll + i * 7919ll / cells) % cells);
+		bodies.push_back(Body { i, { x, y, size, size } });
+	}
+	return bodies;
+}
+
+inline int getBodyId(const Body& body)
+{
+	return body.id;
+}
+
+inline int getBodyId(const Body* body)
+{
+	return body->id;
+}
+
+// Sorted ids of the bodies or pointers to bodies in values, to compare results regardless of order
+template <typename Range>
+std::vector<int> sortedIds(const Range& values)
+{
+	auto ids = std::vector<int>();
+	for (const auto& value : values)
+	{
+		ids.push_back(getBodyId(value));
+	}
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+// Sorted pairs of ids, the smaller one first, to compare intersections regardless of order
+inline std::vector<std::pair<int, int>> normalized(const std::vector<std::pair<Body, Body>>& pairs)
+{
+	auto ids = std::vector<std::pair<int, int>>();
+	for (const auto& [lhs, rhs] : pairs)
+	{
+		ids.emplace_back(std::min(lhs.id, rhs.id), std::max(lhs.id, rhs.id));
+	}
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+#endif // TEST_BODIES_HPP
@@ -0,0 +1,479 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include "Bodies.hpp"
+#include "bvh/bvh.h"
+#include "layered/layered.h"
+#include "quadtree/inserter.h"
+#include "quadtree/snapshot.h"
+#include "sap/sap.h"
+#include <mutex>
+#include <ranges>
+#include <thread>
+
+// Benchmarks are hidden, run them with: tests_kessler-syndrome "[benchmark]"
+
+namespace
+{
+const quadtree::Box<float> BENCH_WORLD { 0.f, 0.f, 4096.f, 4096.f };
+
+std::vector<quadtree::Box<float>> makeWindows(int count)
+{
+	auto windows = std::vector<quadtree::Box<float>>();
+	for (auto i = 0; i < count; ++i)
+	{
+		windows.emplace_back(static_cast<float>((i * 1031) % 4000), static_cast<float>((i * 2017) % 4000), 64.f, 64.f);
+	}
+	return windows;
+}
+
+template <typename Tree>
+void fill(Tree& tree, const std::vector<Body>& bodies)
+{
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+}
+}
+
+TEST_CASE("quadtree storage layouts at 100k values", "[.][benchmark]")
+{
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	const auto windows = makeWindows(1000);
+
+	BodyTree<quadtree::PointerStorage> pointerTree { BENCH_WORLD, getBodyBox };
+	BodyTree<quadtree::FlatStorage> flatTree { BENCH_WORLD, getBodyBox };
+	BodyTree<quadtree::FlatStorage> packedTree { BENCH_WORLD, getBodyBox };
+	fill(pointerTree, bodies);
+	fill(flatTree, bodies);
+	fill(packedTree, bodies);
+	packedTree.mNodes.pack();
+
+	const auto queryAll = [&windows](auto& tree) {
+		auto found = std::size_t(0);
+		for (const auto& window : windows)
+		{
+			found += tree.access(window).size();
+		}
+		return found;
+	};
+
+	BENCHMARK("build pointer")
+	{
+		BodyTree<quadtree::PointerStorage> tree { BENCH_WORLD, getBodyBox };
+		fill(tree, bodies);
+		return tree.mBox.width;
+	};
+	BENCHMARK("build flat")
+	{
+		BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+		fill(tree, bodies);
+		return tree.mBox.width;
+	};
+
+	BENCHMARK("access pointer")
+	{
+		return queryAll(pointerTree);
+	};
+	BENCHMARK("access flat")
+	{
+		return queryAll(flatTree);
+	};
+	BENCHMARK("access flat packed")
+	{
+		return queryAll(packedTree);
+	};
+
+	BENCHMARK("findAllIntersections pointer")
+	{
+		return pointerTree.findAllIntersections().size();
+	};
+	BENCHMARK("findAllIntersections flat")
+	{
+		return flatTree.findAllIntersections().size();
+	};
+	BENCHMARK("findAllIntersections flat packed")
+	{
+		return packedTree.findAllIntersections().size();
+	};
+
+	BENCHMARK("findAllIntersectionsParallel pointer")
+	{
+		return pointerTree.findAllIntersectionsParallel().size();
+	};
+	BENCHMARK("findAllIntersectionsParallel flat packed")
+	{
+		return packedTree.findAllIntersectionsParallel().size();
+	};
+}
+
+TEST_CASE("quadtree rebuild against relocation at 100k values", "[.][benchmark]")
+{
+	auto bodies = makeBodies(100000, 4096.f, 4.f);
+
+	BENCHMARK("add one by one")
+	{
+		BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+		fill(tree, bodies);
+		return tree.mBox.width;
+	};
+	BENCHMARK("build")
+	{
+		BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+		tree.build(bodies);
+		return tree.mBox.width;
+	};
+
+	BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+	tree.build(bodies);
+	BENCHMARK("rebuild")
+	{
+		tree.build(bodies);
+		return tree.mBox.width;
+	};
+
+	for (const auto percent : { 1, 10, 50, 100 })
+	{
+		// Moved bodies go back and forth so that every run relocates the same amount
+		auto forward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+		auto backward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+		for (auto i = std::size_t(0); i < bodies.size(); i += 100 / static_cast<std::size_t>(percent))
+		{
+			auto moved = bodies[i];
+			moved.box.left = std::fmod(moved.box.left + 37.f, 4090.f);
+			moved.box.top = std::fmod(moved.box.top + 3.f, 4090.f);
+			forward.emplace_back(moved, bodies[i].box);
+			backward.emplace_back(bodies[i], moved.box);
+		}
+		auto back = false;
+		BENCHMARK("relocate " + std::to_string(percent) + "%")
+		{
+			tree.relocate(back ? backward : forward);
+			back = !back;
+			return tree.mBox.width;
+		};
+		if (back)
+		{
+			tree.relocate(backward);
+		}
+	}
+}
+
+TEST_CASE("broadphases for small moves at 20k values", "[.][benchmark]")
+{
+	auto bodies = makeBodies(20000, 4096.f, 4.f);
+	// Every body moves by a fraction of its size, back and forth
+	auto forward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	auto backward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (const auto& body : bodies)
+	{
+		auto moved = body;
+		moved.box.top += 0.5f;
+		forward.emplace_back(moved, body.box);
+		backward.emplace_back(body, moved.box);
+	}
+
+	BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+	tree.build(bodies);
+	auto back = false;
+	BENCHMARK("quadtree relocate and findAllIntersections")
+	{
+		tree.relocate(back ? backward : forward);
+		back = !back;
+		return tree.findAllIntersections().size();
+	};
+
+	sap::SweepAndPrune<Body, decltype(&getBodyBox)> sweep { getBodyBox };
+	sweep.build(bodies);
+	back = false;
+	BENCHMARK("sweep and prune relocate and findAllIntersections")
+	{
+		sweep.relocate(back ? backward : forward);
+		back = !back;
+		return sweep.findAllIntersections().size();
+	};
+
+	bvh::AabbTree<Body, decltype(&getBodyBox)> aabbTree { 1.f, getBodyBox };
+	aabbTree.build(bodies);
+	back = false;
+	BENCHMARK("aabb tree relocate and findAllIntersections")
+	{
+		aabbTree.relocate(back ? backward : forward);
+		back = !back;
+		return aabbTree.findAllIntersections().size();
+	};
+}
+
+TEST_CASE("quadtree batched queries at 100k values", "[.][benchmark]")
+{
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	const auto windows = makeWindows(20000);
+
+	BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+	tree.build(bodies);
+
+	BENCHMARK("access one by one")
+	{
+		auto found = std::size_t(0);
+		for (const auto& window : windows)
+		{
+			found += tree.access(window).size();
+		}
+		return found;
+	};
+	auto results = quadtree::BatchResults<Body*>();
+	BENCHMARK("accessBatch")
+	{
+		tree.accessBatch(windows, results);
+		return results.values.size();
+	};
+}
+
+TEST_CASE("static and dynamic layers at 100k values with 20k moving", "[.][benchmark]")
+{
+	struct IsStatic
+	{
+		bool operator()(const Body& body) const
+		{
+			return body.id % 5 != 0;
+		}
+	};
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	auto forward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	auto backward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (const auto& body : bodies)
+	{
+		if (IsStatic()(body))
+			continue;
+		auto moved = body;
+		moved.box.top += 0.5f;
+		forward.emplace_back(moved, body.box);
+		backward.emplace_back(body, moved.box);
+	}
+
+	BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+	tree.build(bodies);
+	auto back = false;
+	BENCHMARK("single tree relocate and findAllIntersections")
+	{
+		tree.relocate(back ? backward : forward);
+		back = !back;
+		return tree.findAllIntersections().size();
+	};
+
+	layered::LayeredIndex<Body, IsStatic, BodyTree<quadtree::FlatStorage>> layers { BENCH_WORLD, getBodyBox };
+	layers.build(bodies);
+	back = false;
+	BENCHMARK("layers relocate and findAllIntersections")
+	{
+		layers.relocate(back ? backward : forward);
+		back = !back;
+		return layers.findAllIntersections().size();
+	};
+}
+
+TEST_CASE("quadtree layers at 100k values in 4 materials", "[.][benchmark]")
+{
+	// Each material only collides with itself, one of them being rare
+	struct BodyLayer
+	{
+		quadtree::Layer operator()(const Body& body) const
+		{
+			const auto category = body.id % 64 == 0 ? quadtree::Categories(8) : quadtree::Categories(1) << (body.id % 3);
+			return quadtree::Layer { category, category };
+		}
+	};
+	using FilteredTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, quadtree::FlatStorage, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::TightBounds, quadtree::CategoryFilter<BodyLayer>>;
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	const auto windows = makeWindows(1000);
+
+	BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+	tree.build(bodies);
+	FilteredTree filtered { BENCH_WORLD, getBodyBox };
+	filtered.build(bodies);
+
+	BENCHMARK("findAllIntersections then filter")
+	{
+		auto pairs = tree.findAllIntersections();
+		return std::count_if(pairs.begin(), pairs.end(), [](const auto& pair) { return BodyLayer()(pair.first).collides(BodyLayer()(pair.second)); });
+	};
+	BENCHMARK("findAllIntersections filtered")
+	{
+		return filtered.findAllIntersections().size();
+	};
+	BENCHMARK("access rare material then filter")
+	{
+		auto found = std::size_t(0);
+		for (const auto& window : windows)
+		{
+			tree.forEach(window, [&found](const Body& body) { found += body.id % 64 == 0; });
+		}
+		return found;
+	};
+	BENCHMARK("access rare material filtered")
+	{
+		auto found = std::size_t(0);
+		for (const auto& window : windows)
+		{
+			found += filtered.count(window, quadtree::Layer { 8, 8 });
+		}
+		return found;
+	};
+}
+
+TEST_CASE("quadtree insertion from 8 threads at 100k values", "[.][benchmark]")
+{
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	// Each thread adds every 8th body
+	const auto produce = [&bodies](auto&& insert) {
+		auto threads = std::vector<std::thread>();
+		for (auto t = std::size_t(0); t < 8; ++t)
+		{
+			threads.emplace_back([&bodies, &insert, t]() {
+				for (auto i = t; i < bodies.size(); i += 8)
+					insert(bodies[i]);
+			});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	};
+
+	BENCHMARK("add behind a global mutex")
+	{
+		BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+		auto mutex = std::mutex();
+		produce([&tree, &mutex](const Body& body) {
+			auto lock = std::lock_guard(mutex);
+			tree.add(body);
+		});
+		return tree.size();
+	};
+	BENCHMARK("concurrent inserter into an empty tree")
+	{
+		BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+		auto inserter = quadtree::ConcurrentInserter<Body, BodyTree<quadtree::FlatStorage>>(tree);
+		produce([&inserter](const Body& body) { inserter.insert(body); });
+		inserter.flush();
+		return tree.size();
+	};
+	BENCHMARK("concurrent inserter into a filled tree")
+	{
+		BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+		tree.add(Body { -1, { 0.f, 0.f, 1.f, 1.f } });
+		auto inserter = quadtree::ConcurrentInserter<Body, BodyTree<quadtree::FlatStorage>>(tree);
+		produce([&inserter](const Body& body) { inserter.insert(body); });
+		inserter.flush();
+		return tree.size();
+	};
+}
+
+TEST_CASE("quadtree snapshot published per step at 100k values", "[.][benchmark]")
+{
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	BodyTree<quadtree::PointerStorage> tree { BENCH_WORLD, getBodyBox };
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	quadtree::Snapshots<BodyTree<quadtree::FlatStorage>> snapshots;
+
+	BENCHMARK("bulk load a flat copy and publish it")
+	{
+		BodyTree<quadtree::FlatStorage> snapshot { BENCH_WORLD, getBodyBox };
+		snapshot.build(tree.query(tree.getBox()));
+		return snapshots.publish(std::move(snapshot));
+	};
+	BENCHMARK("read the snapshot and query a window")
+	{
+		return snapshots.read()->count({ 1000.f, 1000.f, 200.f, 200.f });
+	};
+	BENCHMARK("query the same window in the tree")
+	{
+		return tree.count({ 1000.f, 1000.f, 200.f, 200.f });
+	};
+}
+
+TEST_CASE("quadtree aggregate summaries at 100k values", "[.][benchmark]")
+{
+	using CountingTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, quadtree::FlatStorage, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::TightBounds, quadtree::NoFilter, quadtree::CountAggregate>;
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	BodyTree<quadtree::FlatStorage> tree { BENCH_WORLD, getBodyBox };
+	CountingTree countingTree { BENCH_WORLD, getBodyBox };
+	tree.build(bodies);
+	countingTree.build(bodies);
+
+	// 10% of the bodies go back and forth so that every run relocates the same amount
+	auto forward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	auto backward = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (auto i = std::size_t(0); i < bodies.size(); i += 10)
+	{
+		auto moved = bodies[i];
+		moved.box.left = std::fmod(moved.box.left + 37.f, 4090.f);
+		forward.emplace_back(moved, bodies[i].box);
+		backward.emplace_back(bodies[i], moved.box);
+	}
+	auto back = false;
+	BENCHMARK("relocate 10% without summaries")
+	{
+		tree.relocate(back ? backward : forward);
+		back = !back;
+		return tree.size();
+	};
+	auto countingBack = false;
+	BENCHMARK("relocate 10% with counts")
+	{
+		countingTree.relocate(countingBack ? backward : forward);
+		countingBack = !countingBack;
+		return countingTree.size();
+	};
+
+	const auto windows = std::vector<quadtree::Box<float>> { { 100.f, 100.f, 64.f, 64.f }, { 500.f, 300.f, 1024.f, 1024.f }, { 0.f, 0.f, 4096.f, 2048.f } };
+	BENCHMARK("count windows by visiting")
+	{
+		auto n = std::size_t(0);
+		for (const auto& window : windows)
+			n += tree.count(window);
+		return n;
+	};
+	BENCHMARK("count windows from the summaries")
+	{
+		auto n = std::size_t(0);
+		for (const auto& window : windows)
+			n += countingTree.summarize(window);
+		return n;
+	};
+}
+
+TEST_CASE("quadtree iteration of a window at 100k values", "[.][benchmark]")
+{
+	const auto bodies = makeBodies(100000, 4096.f, 4.f);
+	BodyTree<quadtree::PointerStorage> tree { BENCH_WORLD, getBodyBox };
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	const auto window = quadtree::Box<float> { 500.f, 300.f, 1920.f, 1080.f };
+
+	BENCHMARK("collect pointers with access")
+	{
+		auto sum = 0ll;
+		for (auto* body : tree.access(window))
+			sum += body->id;
+		return sum;
+	};
+	BENCHMARK("walk the lazy view")
+	{
+		auto sum = 0ll;
+		for (const auto& body : tree.view(window))
+			sum += body.id;
+		return sum;
+	};
+	BENCHMARK("stop at the first match of a filtered view")
+	{
+		auto odd = tree.view(window) | std::views::filter([](const Body& body) { return body.id % 2 == 1; });
+		return (*std::ranges::begin(odd)).id;
+	};
+}
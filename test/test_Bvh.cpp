@@ -0,0 +1,182 @@
+#include <catch2/catch.hpp>
+
+#include "Bodies.hpp"
+#include "bvh/bvh.h"
+#include <cmath>
+
+namespace
+{
+using BodyBvh = bvh::AabbTree<Body, decltype(&getBodyBox)>;
+
+// Parents contain their children, leaves contain the box of their value and no child is more
+// than one level taller than its sibling
+void checkNode(const BodyBvh& tree, BodyBvh::NodeId id)
+{
+	const auto& node = tree.mNodes[id];
+	if (node.left == BodyBvh::Null)
+	{
+		REQUIRE(node.height == 0);
+		REQUIRE(tree.mLeaves[node.value] == id);
+		REQUIRE(node.box.contains(tree.mBoxes[node.value]));
+		return;
+	}
+	const auto& left = tree.mNodes[node.left];
+	const auto& right = tree.mNodes[node.right];
+	REQUIRE(left.parent == id);
+	REQUIRE(right.parent == id);
+	REQUIRE(node.box.contains(left.box));
+	REQUIRE(node.box.contains(right.box));
+	REQUIRE(node.height == 1 + std::max(left.height, right.height));
+	REQUIRE(std::abs(left.height - right.height) <= 1);
+	checkNode(tree, node.left);
+	checkNode(tree, node.right);
+}
+}
+
+TEST_CASE("bvh::AabbTree matches the quadtree", "[bvh]")
+{
+	BodyBvh bvh { 1.f, getBodyBox };
+	BodyTree<> tree { { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox };
+	auto bodies = makeBodies(3000);
+	// Mixed sizes, an empty box and a non finite one
+	bodies.push_back(Body { 3000, { 100.f, 100.f, 300.f, 300.f } });
+	bodies.push_back(Body { 3001, { -12.f, -12.f, 2.f, 2.f } });
+	bodies.push_back(Body { 3002, { 50.f, 50.f, 0.f, 10.f } });
+	bodies.push_back(Body { 3003, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	bvh.build(bodies);
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	REQUIRE(bvh.mLoose.size() == 1);
+	checkNode(bvh, bvh.mRoot);
+
+	for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { 0.f, 0.f, 1e30f, 1e30f }, quadtree::Box<float> { 55.f, 55.f, 1.f, 1.f }, quadtree::Box<float> { -20.f, -20.f, 15.f, 15.f } })
+	{
+		REQUIRE(sortedIds(bvh.query(window)) == sortedIds(tree.query(window)));
+		REQUIRE(bvh.count(window) == tree.count(window));
+	}
+	const auto pairs = normalized(tree.findAllIntersections());
+	REQUIRE(normalized(bvh.findAllIntersections()) == pairs);
+	REQUIRE(normalized(bvh.findAllIntersectionsParallel(4)) == pairs);
+
+	// Small moves stay in the fat boxes, large ones reinsert the leaves
+	for (const auto distance : { 0.5f, 40.f })
+	{
+		const auto nodes = bvh.mNodes;
+		auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+		for (auto* body : bvh.access(tree.getBox()))
+		{
+			if (body->id % 3 == 0 && body->id < 3000)
+			{
+				const auto old_box = body->box;
+				body->box.left = std::fmod(body->box.left + distance, 990.f);
+				moved.emplace_back(*body, old_box);
+				tree.update(*body, old_box);
+			}
+		}
+		bvh.relocate(moved);
+		if (distance < 1.f)
+		{
+			REQUIRE(std::equal(nodes.begin(), nodes.end(), bvh.mNodes.begin(), bvh.mNodes.end(), [](const auto& lhs, const auto& rhs) { return lhs.parent == rhs.parent && lhs.box.contains(rhs.box) && rhs.box.contains(lhs.box); }));
+		}
+		checkNode(bvh, bvh.mRoot);
+		REQUIRE(normalized(bvh.findAllIntersections()) == normalized(tree.findAllIntersections()));
+	}
+
+	// Removing every other value keeps the tree consistent
+	for (const auto& body : tree.query(tree.getBox()))
+	{
+		if (body.id % 2 == 0)
+		{
+			bvh.remove(body);
+			tree.remove(body);
+		}
+	}
+	checkNode(bvh, bvh.mRoot);
+	REQUIRE(bvh.count(bvh.getBox()) == tree.count(tree.getBox()));
+	REQUIRE(bvh.size() == tree.size());
+	REQUIRE(normalized(bvh.findAllIntersections()) == normalized(tree.findAllIntersections()));
+	REQUIRE(!bvh.any({ 2000.f, 2000.f, 10.f, 10.f }));
+
+	bvh.clear();
+	REQUIRE(bvh.size() == 0);
+	REQUIRE(bvh.query(tree.getBox()).empty());
+	bvh.add(bodies[0]);
+	checkNode(bvh, bvh.mRoot);
+	REQUIRE(bvh.count(bvh.getBox()) == 1);
+}
+
+TEST_CASE("bvh::AabbTree keeps moved values in their fat boxes", "[bvh]")
+{
+	BodyBvh bvh { 5.f, getBodyBox };
+	bvh.add(Body { 0, { 0.f, 0.f, 10.f, 10.f } });
+	bvh.add(Body { 1, { 100.f, 0.f, 10.f, 10.f } });
+	const auto leaf = bvh.mLeaves[0];
+	const auto fatBox = bvh.mNodes[leaf].box;
+	REQUIRE(fatBox.left == -5.f);
+	REQUIRE(fatBox.getRight() == 15.f);
+	// The fat box is only used to prune, queries see the tight box
+	REQUIRE(bvh.count({ 12.f, 0.f, 2.f, 2.f }) == 0);
+
+	// A move within the margin keeps the leaf as it is
+	bvh.update(Body { 0, { 3.f, 0.f, 10.f, 10.f } }, { 0.f, 0.f, 10.f, 10.f });
+	REQUIRE(bvh.mLeaves[0] == leaf);
+	REQUIRE(bvh.mNodes[leaf].box.left == fatBox.left);
+	REQUIRE(bvh.mNodes[leaf].box.getRight() == fatBox.getRight());
+	REQUIRE(bvh.count({ 0.f, 0.f, 2.f, 2.f }) == 0);
+	REQUIRE(bvh.count({ 12.f, 0.f, 2.f, 2.f }) == 1);
+
+	// Leaving it extends the new fat box along the displacement
+	bvh.update(Body { 0, { 23.f, 0.f, 10.f, 10.f } }, { 3.f, 0.f, 10.f, 10.f });
+	REQUIRE(bvh.mNodes[bvh.mLeaves[0]].box.left == 18.f);
+	REQUIRE(bvh.mNodes[bvh.mLeaves[0]].box.getRight() == 33.f + 5.f + 4 * 20.f);
+	REQUIRE(bvh.mNodes[bvh.mLeaves[0]].box.top == -5.f);
+	checkNode(bvh, bvh.mRoot);
+	REQUIRE(sortedIds(bvh.query({ 20.f, 0.f, 100.f, 10.f })) == std::vector<int> { 0, 1 });
+
+	// Non finite boxes leave the tree and come back
+	bvh.update(Body { 0, { 23.f, 0.f, std::numeric_limits<float>::infinity(), 10.f } }, { 23.f, 0.f, 10.f, 10.f });
+	REQUIRE(bvh.mLeaves[0] == BodyBvh::Null);
+	REQUIRE(bvh.mLoose.size() == 1);
+	REQUIRE(normalized(bvh.findAllIntersections()) == std::vector<std::pair<int, int>> { { 0, 1 } });
+	bvh.update(Body { 0, { 23.f, 0.f, 10.f, 10.f } }, { 23.f, 0.f, std::numeric_limits<float>::infinity(), 10.f });
+	REQUIRE(bvh.mLoose.empty());
+	checkNode(bvh, bvh.mRoot);
+	REQUIRE(bvh.findAllIntersections().empty());
+}
+
+TEST_CASE("bvh::AabbTree visits trees deeper than its inline stack", "[bvh]")
+{
+	// A chain of nodes, each with a leaf on its left, which the rotations never leave
+	BodyBvh bvh { 0.f, getBodyBox };
+	const auto count = 100u;
+	for (auto i = 0u; i < count; ++i)
+	{
+		bvh.mValues.push_back(Body { static_cast<int>(i), { static_cast<float>(i), 0.f, 1.5f, 1.f } });
+		bvh.mBoxes.push_back(bvh.mValues.back().box);
+		bvh.mLeaves.push_back(i);
+		bvh.mNodes.emplace_back();
+		bvh.mNodes.back().box = bvh.mBoxes.back();
+		bvh.mNodes.back().value = i;
+	}
+	auto next = count - 1;
+	for (auto i = count - 1; i-- > 0;)
+	{
+		auto node = BodyBvh::Node();
+		node.left = i;
+		node.right = next;
+		node.box = BodyBvh::merge(bvh.mNodes[i].box, bvh.mNodes[next].box);
+		node.height = bvh.mNodes[next].height + 1;
+		next = static_cast<BodyBvh::NodeId>(bvh.mNodes.size());
+		bvh.mNodes[node.left].parent = next;
+		bvh.mNodes[node.right].parent = next;
+		bvh.mNodes.push_back(node);
+	}
+	bvh.mRoot = next;
+	REQUIRE(bvh.mNodes[bvh.mRoot].height == 99);
+
+	REQUIRE(bvh.count(bvh.getBox()) == count);
+	REQUIRE(sortedIds(bvh.query({ 99.2f, 0.f, 0.1f, 1.f })) == std::vector<int> { 98, 99 });
+	REQUIRE(bvh.findAllIntersections().size() == count - 1);
+}
@@ -0,0 +1,78 @@
+#include <catch2/catch.hpp>
+
+#include "element.h"
+
+namespace
+{
+Element makeElement(float x, float y, float vy)
+{
+	Element element {};
+	element.setPosition(sf::Vector2f(x, y));
+	element.shape.setScale(sf::Vector2f(10, 10));
+	element.velocity = sf::Vector2f(0, vy);
+	return element;
+}
+}
+
+TEMPLATE_TEST_CASE("ElementTree keeps elements moving into each other apart", "[element]", ElementTree, ElementGrid, ElementSweep, ElementBvh)
+{
+	auto elements = [] {
+		if constexpr (std::is_same_v<TestType, ElementGrid>)
+			return TestType { GRID_CELL_SIZE };
+		else if constexpr (std::is_same_v<TestType, ElementSweep>)
+			return TestType {};
+		else if constexpr (std::is_same_v<TestType, ElementBvh>)
+			return TestType { AABB_MARGIN };
+		else
+			return TestType { INITIAL_SIZE };
+	}();
+	// Both would end up at 15 after one step, the first one to move stops the other
+	const auto upperId = elements.emplace(makeElement(0.f, 0.f, 1500.f)).id;
+	const auto lowerId = elements.emplace(makeElement(0.f, 30.f, -1500.f)).id;
+	elements.update(0.01);
+
+	auto bounds = std::vector<sf::FloatRect>();
+	for (const auto& element : elements.query(EVERYTHING))
+	{
+		if (element.id == upperId || element.id == lowerId)
+			bounds.push_back(element.shape.getGlobalBounds());
+	}
+	REQUIRE(bounds.size() == 2);
+	REQUIRE(!bounds[0].intersects(bounds[1]));
+	// One of them moved all the way
+	REQUIRE((bounds[0].top == Approx(15.f).margin(0.01) || bounds[1].top == Approx(15.f).margin(0.01)));
+}
+
+TEST_CASE("ElementTree adds the fixed elements placed between two updates at once", "[element]")
+{
+	ElementTree elements { INITIAL_SIZE };
+	auto wall = makeElement(0.f, 50.f, 0.f);
+	wall.fixed = true;
+	for (auto i = 0; i < 20; ++i)
+	{
+		wall.setPosition(sf::Vector2f(10.f * static_cast<float>(i), 50.f));
+		elements.emplace(wall);
+	}
+	elements.emplace(makeElement(45.f, 20.f, 0.f));
+	REQUIRE(elements.size() == 21);
+	REQUIRE(elements.getStatic().size() == 0);
+	REQUIRE(elements.getDynamic().size() == 1);
+
+	// The falling element lands on the walls added by the update
+	for (auto i = 0; i < 50; ++i)
+		elements.update(0.01);
+	REQUIRE(elements.getStatic().size() == 20);
+	REQUIRE(elements.size() == 21);
+	const auto stats = elements.getStats();
+	REQUIRE(stats.values == 21);
+	REQUIRE(stats.queries > 0);
+	elements.resetStats();
+	REQUIRE(elements.count({ 0.f, 50.f, 200.f, 10.f }) == 20);
+	REQUIRE(elements.getStatic().getStats().queries == 1);
+	for (const auto& element : elements.query({ 0.f, 0.f, 200.f, 50.f }))
+		REQUIRE(element.shape.getGlobalBounds().top + 10.f <= 50.f);
+
+	elements.emplace(wall);
+	elements.clear();
+	REQUIRE(elements.size() == 0);
+}
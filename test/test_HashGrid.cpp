@@ -0,0 +1,111 @@
+#include <catch2/catch.hpp>
+
+#include "Bodies.hpp"
+#include "hashgrid/hashgrid.h"
+
+namespace
+{
+using BodyGrid = hashgrid::HashGrid<Body, decltype(&getBodyBox)>;
+}
+
+TEST_CASE("hashgrid::HashGrid matches the quadtree", "[hashgrid]")
+{
+	BodyGrid grid { 16.f, getBodyBox };
+	BodyTree<> tree { { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox };
+	auto bodies = makeBodies(3000);
+	// A value covering many cells and one added after the last rebuild are both loose
+	bodies.push_back(Body { 3000, { 100.f, 100.f, 300.f, 300.f } });
+	bodies.push_back(Body { 3001, { -12.f, -12.f, 8.f, 8.f } });
+	bodies.push_back(Body { 3002, { -8.f, -8.f, 10.f, 10.f } });
+	grid.build(bodies);
+	bodies.push_back(Body { 3003, { 50.f, 50.f, 10.f, 10.f } });
+	grid.add(bodies.back());
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	REQUIRE(grid.mLoose.size() == 2);
+
+	for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { 0.f, 0.f, 1e30f, 1e30f }, quadtree::Box<float> { 55.f, 55.f, 1.f, 1.f }, quadtree::Box<float> { -20.f, -20.f, 15.f, 15.f } })
+	{
+		REQUIRE(sortedIds(grid.query(window)) == sortedIds(tree.query(window)));
+		REQUIRE(grid.count(window) == tree.count(window));
+	}
+	const auto pairs = normalized(tree.findAllIntersections());
+	REQUIRE(normalized(grid.findAllIntersections()) == pairs);
+	REQUIRE(normalized(grid.findAllIntersectionsParallel(4)) == pairs);
+
+	// Move bodies in place and relocate them like ElementTree::update
+	auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (auto* body : grid.access(grid.getBox()))
+	{
+		if (body->id % 3 == 0)
+		{
+			const auto old_box = body->box;
+			body->box.left = std::fmod(body->box.left + 37.f, 990.f);
+			moved.emplace_back(*body, old_box);
+			tree.update(*body, old_box);
+		}
+	}
+	grid.relocate(moved);
+	REQUIRE(grid.mLoose.size() == 1);
+	REQUIRE(normalized(grid.findAllIntersections()) == normalized(tree.findAllIntersections()));
+
+	// Removing every other value keeps the cells consistent
+	for (const auto& body : tree.query(tree.getBox()))
+	{
+		if (body.id % 2 == 0)
+		{
+			grid.remove(body);
+			tree.remove(body);
+		}
+	}
+	REQUIRE(grid.count(grid.getBox()) == tree.count(tree.getBox()));
+	REQUIRE(grid.size() == tree.size());
+	REQUIRE(normalized(grid.findAllIntersections()) == normalized(tree.findAllIntersections()));
+	REQUIRE(!grid.any({ 2000.f, 2000.f, 10.f, 10.f }));
+
+	grid.clear();
+	REQUIRE(grid.size() == 0);
+	REQUIRE(grid.query(tree.getBox()).empty());
+	REQUIRE(grid.findAllIntersections().empty());
+}
+
+TEST_CASE("hashgrid::HashGrid reports values sharing several cells once", "[hashgrid]")
+{
+	BodyGrid grid { 10.f, getBodyBox };
+	// Across the corner of four cells, on both sides of 0, touching a cell edge, empty and far
+	// enough for the cells to be clamped
+	grid.build(std::vector<Body> {
+		Body { 0, { 5.f, 5.f, 10.f, 10.f } },
+		Body { 1, { 8.f, 8.f, 10.f, 10.f } },
+		Body { 2, { -15.f, -15.f, 10.f, 10.f } },
+		Body { 3, { -6.f, -6.f, 8.f, 8.f } },
+		Body { 4, { 18.f, 10.f, 2.f, 2.f } },
+		Body { 5, { 50.f, 50.f, 0.f, 0.f } },
+		Body { 6, { 1e12f, 1e12f, 1e6f, 1e6f } },
+		Body { 7, { 2e12f, 2e12f, 1e6f, 1e6f } } });
+	REQUIRE(grid.mLoose.empty());
+	const auto pairs = std::vector<std::pair<int, int>> { { 0, 1 }, { 2, 3 } };
+	REQUIRE(normalized(grid.findAllIntersections()) == pairs);
+	REQUIRE(normalized(grid.findAllIntersectionsParallel(4)) == pairs);
+	REQUIRE(sortedIds(grid.query({ 9.f, 9.f, 2.f, 2.f })) == std::vector<int> { 0, 1 });
+	REQUIRE(sortedIds(grid.query({ -10.f, -10.f, 30.f, 30.f })) == std::vector<int> { 0, 1, 2, 3, 4 });
+	REQUIRE(grid.count({ 20.f, 0.f, 10.f, 20.f }) == 0);
+	REQUIRE(sortedIds(grid.query({ 1e12f, 1e12f, 1e6f, 1e6f })) == std::vector<int> { 6 });
+
+	// The empty value is found without its box
+	grid.remove(Body { 5, { 50.f, 50.f, 0.f, 0.f } });
+	grid.remove(Body { 6, { 1e12f, 1e12f, 1e6f, 1e6f } });
+	REQUIRE(grid.size() == 6);
+	REQUIRE(grid.query({ 1e12f, 1e12f, 1e6f, 1e6f }).empty());
+	REQUIRE(normalized(grid.findAllIntersections()) == pairs);
+
+	// Added values are loose until there are enough of them to rebuild the cells
+	for (const auto& body : makeBodies(100, 200.f))
+	{
+		grid.add(Body { body.id + 10, body.box });
+	}
+	REQUIRE(grid.mLoose.size() < 100);
+	REQUIRE(grid.count({ 0.f, 0.f, 200.f, 200.f }) == 104);
+}
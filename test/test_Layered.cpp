@@ -0,0 +1,264 @@
+#include <catch2/catch.hpp>
+
+#include "Bodies.hpp"
+#include "hashgrid/hashgrid.h"
+#include "layered/layered.h"
+
+namespace
+{
+// Bodies with a negative id never move
+struct IsWall
+{
+	bool operator()(const Body& body) const
+	{
+		return body.id < 0;
+	}
+};
+
+using BodyLayers = layered::LayeredIndex<Body, IsWall, BodyTree<quadtree::FlatStorage>, BodyTree<quadtree::PointerStorage, quadtree::CountStats>>;
+
+// Pairs of the single tree without the ones between two walls
+std::vector<std::pair<int, int>> withoutWallPairs(std::vector<std::pair<int, int>> pairs)
+{
+	std::erase_if(pairs, [](const auto& pair) { return pair.first < 0 && pair.second < 0; });
+	return pairs;
+}
+
+// Bodies of makeBodies, every fourth one turned into a wall
+std::vector<Body> makeLayeredBodies(int count)
+{
+	auto bodies = makeBodies(count);
+	for (auto& body : bodies)
+	{
+		if (body.id % 4 == 0)
+			body.id = -body.id - 1;
+	}
+	return bodies;
+}
+}
+
+TEST_CASE("layered::LayeredIndex matches a single quadtree without the static pairs", "[layered]")
+{
+	const auto world = quadtree::Box<float> { 0.f, 0.f, 1024.f, 1024.f };
+	BodyLayers layers { world, getBodyBox };
+	BodyTree<> tree { world, getBodyBox };
+	auto bodies = makeLayeredBodies(3000);
+	// A large wall, and a dynamic body with a non finite box
+	bodies.push_back(Body { -5000, { 100.f, 100.f, 300.f, 300.f } });
+	bodies.push_back(Body { 3001, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	for (const auto& body : bodies)
+	{
+		layers.add(body);
+		tree.add(body);
+	}
+	REQUIRE(layers.size() == tree.size());
+	REQUIRE(layers.getStatic().size() == 751);
+	REQUIRE(layers.getDynamic().size() == layers.size() - 751);
+
+	for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { 0.f, 0.f, 1e30f, 1e30f }, quadtree::Box<float> { 55.f, 55.f, 1.f, 1.f }, quadtree::Box<float> { -20.f, -20.f, 15.f, 15.f } })
+	{
+		REQUIRE(sortedIds(layers.query(window)) == sortedIds(tree.query(window)));
+		REQUIRE(layers.count(window) == tree.count(window));
+		REQUIRE(layers.access(window).size() == tree.count(window));
+		REQUIRE(layers.any(window) == tree.any(window));
+		auto viewed = std::vector<Body>();
+		for (const auto& body : layers.view(window))
+			viewed.push_back(body);
+		REQUIRE(sortedIds(viewed) == sortedIds(tree.query(window)));
+	}
+	REQUIRE(static_cast<std::size_t>(std::ranges::distance(std::as_const(layers).all())) == layers.size());
+	const auto pairs = withoutWallPairs(normalized(tree.findAllIntersections()));
+	REQUIRE(normalized(layers.findAllIntersections()) == pairs);
+	REQUIRE(normalized(layers.findAllIntersectionsParallel(4)) == pairs);
+
+	// Dynamic bodies move by handle, walls stay where they are
+	auto moved = std::vector<quadtree::Handle>();
+	for (auto handle : layers.handles(layers.getBox()))
+	{
+		auto& body = layers.get(handle);
+		if (body.id % 3 == 0 && body.id < 3000)
+		{
+			const auto old_box = body.box;
+			body.box.left = std::fmod(body.box.left + 40.f, 990.f);
+			tree.update(body, old_box);
+			moved.push_back(handle);
+		}
+	}
+	layers.relocate(moved);
+	REQUIRE(normalized(layers.findAllIntersections()) == withoutWallPairs(normalized(tree.findAllIntersections())));
+
+	// The first hit of a segment is looked for in both layers
+	const auto hit = layers.segmentCast({ -10.f, 250.f }, { 1100.f, 250.f });
+	const auto expected = tree.segmentCast({ -10.f, 250.f }, { 1100.f, 250.f });
+	REQUIRE(hit.has_value() == expected.has_value());
+	if (hit)
+		REQUIRE(hit->second == expected->second);
+
+	// The nearest values of both layers are merged, ties may be broken in another order
+	const auto point = quadtree::Vector2<float>(503.f, 497.f);
+	const auto distance = [&point](const Body& body) {
+		const auto dx = std::max({ body.box.left - point.x, 0.f, point.x - body.box.getRight() });
+		const auto dy = std::max({ body.box.top - point.y, 0.f, point.y - body.box.getBottom() });
+		return dx * dx + dy * dy;
+	};
+	auto distances = std::vector<float>();
+	layers.forEachNearest(point, 12, [&distances, &distance](const Body& body) { distances.push_back(distance(body)); });
+	auto expectedDistances = std::vector<float>();
+	for (const auto& body : tree.findNearest(point, 12))
+	{
+		expectedDistances.push_back(distance(body));
+	}
+	REQUIRE(distances == expectedDistances);
+
+	const auto stats = layers.getStats();
+	REQUIRE(stats.values == layers.size());
+	REQUIRE(stats.nodes == layers.getStatic().getStats().nodes + layers.getDynamic().getStats().nodes);
+
+	for (const auto& body : tree.query(tree.getBox()))
+	{
+		if (body.id % 2 == 0)
+		{
+			layers.remove(body);
+			tree.remove(body);
+		}
+	}
+	REQUIRE(layers.size() == tree.size());
+	REQUIRE(normalized(layers.findAllIntersections()) == withoutWallPairs(normalized(tree.findAllIntersections())));
+
+	layers.clear();
+	REQUIRE(layers.size() == 0);
+	REQUIRE(layers.findAllIntersections().empty());
+}
+
+TEST_CASE("layered::LayeredIndex builds both layers and mixes index types", "[layered]")
+{
+	using GridLayers = layered::LayeredIndex<Body, IsWall, BodyTree<quadtree::FlatStorage>, hashgrid::HashGrid<Body, decltype(&getBodyBox)>>;
+	BodyLayers layers { quadtree::Box<float> { 0.f, 0.f, 16.f, 16.f }, getBodyBox };
+	BodyTree<> tree { quadtree::Box<float> { 0.f, 0.f, 16.f, 16.f }, getBodyBox };
+	const auto bodies = makeLayeredBodies(2000);
+	layers.build(bodies);
+	tree.build(bodies);
+	REQUIRE(layers.size() == bodies.size());
+	REQUIRE(layers.getStatic().size() == 500);
+	const auto pairs = withoutWallPairs(normalized(tree.findAllIntersections()));
+	REQUIRE(normalized(layers.findAllIntersectionsParallel(4)) == pairs);
+
+	// Indexes taking different parameters are constructed beforehand
+	GridLayers grid { BodyTree<quadtree::FlatStorage>(quadtree::Box<float> { 0.f, 0.f, 16.f, 16.f }, getBodyBox), hashgrid::HashGrid<Body, decltype(&getBodyBox)>(16.f, getBodyBox) };
+	grid.build(bodies);
+	REQUIRE(normalized(grid.findAllIntersections()) == pairs);
+	REQUIRE(sortedIds(grid.query({ 200.f, 200.f, 100.f, 100.f })) == sortedIds(tree.query({ 200.f, 200.f, 100.f, 100.f })));
+}
+
+TEST_CASE("layered::LayeredIndex filters the pairs of both layers by layer", "[layered]")
+{
+	// Walls only collide with half of the bodies they may overlap
+	struct BodyLayer
+	{
+		quadtree::Layer operator()(const Body& body) const
+		{
+			if (body.id < 0)
+				return quadtree::Layer { 1, 2 };
+			return quadtree::Layer { body.id % 8 == 2 ? quadtree::Categories(2) : quadtree::Categories(4), quadtree::AllCategories };
+		}
+	};
+	using FilteredTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, quadtree::FlatStorage, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::TightBounds, quadtree::CategoryFilter<BodyLayer>>;
+	using FilteredLayers = layered::LayeredIndex<Body, IsWall, FilteredTree>;
+	FilteredLayers layers { quadtree::Box<float> { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox };
+	BodyTree<> tree { quadtree::Box<float> { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox };
+	const auto bodies = makeLayeredBodies(3000);
+	for (const auto& body : bodies)
+	{
+		layers.add(body);
+		tree.add(body);
+	}
+	auto expected = std::vector<std::pair<Body, Body>>();
+	for (const auto& pair : tree.findAllIntersections())
+	{
+		if (BodyLayer()(pair.first).collides(BodyLayer()(pair.second)))
+			expected.push_back(pair);
+	}
+	const auto pairs = withoutWallPairs(normalized(expected));
+	REQUIRE(pairs.size() < withoutWallPairs(normalized(tree.findAllIntersections())).size());
+	REQUIRE(normalized(layers.findAllIntersections()) == pairs);
+	REQUIRE(normalized(layers.findAllIntersectionsParallel(4)) == pairs);
+
+	const auto window = quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f };
+	const auto wallLayer = quadtree::Layer { 1, 2 };
+	auto inWindow = tree.query(window);
+	std::erase_if(inWindow, [&wallLayer](const Body& body) { return !wallLayer.collides(BodyLayer()(body)); });
+	REQUIRE(layers.count(window, wallLayer) == inWindow.size());
+	REQUIRE(layers.any(window, wallLayer, [](const Body& body) { return body.id % 8 == 2; }) == !inWindow.empty());
+}
+
+TEST_CASE("layered::LayeredIndex batches static values and reads boxes with each accessor", "[layered]")
+{
+	BodyLayers layers { quadtree::Box<float> { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox };
+	BodyTree<> tree { quadtree::Box<float> { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox };
+	const auto bodies = makeLayeredBodies(2000);
+	const auto half = bodies.begin() + 1000;
+	layers.insertAll(std::vector<Body>(bodies.begin(), half));
+	layers.insertAll(std::vector<Body>(half, bodies.end()));
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	// The static index is built again in one pass, as compact as if it was built at once
+	REQUIRE(layers.size() == bodies.size());
+	REQUIRE(layers.getStatic().size() == 500);
+	auto built = BodyTree<quadtree::FlatStorage>(quadtree::Box<float> { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox);
+	built.build(layers.getStatic().query(layers.getStatic().getBox()));
+	REQUIRE(layers.getStatic().getStats().nodes == built.getStats().nodes);
+	REQUIRE(normalized(layers.findAllIntersections()) == withoutWallPairs(normalized(tree.findAllIntersections())));
+
+	// Walls only know their box through the accessor of the static index
+	struct WallBox
+	{
+		quadtree::Box<float> operator()(const Body& body) const
+		{
+			return body.box;
+		}
+	};
+	struct MovingBox
+	{
+		quadtree::Box<float> operator()(const Body& body) const
+		{
+			return body.id < 0 ? quadtree::Box<float> { 1e6f, 1e6f, 1.f, 1.f } : body.box;
+		}
+	};
+	using SplitLayers = layered::LayeredIndex<Body, IsWall, quadtree::Quadtree<Body, WallBox>, quadtree::Quadtree<Body, MovingBox>>;
+	SplitLayers split { quadtree::Box<float> { 0.f, 0.f, 1024.f, 1024.f } };
+	split.build(bodies);
+	const auto point = quadtree::Vector2<float>(503.f, 497.f);
+	auto ids = std::vector<int>();
+	split.forEachNearest(point, 12, [&ids](const Body& body) { ids.push_back(body.id); });
+	auto expected = std::vector<int>();
+	for (const auto& body : tree.findNearest(point, 12))
+	{
+		expected.push_back(body.id);
+	}
+	REQUIRE(ids.size() == expected.size());
+	std::sort(ids.begin(), ids.end());
+	std::sort(expected.begin(), expected.end());
+	REQUIRE(ids == expected);
+}
+
+TEST_CASE("layered::LayeredIndex never pairs two walls", "[layered]")
+{
+	BodyLayers layers { quadtree::Box<float> { 0.f, 0.f, 100.f, 100.f }, getBodyBox };
+	layers.add(Body { -1, { 0.f, 0.f, 20.f, 20.f } });
+	layers.add(Body { -2, { 10.f, 10.f, 20.f, 20.f } });
+	REQUIRE(layers.getStatic().size() == 2);
+	REQUIRE(layers.findAllIntersections().empty());
+
+	// A body overlapping both walls pairs with each of them
+	layers.add(Body { 1, { 15.f, 15.f, 2.f, 2.f } });
+	const auto pairs = std::vector<std::pair<int, int>> { { -2, 1 }, { -1, 1 } };
+	REQUIRE(normalized(layers.findAllIntersections()) == pairs);
+	REQUIRE(normalized(layers.findAllIntersectionsParallel(4)) == pairs);
+	REQUIRE(sortedIds(layers.query({ 15.f, 15.f, 1.f, 1.f })) == std::vector<int> { -2, -1, 1 });
+
+	layers.remove(Body { -1, { 0.f, 0.f, 20.f, 20.f } });
+	REQUIRE(layers.getStatic().size() == 1);
+	REQUIRE(normalized(layers.findAllIntersections()) == std::vector<std::pair<int, int>> { { -2, 1 } });
+}
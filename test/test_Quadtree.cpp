@@ -0,0 +1,1341 @@
+#include <catch2/catch.hpp>
+
+#include "Bodies.hpp"
+#include "quadtree/inserter.h"
+#include "quadtree/snapshot.h"
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <thread>
+#include <utility>
+
+namespace
+{
+const quadtree::Box<float> WORLD { 0.f, 0.f, 1024.f, 1024.f };
+
+// Number of bodies, sum and maximum of their ids
+struct IdAggregate
+{
+	static constexpr auto Enabled = true;
+
+	struct Summary
+	{
+		std::size_t count = 0;
+		long long sum = 0;
+		int max = std::numeric_limits<int>::min();
+
+		friend bool operator==(const Summary&, const Summary&) = default;
+	};
+
+	Summary summarize(const Body& body, const quadtree::Box<float>&) const
+	{
+		return Summary { 1, body.id, body.id };
+	}
+
+	Summary combine(const Summary& lhs, const Summary& rhs) const
+	{
+		return Summary { lhs.count + rhs.count, lhs.sum + rhs.sum, std::max(lhs.max, rhs.max) };
+	}
+};
+
+// Whether the summary of every node is the one of the values of its subtree
+template <typename Tree>
+bool hasExactSummaries(const Tree& tree)
+{
+	const auto check = [&tree](const auto& self, auto node, IdAggregate::Summary& subtree) -> bool {
+		auto summary = IdAggregate::Summary();
+		for (auto index : tree.mNodes.values(node))
+			summary = IdAggregate().combine(summary, IdAggregate().summarize(tree.mSlots[index], {}));
+		if (!tree.isLeaf(node))
+		{
+			for (auto i = std::size_t(0); i < 4; ++i)
+			{
+				auto child = IdAggregate::Summary();
+				if (!self(self, tree.mNodes.child(node, i), child))
+					return false;
+				summary = IdAggregate().combine(summary, child);
+			}
+		}
+		subtree = summary;
+		return summary == tree.mNodes.summary(node);
+	};
+	auto summary = IdAggregate::Summary();
+	return check(check, tree.mNodes.root(), summary);
+}
+
+// Whether the content of every node holds the values of its subtree and stays inside its cell
+template <typename Tree>
+bool boundsValues(const Tree& tree)
+{
+	const auto check = [&tree](const auto& self, auto node, const quadtree::Box<float>& box, bool root) -> std::optional<quadtree::Edges<float>> {
+		auto values = quadtree::NoEdges<float>;
+		for (auto index : tree.mNodes.values(node))
+			values = tree.unite(values, tree.toEdges(tree.mBoxes[index]));
+		if (!tree.isLeaf(node))
+		{
+			for (auto i = std::size_t(0); i < 4; ++i)
+			{
+				auto child = self(self, tree.mNodes.child(node, i), tree.computeBox(box, static_cast<int>(i)), false);
+				if (!child)
+					return std::nullopt;
+				values = tree.unite(values, *child);
+			}
+		}
+		const auto& content = tree.mNodes.content(node);
+		if (!tree.isEmpty(values) && !(content.left <= values.left && content.top <= values.top && values.right <= content.right && values.bottom <= content.bottom))
+			return std::nullopt;
+		if (!root && !tree.isEmpty(content) && !(box.left <= content.left && box.top <= content.top && content.right <= box.getRight() && content.bottom <= box.getBottom()))
+			return std::nullopt;
+		return values;
+	};
+	return check(check, tree.mNodes.root(), tree.getBox(), true).has_value();
+}
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree relocates moved values", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	auto bodies = makeBodies(500);
+	for (auto& body : bodies)
+	{
+		tree.add(body);
+	}
+
+	// Move every body in place like ElementTree::update does
+	auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (auto* body : tree.access(WORLD))
+	{
+		const auto old_box = body->box;
+		body->box.left = static_cast<float>((static_cast<int>(body->box.left) + 517) % 1000);
+		body->box.top = static_cast<float>((static_cast<int>(body->box.top) + 211) % 1000);
+		bodies[static_cast<std::size_t>(body->id)] = *body;
+		moved.emplace_back(*body, old_box);
+	}
+	tree.relocate(moved);
+
+	for (const auto& body : bodies)
+	{
+		auto found = tree.query(body.box);
+		REQUIRE(std::find(found.begin(), found.end(), body) != found.end());
+	}
+
+	// A single update keeps the tree consistent as well
+	auto body = bodies.front();
+	const auto old_box = body.box;
+	body.box.left = 3.f;
+	body.box.top = 3.f;
+	tree.update(body, old_box);
+	bodies.front() = body;
+
+	for (const auto& other : bodies)
+	{
+		tree.remove(other);
+	}
+	REQUIRE(tree.query(WORLD).empty());
+	REQUIRE(tree.isLeaf(tree.mNodes.root()));
+}
+
+TEST_CASE("quadtree::FlatStorage matches the pointer layout", "[quadtree]")
+{
+	BodyTree<quadtree::PointerStorage> pointerTree { WORLD, getBodyBox };
+	BodyTree<quadtree::FlatStorage> flatTree { WORLD, getBodyBox };
+	auto bodies = makeBodies(2000);
+	for (const auto& body : bodies)
+	{
+		pointerTree.add(body);
+		flatTree.add(body);
+	}
+	// Remove every third body to leave abandoned slabs and merged nodes behind
+	for (auto i = std::size_t(0); i < bodies.size(); i += 3)
+	{
+		pointerTree.remove(bodies[i]);
+		flatTree.remove(bodies[i]);
+	}
+
+	const auto sameIds = [](std::vector<Body> lhs, std::vector<Body> rhs) {
+		const auto byId = [](const Body& a, const Body& b) { return a.id < b.id; };
+		std::sort(lhs.begin(), lhs.end(), byId);
+		std::sort(rhs.begin(), rhs.end(), byId);
+		return lhs == rhs;
+	};
+	const auto window = quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f };
+	REQUIRE(sameIds(pointerTree.query(WORLD), flatTree.query(WORLD)));
+	REQUIRE(sameIds(pointerTree.query(window), flatTree.query(window)));
+	REQUIRE(pointerTree.findAllIntersections().size() == flatTree.findAllIntersections().size());
+
+	flatTree.mNodes.pack();
+	REQUIRE(sameIds(pointerTree.query(window), flatTree.query(window)));
+	REQUIRE(pointerTree.findAllIntersections().size() == flatTree.findAllIntersections().size());
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree fits its box to the values", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType> tree { { 0.f, 0.f, 16.f, 16.f }, getBodyBox };
+	auto bodies = makeBodies(1000);
+	// Values far on every side make the root grow
+	bodies.push_back(Body { 1000, { -5000.f, -300.f, 10.f, 10.f } });
+	bodies.push_back(Body { 1001, { 7000.f, 9000.f, 10.f, 10.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	for (const auto& body : bodies)
+	{
+		REQUIRE(tree.getBox().contains(body.box));
+		auto found = tree.query(body.box);
+		REQUIRE(std::find(found.begin(), found.end(), body) != found.end());
+	}
+	REQUIRE(tree.query(tree.getBox()).size() == bodies.size());
+
+	// Once the outliers are gone, the root shrinks back to the screen scale
+	const auto grown = tree.getBox();
+	tree.remove(bodies[1000]);
+	tree.remove(bodies[1001]);
+	REQUIRE(tree.getBox().width < grown.width);
+	REQUIRE(tree.getBox().width >= 1000.f);
+	REQUIRE(tree.query(tree.getBox()).size() == 1000);
+
+	// Moving a value outside makes it grow again
+	auto body = bodies[0];
+	const auto old_box = body.box;
+	body.box.left = -20000.f;
+	tree.update(body, old_box);
+	REQUIRE(tree.getBox().contains(body.box));
+	auto found = tree.query(body.box);
+	REQUIRE(std::find(found.begin(), found.end(), body) != found.end());
+
+	// Values touching the right and bottom edges of the root are still found once it grows
+	BodyTree<TestType> edges { { 0.f, 0.f, 32.f, 32.f }, getBodyBox };
+	auto touching = std::vector<Body>();
+	for (auto i = 0; i < 64; ++i)
+	{
+		touching.push_back(Body { i, { 22.f, float(i % 8) * 2.f, 10.f, 10.f } });
+		touching.push_back(Body { 64 + i, { float(i % 8) * 2.f, 22.f, 10.f, 10.f } });
+	}
+	for (const auto& value : touching)
+		edges.add(value);
+	edges.add(Body { 128, { 500.f, 500.f, 10.f, 10.f } });
+	for (auto& value : touching)
+	{
+		const auto previous = value.box;
+		value.box.top += 1.f;
+		edges.update(value, previous);
+	}
+	for (const auto& value : touching)
+		edges.remove(value);
+	REQUIRE(edges.query(edges.getBox()).size() == 1);
+
+	// A value moving out of a leaf root makes it grow as well
+	BodyTree<TestType> leaf { { 0.f, 0.f, 100.f, 100.f }, getBodyBox };
+	leaf.add(Body { 0, { 10.f, 10.f, 5.f, 5.f } });
+	auto leaving = leaf.add(Body { 1, { 20.f, 20.f, 5.f, 5.f } });
+	const auto previous = leaving.box;
+	leaving.box = { 500.f, 500.f, 5.f, 5.f };
+	leaf.update(leaving, previous);
+	REQUIRE(leaf.getBox().contains(leaving.box));
+	REQUIRE(leaf.count({ 495.f, 495.f, 20.f, 20.f }) == 1);
+	leaf.add(Body { 2, { -300.f, -300.f, 5.f, 5.f } });
+	leaf.remove(leaving);
+	REQUIRE(leaf.size() == 2);
+	REQUIRE(leaf.count(leaf.getBox()) == 2);
+
+	// Values that never fit stay in the root as it grows around them
+	BodyTree<TestType> unbounded { { 0.f, 0.f, 100.f, 100.f }, getBodyBox };
+	const auto infinite = Body { 0, { 10.f, 10.f, std::numeric_limits<float>::infinity(), 5.f } };
+	unbounded.add(infinite);
+	unbounded.add(Body { 1, { 20.f, 20.f, 5.f, 5.f } });
+	unbounded.add(Body { 2, { 1000.f, 1000.f, 5.f, 5.f } });
+	REQUIRE(unbounded.count({ 50.f, 12.f, 1.f, 1.f }) == 1);
+	unbounded.remove(infinite);
+	REQUIRE(unbounded.size() == 2);
+	REQUIRE(unbounded.count(unbounded.getBox()) == 2);
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree merges the nodes pushed below its maximum depth as it grows", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	using DeepTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::NoStats, quadtree::FixedSplit<1, 4>>;
+	DeepTree tree { { 0.f, 0.f, 16.f, 16.f }, getBodyBox };
+	// Small bodies split the tree down to its maximum depth
+	auto bodies = makeBodies(64, 16.f, 0.5f);
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	REQUIRE(tree.getStats().nodesPerDepth.size() == 5);
+
+	// A single body far away grows the root several times at once
+	bodies.push_back(Body { 64, { 1000.f, 1000.f, 1.f, 1.f } });
+	tree.add(bodies.back());
+	REQUIRE(tree.getBox().width >= 1024.f);
+	REQUIRE(tree.getStats().nodesPerDepth.size() <= 5);
+	for (const auto& body : bodies)
+	{
+		auto found = tree.query(body.box);
+		REQUIRE(std::find(found.begin(), found.end(), body) != found.end());
+	}
+	for (const auto& body : bodies)
+	{
+		tree.remove(body);
+	}
+	REQUIRE(tree.size() == 0);
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree keeps finding the values of a fitted root as it grows", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	// Doubling the root fitted by build towards the north west rounds its edges, its old box
+	// is not given back exactly by the new one
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	auto bodies = makeBodies(300, 500.f, 3.f);
+	for (auto& body : bodies)
+	{
+		body.box.left -= 943.912f;
+		body.box.top -= 943.912f;
+	}
+	bodies.push_back(Body { 300, { -943.912f, -943.912f, 3.f, 3.f } });
+	bodies.push_back(Body { 301, { -425.912f, -425.912f, 3.f, 3.f } });
+	tree.build(bodies);
+	const auto fitted = tree.getBox();
+	REQUIRE((fitted.left - fitted.width) + fitted.width != fitted.left);
+
+	// Bodies starting on the center of the root are the first to be routed elsewhere
+	const auto center = fitted.getCenter();
+	for (auto i = 0; i < 20; ++i)
+	{
+		bodies.push_back(Body { 302 + i, { center.x, center.y + static_cast<float>(i), 1.f, 0.5f } });
+		tree.add(bodies.back());
+	}
+	bodies.push_back(Body { 400, { -90000.3f, -70000.7f, 3.f, 3.f } });
+	tree.add(bodies.back());
+	for (const auto& body : bodies)
+	{
+		auto found = tree.query(body.box);
+		REQUIRE(std::find(found.begin(), found.end(), body) != found.end());
+	}
+	for (auto& body : bodies)
+	{
+		const auto oldBox = body.box;
+		body.box.top += 0.25f;
+		tree.update(body, oldBox);
+	}
+	for (const auto& body : bodies)
+	{
+		tree.remove(body);
+	}
+	REQUIRE(tree.size() == 0);
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree visits values without collecting them", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	for (const auto& body : makeBodies(1000))
+	{
+		tree.add(body);
+	}
+
+	const auto window = quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f };
+	const auto expected = tree.query(window);
+	REQUIRE(!expected.empty());
+	REQUIRE(tree.count(window) == expected.size());
+	REQUIRE(tree.count(WORLD) == 1000);
+
+	auto visited = std::vector<Body>();
+	tree.forEach(window, [&visited](const Body& body) { visited.push_back(body); });
+	REQUIRE(visited == expected);
+
+	// any stops at the first value satisfying the predicate
+	auto tested = std::size_t(0);
+	REQUIRE(tree.any(window, [&tested](const Body&) { return ++tested == 2; }));
+	REQUIRE(tested == 2);
+	REQUIRE(!tree.any(window, [](const Body& body) { return body.id < 0; }));
+	REQUIRE(tree.any(window));
+	REQUIRE(!tree.any({ 2000.f, 2000.f, 10.f, 10.f }));
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree finds intersections in parallel", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	// Dense enough for the root to be split in many jobs, with values straddling the quadrants
+	for (const auto& body : makeBodies(8000, 1000.f, 12.f))
+	{
+		tree.add(body);
+	}
+
+	const auto serial = normalized(tree.findAllIntersections());
+	REQUIRE(serial.size() > 0);
+	REQUIRE(std::adjacent_find(serial.begin(), serial.end()) == serial.end());
+	REQUIRE(normalized(tree.findAllIntersectionsParallel(4)) == serial);
+	REQUIRE(normalized(tree.findAllIntersectionsParallel(1)) == serial);
+}
+
+TEST_CASE("quadtree::simd::forEachIntersecting matches Box::intersects", "[quadtree]")
+{
+	// Enough boxes for several SIMD blocks and a scalar tail
+	auto boxes = std::vector<quadtree::Box<float>>();
+	for (const auto& body : makeBodies(203, 200.f, 20.f))
+	{
+		boxes.push_back(body.box);
+	}
+	boxes[5].width = std::numeric_limits<float>::quiet_NaN();
+	auto columns = std::array<std::vector<float>, 4>();
+	for (const auto& box : boxes)
+	{
+		columns[0].push_back(box.left);
+		columns[1].push_back(box.top);
+		columns[2].push_back(box.getRight());
+		columns[3].push_back(box.getBottom());
+	}
+	const auto edges = quadtree::EdgeColumns<float> { columns[0].data(), columns[1].data(), columns[2].data(), columns[3].data() };
+
+	for (const auto& query : { quadtree::Box<float> { 50.f, 50.f, 40.f, 30.f }, quadtree::Box<float> { 0.f, 0.f, 200.f, 200.f }, quadtree::Box<float> { 500.f, 0.f, 1.f, 1.f } })
+	{
+		for (const auto n : { std::size_t(0), std::size_t(7), std::size_t(16), std::size_t(203) })
+		{
+			auto expected = std::vector<std::size_t>();
+			for (auto i = std::size_t(0); i < n; ++i)
+			{
+				if (query.intersects(boxes[i]))
+					expected.push_back(i);
+			}
+			auto found = std::vector<std::size_t>();
+			const auto q = quadtree::Edges<float> { query.left, query.top, query.getRight(), query.getBottom() };
+			REQUIRE(!quadtree::simd::forEachIntersecting(edges, n, q, [&found](std::size_t i) { found.push_back(i); return false; }));
+			REQUIRE(found == expected);
+		}
+	}
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree builds from a range of values", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType> built { { 0.f, 0.f, 16.f, 16.f }, getBodyBox };
+	BodyTree<TestType> added { WORLD, getBodyBox };
+	auto bodies = makeBodies(3000);
+	bodies.push_back(Body { 3000, { std::numeric_limits<float>::infinity(), 0.f, 1.f, 1.f } });
+	for (const auto& body : bodies)
+	{
+		added.add(body);
+	}
+	built.build(bodies);
+
+	// The value at infinity is kept in the root but no box query can reach it
+	REQUIRE(built.count(built.getBox()) == bodies.size() - 1);
+	for (const auto& body : std::span(bodies).first(3000))
+	{
+		auto found = built.query(body.box);
+		REQUIRE(std::find(found.begin(), found.end(), body) != found.end());
+	}
+	REQUIRE(built.findAllIntersections().size() == added.findAllIntersections().size());
+	REQUIRE(!built.isLeaf(built.mNodes.root()));
+
+	// A built tree supports the incremental operations
+	auto body = bodies[10];
+	const auto old_box = body.box;
+	body.box.left = 500.f;
+	built.update(body, old_box);
+	auto found = built.query(body.box);
+	REQUIRE(std::find(found.begin(), found.end(), body) != found.end());
+	bodies[10] = body;
+	for (const auto& other : bodies)
+	{
+		built.remove(other);
+	}
+	REQUIRE(built.isLeaf(built.mNodes.root()));
+	REQUIRE(built.mNodes.values(built.mNodes.root()).empty());
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree hands out stable handles", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	auto bodies = makeBodies(2000);
+	auto handles = std::vector<quadtree::Handle>();
+	for (auto i = std::size_t(0); i < 1000; ++i)
+	{
+		handles.push_back(tree.insert(bodies[i]));
+	}
+	// References and handles survive the splits of the next insertions and the merges of removals
+	auto* first = &tree.get(handles.front());
+	for (auto i = std::size_t(1000); i < bodies.size(); ++i)
+	{
+		tree.add(bodies[i]);
+	}
+	for (auto i = std::size_t(1000); i < bodies.size(); ++i)
+	{
+		tree.remove(bodies[i]);
+	}
+	REQUIRE(first == &tree.get(handles.front()));
+	for (auto i = std::size_t(0); i < handles.size(); ++i)
+	{
+		REQUIRE(tree.get(handles[i]).id == bodies[i].id);
+	}
+
+	// Values modified in place through their handles are moved without being copied
+	for (auto i = std::size_t(0); i < handles.size(); i += 2)
+	{
+		auto& body = tree.get(handles[i]);
+		body.box.left = std::fmod(body.box.left + 301.f, 990.f);
+		bodies[i] = body;
+	}
+	auto moved = std::vector<quadtree::Handle>();
+	for (auto i = std::size_t(0); i < handles.size(); i += 2)
+	{
+		moved.push_back(handles[i]);
+	}
+	tree.relocate(moved);
+	for (auto i = std::size_t(0); i < handles.size(); ++i)
+	{
+		auto found = tree.query(bodies[i].box);
+		REQUIRE(std::find(found.begin(), found.end(), bodies[i]) != found.end());
+	}
+	REQUIRE(tree.handles(WORLD).size() == handles.size());
+
+	// A removed value's handle is stale, even once its slot is reused
+	tree.remove(handles[3]);
+	REQUIRE(!tree.contains(handles[3]));
+	auto reused = tree.insert(Body { 5000, { 1.f, 1.f, 1.f, 1.f } });
+	REQUIRE(reused.index == handles[3].index);
+	REQUIRE(!tree.contains(handles[3]));
+	REQUIRE(tree.contains(reused));
+	REQUIRE(tree.count(WORLD) == handles.size());
+	REQUIRE(tree.size() == handles.size());
+
+	// Clearing invalidates every handle, including those of the slots reused afterwards
+	tree.clear();
+	REQUIRE(tree.size() == 0);
+	REQUIRE(tree.count(WORLD) == 0);
+	REQUIRE(!tree.contains(reused));
+	auto fresh = tree.insert(bodies[0]);
+	REQUIRE(fresh.index == handles[0].index);
+	REQUIRE(!tree.contains(handles[0]));
+	REQUIRE(tree.query(bodies[0].box) == std::vector<Body> { bodies[0] });
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree reports its shape and the work of its queries", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	STATIC_REQUIRE(std::is_empty_v<quadtree::NoStats>);
+	BodyTree<TestType, quadtree::CountStats> tree { WORLD, getBodyBox };
+	for (const auto& body : makeBodies(2000))
+	{
+		tree.add(body);
+	}
+	// Straddles the quadrants of the root
+	tree.add(Body { 2000, { 500.f, 500.f, 24.f, 24.f } });
+
+	auto stats = tree.getStats();
+	REQUIRE(stats.values == 2001);
+	REQUIRE(stats.nodes == std::accumulate(stats.nodesPerDepth.begin(), stats.nodesPerDepth.end(), std::size_t(0)));
+	REQUIRE(stats.nodes == std::accumulate(stats.valuesPerNode.begin(), stats.valuesPerNode.end(), std::size_t(0)));
+	REQUIRE(stats.nodes == 4 * (stats.nodes - stats.leaves) + 1);
+	REQUIRE(stats.nodesPerDepth[0] == 1);
+	auto values = std::size_t(0);
+	for (auto i = std::size_t(0); i < stats.valuesPerNode.size(); ++i)
+	{
+		values += i * stats.valuesPerNode[i];
+	}
+	REQUIRE(values == stats.values);
+	REQUIRE(stats.interiorValues >= 1);
+	REQUIRE(stats.interiorValues < stats.values);
+	REQUIRE(stats.bytes > stats.values * sizeof(Body));
+
+	tree.resetStats();
+	const auto window = quadtree::Box<float> { 100.f, 100.f, 50.f, 50.f };
+	const auto found = tree.count(window);
+	stats = tree.getStats();
+	REQUIRE(stats.queries == 1);
+	REQUIRE(stats.nodesVisited >= 1);
+	REQUIRE(stats.nodesVisited < stats.nodes);
+	REQUIRE(stats.boxesTested >= found);
+	tree.resetStats();
+	REQUIRE(tree.getStats().nodesVisited == 0);
+}
+
+TEST_CASE("quadtree::Quadtree takes its split thresholds from a policy", "[quadtree]")
+{
+	using SmallLeaves = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, quadtree::PointerStorage, quadtree::NoStats, quadtree::FixedSplit<4, 10>>;
+	using Adaptive = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, quadtree::FlatStorage, quadtree::NoStats, quadtree::AdaptiveSplit<>>;
+	BodyTree<> tree { WORLD, getBodyBox };
+	SmallLeaves small { WORLD, getBodyBox };
+	Adaptive adaptive { WORLD, getBodyBox };
+	auto bodies = makeBodies(2000);
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+		small.add(body);
+		adaptive.add(body);
+	}
+	REQUIRE(small.getStats().nodes > tree.getStats().nodes);
+	REQUIRE(small.getStats().nodesPerDepth.size() > tree.getStats().nodesPerDepth.size());
+
+	// Small queries find few of the boxes of their leaves, the thresholds go down
+	for (const auto& body : bodies)
+	{
+		REQUIRE(adaptive.count({ body.box.left, body.box.top, 1.f, 1.f }) == tree.count({ body.box.left, body.box.top, 1.f, 1.f }));
+	}
+	adaptive.relocate(std::vector<quadtree::Handle>());
+	REQUIRE(std::ranges::any_of(adaptive.mSplit.mThresholds, [](auto threshold) { return threshold < 16; }));
+	REQUIRE(std::ranges::all_of(adaptive.mSplit.mThresholds, [](auto threshold) { return threshold <= 16; }));
+	const auto thresholds = adaptive.mSplit.mThresholds;
+
+	// Squeezing the values in half of the world splits more leaves with the lower thresholds
+	auto moved = std::vector<quadtree::Handle>();
+	for (auto handle : adaptive.handles(WORLD))
+	{
+		auto& body = adaptive.get(handle);
+		const auto old_box = body.box;
+		body.box.left /= 2.f;
+		tree.update(body, old_box);
+		moved.push_back(handle);
+	}
+	adaptive.relocate(moved);
+	REQUIRE(adaptive.getStats().nodes > tree.getStats().nodes);
+
+	// Queries covering the world find every box they test, the thresholds go back up
+	for (auto i = 0; i < 8; ++i)
+	{
+		REQUIRE(adaptive.count(WORLD) == tree.count(WORLD));
+	}
+	adaptive.relocate(std::vector<quadtree::Handle>());
+	for (auto depth = std::size_t(0); depth < thresholds.size(); ++depth)
+	{
+		REQUIRE(adaptive.mSplit.mThresholds[depth] >= thresholds[depth]);
+	}
+	REQUIRE(adaptive.mSplit.mThresholds != thresholds);
+	for (const auto& body : tree.query(WORLD))
+	{
+		REQUIRE(adaptive.count(body.box) == tree.count(body.box));
+	}
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree with loose bounds matches the tight one", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	using LooseTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::LooseBounds<>>;
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	LooseTree loose { WORLD, getBodyBox };
+	auto bodies = makeBodies(3000);
+	// Boxes crossing the center lines, a large one, one outside of the world and a non finite one
+	bodies.push_back(Body { 3000, { 510.f, 510.f, 4.f, 4.f } });
+	bodies.push_back(Body { 3001, { 250.f, 508.f, 6.f, 6.f } });
+	bodies.push_back(Body { 3002, { 100.f, 100.f, 600.f, 300.f } });
+	bodies.push_back(Body { 3003, { 1500.f, -200.f, 10.f, 10.f } });
+	bodies.push_back(Body { 3004, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+		loose.add(body);
+	}
+	// Only the large body and the non finite one may be too large for a child of the root
+	REQUIRE(loose.getStats().interiorValues < tree.getStats().interiorValues);
+	REQUIRE(loose.mNodes.values(loose.mNodes.root()).size() <= 2);
+
+	const auto check = [&]() {
+		for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { 505.f, 505.f, 10.f, 10.f }, quadtree::Box<float> { -1e30f, -1e30f, 2e30f, 2e30f }, quadtree::Box<float> { 1495.f, -195.f, 1.f, 1.f } })
+		{
+			REQUIRE(sortedIds(loose.query(window)) == sortedIds(tree.query(window)));
+		}
+		const auto pairs = normalized(tree.findAllIntersections());
+		REQUIRE(normalized(loose.findAllIntersections()) == pairs);
+		REQUIRE(normalized(loose.findAllIntersectionsParallel(4)) == pairs);
+	};
+	check();
+
+	// Moved values follow their center
+	auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (auto* body : loose.access(WORLD))
+	{
+		if (body->id % 3 == 0 && body->id < 3000)
+		{
+			const auto old_box = body->box;
+			body->box.left = std::fmod(body->box.left + 37.f, 990.f);
+			moved.emplace_back(*body, old_box);
+			tree.update(*body, old_box);
+		}
+	}
+	loose.relocate(moved);
+	check();
+
+	// Bulk loading places the values at the same nodes
+	LooseTree built { WORLD, getBodyBox };
+	built.build(tree.query(tree.getBox()));
+	REQUIRE(normalized(built.findAllIntersections()) == normalized(tree.findAllIntersections()));
+
+	for (const auto& body : tree.query(tree.getBox()))
+	{
+		loose.remove(body);
+	}
+	REQUIRE(loose.size() == 0);
+	REQUIRE(loose.getStats().nodes == 1);
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree finds the nearest values and the values in a radius", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	using LooseTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::LooseBounds<>>;
+	const auto distance = [](const Body& body, const quadtree::Vector2<float>& point) {
+		auto dx = std::max({ body.box.left - point.x, 0.f, point.x - body.box.getRight() });
+		auto dy = std::max({ body.box.top - point.y, 0.f, point.y - body.box.getBottom() });
+		return dx * dx + dy * dy;
+	};
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	LooseTree loose { WORLD, getBodyBox };
+	auto bodies = makeBodies(2000, 1000.f, 4.f);
+	bodies.push_back(Body { 2000, { 100.f, 100.f, 600.f, 300.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+		loose.add(body);
+	}
+
+	for (const auto& point : { quadtree::Vector2<float>(500.f, 500.f), quadtree::Vector2<float>(3.f, 997.f), quadtree::Vector2<float>(-300.f, 1400.f), quadtree::Vector2<float>(250.f, 250.f) })
+	{
+		auto expected = std::vector<float>();
+		for (const auto& body : bodies)
+		{
+			expected.push_back(distance(body, point));
+		}
+		std::sort(expected.begin(), expected.end());
+		for (const auto k : { std::size_t(0), std::size_t(1), std::size_t(7), std::size_t(40) })
+		{
+			for (const auto& nearest : { tree.findNearest(point, k), loose.findNearest(point, k) })
+			{
+				REQUIRE(nearest.size() == k);
+				for (auto i = std::size_t(0); i < k; ++i)
+				{
+					REQUIRE(distance(nearest[i], point) == expected[i]);
+				}
+			}
+		}
+
+		for (const auto radius : { 0.f, 5.f, 60.f, 2000.f })
+		{
+			auto inside = std::vector<int>();
+			for (const auto& body : bodies)
+			{
+				if (distance(body, point) < radius * radius)
+					inside.push_back(body.id);
+			}
+			for (const auto& found : { tree.queryRadius(point, radius), loose.queryRadius(point, radius) })
+			{
+				REQUIRE(sortedIds(found) == inside);
+			}
+		}
+	}
+	REQUIRE(tree.findNearest({ 0.f, 0.f }, 3000).size() == bodies.size());
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree casts rays front to back", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	using LooseTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::LooseBounds<>>;
+	// First time in [0, maxTime] at which the ray enters the closed box, or a negative value
+	const auto enterTime = [](const quadtree::Box<float>& box, quadtree::Vector2<float> origin, quadtree::Vector2<float> direction, float maxTime) {
+		auto enter = 0.f;
+		auto exit = maxTime;
+		const auto slab = [&](float low, float high, float start, float speed) {
+			if (speed == 0.f)
+				return low <= start && start <= high;
+			const auto t0 = (low - start) / speed;
+			const auto t1 = (high - start) / speed;
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+			return enter <= exit;
+		};
+		return slab(box.left, box.getRight(), origin.x, direction.x) && slab(box.top, box.getBottom(), origin.y, direction.y) ? enter : -1.f;
+	};
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	LooseTree loose { WORLD, getBodyBox };
+	auto bodies = makeBodies(1500, 1000.f, 3.f);
+	// A thin wall and a large box crossing the center lines
+	bodies.push_back(Body { 1500, { 700.f, 0.f, 0.5f, 1000.f } });
+	bodies.push_back(Body { 1501, { 300.f, 300.f, 400.f, 400.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+		loose.add(body);
+	}
+
+	const auto check = [&](quadtree::Vector2<float> origin, quadtree::Vector2<float> direction, float maxTime, const auto& pred) {
+		auto expected = -1.f;
+		for (const auto& body : bodies)
+		{
+			const auto time = enterTime(body.box, origin, direction, maxTime);
+			if (time >= 0.f && pred(body) && (expected < 0.f || time < expected))
+				expected = time;
+		}
+		for (const auto& hit : { tree.raycast(origin, direction, maxTime, pred), loose.raycast(origin, direction, maxTime, pred) })
+		{
+			REQUIRE(hit.has_value() == (expected >= 0.f));
+			if (hit)
+			{
+				REQUIRE(hit->second == expected);
+				REQUIRE(enterTime(hit->first.box, origin, direction, maxTime) == expected);
+			}
+		}
+	};
+	const auto all = [](const Body&) { return true; };
+	const auto notLarge = [](const Body& body) { return body.id != 1501; };
+	for (auto i = 0; i < 64; ++i)
+	{
+		const auto angle = static_cast<float>(i) * 0.3f;
+		const auto origin = quadtree::Vector2<float>(static_cast<float>((i * 137) % 1100) - 50.f, static_cast<float>((i * 71) % 1100) - 50.f);
+		const auto direction = quadtree::Vector2<float>(std::cos(angle), std::sin(angle));
+		check(origin, direction, 2000.f, all);
+		check(origin, direction, 40.f, all);
+		check(origin, direction, 2000.f, notLarge);
+	}
+	// Axis aligned rays, and a ray starting inside a box
+	check({ 0.f, 500.f }, { 1.f, 0.f }, 1000.f, notLarge);
+	check({ 650.f, -10.f }, { 0.f, 1.f }, 1000.f, all);
+	check({ 500.f, 500.f }, { 1.f, 1.f }, 1000.f, all);
+
+	// The thin wall stops a segment crossing it
+	auto hit = tree.segmentCast({ 650.f, 200.5f }, { 750.f, 200.5f }, [](const Body& body) { return body.id >= 1500; });
+	REQUIRE(hit);
+	REQUIRE(hit->first.id == 1500);
+	REQUIRE(hit->second == Approx(0.5f));
+	REQUIRE(!tree.segmentCast({ 710.f, 200.5f }, { 750.f, 200.5f }, [](const Body& body) { return body.id >= 1500; }));
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree answers a batch of queries in one walk", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	using LooseTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::CountStats, quadtree::FixedSplit<>, quadtree::LooseBounds<>>;
+	BodyTree<TestType, quadtree::CountStats> tree { WORLD, getBodyBox };
+	LooseTree loose { WORLD, getBodyBox };
+	auto bodies = makeBodies(3000);
+	bodies.push_back(Body { 3000, { 500.f, 500.f, 30.f, 30.f } });
+	bodies.push_back(Body { 3001, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+		loose.add(body);
+	}
+	auto windows = std::vector<quadtree::Box<float>>();
+	for (const auto& body : bodies)
+	{
+		if (body.id % 7 == 0)
+			windows.emplace_back(body.box.left - 5.f, body.box.top - 5.f, 20.f, 20.f);
+	}
+	// Windows crossing the center lines, covering everything and outside of the tree
+	windows.emplace_back(500.f, 100.f, 30.f, 800.f);
+	windows.emplace_back(-1e30f, -1e30f, 2e30f, 2e30f);
+	windows.emplace_back(5000.f, 5000.f, 10.f, 10.f);
+	windows.emplace_back(250.f, 250.f, 1.f, 1.f);
+
+	const auto check = [&windows](auto& index) {
+		index.resetStats();
+		auto results = index.accessBatch(windows);
+		const auto batchStats = index.getStats();
+		REQUIRE(results.size() == windows.size());
+		REQUIRE(results.offsets.back() == results.values.size());
+		index.resetStats();
+		for (auto i = std::size_t(0); i < windows.size(); ++i)
+		{
+			REQUIRE(sortedIds(results[i]) == sortedIds(index.access(windows[i])));
+		}
+		const auto singleStats = index.getStats();
+		REQUIRE(batchStats.queries == singleStats.queries);
+		REQUIRE(batchStats.nodesVisited < singleStats.nodesVisited);
+	};
+	check(tree);
+	check(loose);
+
+	// The buffers are reused by the next batch
+	auto results = quadtree::BatchResults<Body*>();
+	tree.accessBatch(std::span(windows).first(3), results);
+	REQUIRE(results.size() == 3);
+	tree.accessBatch(std::span<const quadtree::Box<float>>(), results);
+	REQUIRE(results.size() == 0);
+	REQUIRE(results.values.empty());
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree filters values and pairs by layer", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	// Bodies fall in 3 categories by id, the third one only colliding with the first, and a
+	// few bodies in a fourth category colliding with everything
+	struct BodyLayer
+	{
+		quadtree::Layer operator()(const Body& body) const
+		{
+			if (body.id % 50 == 0)
+				return quadtree::Layer { 8, quadtree::AllCategories };
+			const auto category = quadtree::Categories(1) << (body.id % 3);
+			return quadtree::Layer { category, category == 4 ? quadtree::Categories(1) : quadtree::AllCategories };
+		}
+	};
+	using FilteredTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::CountStats, quadtree::FixedSplit<>, quadtree::TightBounds, quadtree::CategoryFilter<BodyLayer>>;
+	using LooseTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::LooseBounds<>, quadtree::CategoryFilter<BodyLayer>>;
+	const auto colliding = [](const std::vector<std::pair<Body, Body>>& pairs) {
+		auto filtered = std::vector<std::pair<Body, Body>>();
+		std::copy_if(pairs.begin(), pairs.end(), std::back_inserter(filtered), [](const auto& pair) { return BodyLayer()(pair.first).collides(BodyLayer()(pair.second)); });
+		return normalized(filtered);
+	};
+	// The categories of a node contain the ones of its subtree, exactly if exact is set
+	const auto checkCategories = [](const auto& tree, bool exact) {
+		const auto visit = [&tree, exact](const auto& self, auto node) -> quadtree::Categories {
+			auto categories = quadtree::Categories(0);
+			for (auto index : tree.mNodes.values(node))
+				categories |= tree.mLayers[index].category;
+			if (!tree.isLeaf(node))
+			{
+				for (auto i = std::size_t(0); i < 4; ++i)
+					categories |= self(self, tree.mNodes.child(node, i));
+			}
+			REQUIRE((tree.mNodes.categories(node) & categories) == categories);
+			if (exact)
+				REQUIRE(tree.mNodes.categories(node) == categories);
+			return categories;
+		};
+		visit(visit, tree.mNodes.root());
+	};
+
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	FilteredTree filtered { WORLD, getBodyBox };
+	LooseTree loose { WORLD, getBodyBox };
+	auto bodies = makeBodies(3000);
+	bodies.push_back(Body { 3001, { 100.f, 100.f, 600.f, 300.f } });
+	bodies.push_back(Body { 3002, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+		filtered.add(body);
+		loose.add(body);
+	}
+
+	const auto check = [&]() {
+		checkCategories(filtered, false);
+		checkCategories(loose, false);
+		const auto pairs = colliding(tree.findAllIntersections());
+		REQUIRE(pairs.size() < tree.findAllIntersections().size());
+		REQUIRE(normalized(filtered.findAllIntersections()) == pairs);
+		REQUIRE(normalized(filtered.findAllIntersectionsParallel(4)) == pairs);
+		REQUIRE(normalized(loose.findAllIntersections()) == pairs);
+		for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { -1e30f, -1e30f, 2e30f, 2e30f } })
+		{
+			for (const auto& layer : { quadtree::AnyLayer, quadtree::Layer { 4, 1 }, quadtree::Layer { 1, 8 } })
+			{
+				auto expected = tree.query(window);
+				std::erase_if(expected, [&layer](const Body& body) { return !layer.collides(BodyLayer()(body)); });
+				REQUIRE(filtered.count(window, layer) == expected.size());
+				REQUIRE(loose.count(window, layer) == expected.size());
+				REQUIRE(filtered.any(window, layer, [](const Body&) { return true; }) == !expected.empty());
+			}
+		}
+	};
+	check();
+
+	// Subtrees without the rare category are skipped
+	filtered.resetStats();
+	filtered.count(WORLD, quadtree::AnyLayer);
+	const auto allNodes = filtered.getStats().nodesVisited;
+	filtered.resetStats();
+	REQUIRE(filtered.query(WORLD, quadtree::Layer { 1, 8 }).size() == 60);
+	REQUIRE(filtered.getStats().nodesVisited < allNodes);
+
+	auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (auto* body : filtered.access(WORLD))
+	{
+		if (body->id % 3 == 0 && body->id < 3000)
+		{
+			const auto old_box = body->box;
+			body->box.left = std::fmod(body->box.left + 37.f, 990.f);
+			body->box.top = std::fmod(body->box.top + 411.f, 990.f);
+			moved.emplace_back(*body, old_box);
+			tree.update(*body, old_box);
+		}
+	}
+	filtered.relocate(moved);
+	loose.relocate(moved);
+	check();
+
+	for (const auto& body : tree.query(tree.getBox()))
+	{
+		if (body.id % 2 == 0)
+		{
+			tree.remove(body);
+			filtered.remove(body);
+			loose.remove(body);
+		}
+	}
+	check();
+
+	// A body leaving the cluster in one batch must not drop the category of another one moved
+	// beyond it within the north west quadrant while the first one is waiting to be added back
+	FilteredTree batch { WORLD, getBodyBox };
+	auto cluster = makeBodies(60, 100.f, 2.f);
+	for (auto i = std::size_t(0); i < cluster.size(); ++i)
+	{
+		cluster[i].id = 3 * static_cast<int>(i + 1);
+		batch.add(cluster[i]);
+	}
+	const auto lone = Body { 5005, { 5.f, 5.f, 2.f, 2.f } };
+	batch.add(lone);
+	auto batchMoved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	batchMoved.emplace_back(Body { lone.id, { 200.f, 5.f, 2.f, 2.f } }, lone.box);
+	batchMoved.emplace_back(Body { cluster[0].id, { 800.f, 800.f, 2.f, 2.f } }, cluster[0].box);
+	batch.relocate(batchMoved);
+	checkCategories(batch, false);
+	REQUIRE(batch.count({ 199.f, 4.f, 4.f, 4.f }, quadtree::Layer { 1, 2 }) == 1);
+	REQUIRE(batch.any(WORLD, quadtree::Layer { 1, 2 }, [](const Body& body) { return body.id == 5005; }));
+
+	// Bulk loading computes the exact categories of each node
+	FilteredTree built { WORLD, getBodyBox };
+	built.build(tree.query(tree.getBox()));
+	checkCategories(built, true);
+	REQUIRE(normalized(built.findAllIntersections()) == colliding(tree.findAllIntersections()));
+}
+
+TEMPLATE_TEST_CASE("quadtree::ConcurrentInserter fills the tree from many threads", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	const auto bodies = makeBodies(8000);
+	BodyTree<TestType> expected { WORLD, getBodyBox };
+	for (const auto& body : bodies)
+	{
+		expected.add(body);
+	}
+
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	auto inserter = quadtree::ConcurrentInserter<Body, BodyTree<TestType>>(tree);
+	// The first flush bulk loads the empty tree, the second one adds to it
+	for (const auto half : { 0, 1 })
+	{
+		auto threads = std::vector<std::thread>();
+		for (auto t = 0; t < 8; ++t)
+		{
+			threads.emplace_back([&inserter, &bodies, half, t]() {
+				for (auto i = half * 4000 + t; i < (half + 1) * 4000; i += 8)
+					inserter.insert(bodies[static_cast<std::size_t>(i)]);
+			});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		REQUIRE(tree.size() == static_cast<std::size_t>(half * 4000));
+		REQUIRE(inserter.flush() == 4000);
+	}
+	REQUIRE(tree.size() == bodies.size());
+	REQUIRE(inserter.flush() == 0);
+	for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { 0.f, 0.f, 1e30f, 1e30f }, quadtree::Box<float> { 55.f, 55.f, 1.f, 1.f } })
+	{
+		REQUIRE(sortedIds(tree.query(window)) == sortedIds(expected.query(window)));
+	}
+	REQUIRE(tree.findAllIntersections().size() == expected.findAllIntersections().size());
+
+	// insertAll hands out the handles in the order of the values, growing the root for the
+	// values outside of it
+	auto more = std::vector<Body> { Body { 9000, { 2000.f, 10.f, 5.f, 5.f } }, Body { 9001, { -300.f, -300.f, 5.f, 5.f } } };
+	const auto handles = tree.insertAll(more);
+	REQUIRE(handles.size() == 2);
+	REQUIRE(tree.get(handles[0]).id == 9000);
+	REQUIRE(tree.get(handles[1]).id == 9001);
+	REQUIRE(tree.getBox().contains(more[0].box));
+	REQUIRE(tree.getBox().contains(more[1].box));
+	REQUIRE(tree.count({ 1999.f, 9.f, 2.f, 2.f }) == 1);
+	REQUIRE(tree.count({ -301.f, -301.f, 2.f, 2.f }) == 1);
+}
+
+TEST_CASE("quadtree::Snapshots publishes versions to concurrent readers", "[quadtree]")
+{
+	// Every body of version v has an id between 1000 * v and 1000 * v + 499
+	const auto makeVersion = [](int version) {
+		auto bodies = makeBodies(500);
+		for (auto& body : bodies)
+		{
+			body.id += 1000 * version;
+		}
+		BodyTree<quadtree::FlatStorage> tree { WORLD, getBodyBox };
+		tree.build(bodies);
+		return tree;
+	};
+	quadtree::Snapshots<BodyTree<quadtree::FlatStorage>> snapshots;
+	REQUIRE(!snapshots.read());
+	REQUIRE(snapshots.publish(makeVersion(1)) == 1);
+
+	// A reader keeps its version alive, whatever is published meanwhile
+	{
+		const auto reader = snapshots.read();
+		REQUIRE(reader.version() == 1);
+		snapshots.publish(makeVersion(2));
+		snapshots.publish(makeVersion(3));
+		REQUIRE(snapshots.retired() == 2);
+		REQUIRE(snapshots.read().version() == 3);
+		REQUIRE(reader->size() == 500);
+		REQUIRE(reader->count({ 0.f, 0.f, 1e30f, 1e30f }) == 500);
+	}
+	REQUIRE(snapshots.reclaim() == 2);
+	REQUIRE(snapshots.retired() == 0);
+
+	// Readers see whole versions, in the order they were published
+	auto failures = std::atomic<int>(0);
+	auto done = std::atomic<bool>(false);
+	auto readers = std::vector<std::thread>();
+	for (auto t = 0; t < 4; ++t)
+	{
+		readers.emplace_back([&snapshots, &failures, &done]() {
+			auto last = std::uint64_t(0);
+			while (!done)
+			{
+				const auto reader = snapshots.read();
+				const auto version = static_cast<int>(reader.version());
+				auto count = std::size_t(0);
+				reader->forEach(reader->getBox(), [&](const Body& body) {
+					count += body.id / 1000 == version;
+				});
+				if (count != 500 || reader.version() < last)
+					++failures;
+				last = reader.version();
+			}
+		});
+	}
+	for (auto version = 4; version <= 200; ++version)
+	{
+		snapshots.publish(makeVersion(version));
+	}
+	done = true;
+	for (auto& reader : readers)
+	{
+		reader.join();
+	}
+	REQUIRE(failures == 0);
+	REQUIRE(snapshots.version() == 200);
+	REQUIRE(snapshots.read()->count({ 0.f, 0.f, 1e30f, 1e30f }) == 500);
+	snapshots.reclaim();
+	REQUIRE(snapshots.retired() == 0);
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree keeps exact aggregate summaries", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	using SummaryTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::TightBounds, quadtree::NoFilter, IdAggregate>;
+	using LooseSummaryTree = quadtree::Quadtree<Body, decltype(&getBodyBox), std::equal_to<Body>, float, TestType, quadtree::NoStats, quadtree::FixedSplit<>, quadtree::LooseBounds<>, quadtree::NoFilter, IdAggregate>;
+	const auto expected = [](const std::vector<Body>& bodies) {
+		auto summary = IdAggregate::Summary();
+		for (const auto& body : bodies)
+			summary = IdAggregate().combine(summary, IdAggregate().summarize(body, body.box));
+		return summary;
+	};
+	auto bodies = makeBodies(3000);
+	// A body on the edge of a window, an empty one and one with a non finite box
+	bodies.push_back(Body { 3000, { 100.f, 200.f, 0.f, 0.f } });
+	bodies.push_back(Body { 3001, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	const auto windows = { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { -1e30f, -1e30f, 2e30f, 2e30f }, quadtree::Box<float> { 55.f, 55.f, 1.f, 1.f }, quadtree::Box<float> { 0.f, 0.f, 512.f, 512.f } };
+
+	SummaryTree tree { WORLD, getBodyBox };
+	LooseSummaryTree looseTree { WORLD, getBodyBox };
+	BodyTree<TestType> reference { WORLD, getBodyBox };
+	auto handles = std::vector<quadtree::Handle>();
+	auto looseHandles = std::vector<quadtree::Handle>();
+	for (const auto& body : bodies)
+	{
+		handles.push_back(tree.insert(body));
+		looseHandles.push_back(looseTree.insert(body));
+		reference.add(body);
+	}
+	const auto check = [&]() {
+		REQUIRE(hasExactSummaries(tree));
+		REQUIRE(hasExactSummaries(looseTree));
+		REQUIRE(tree.summarize() == expected(reference.query(reference.getBox())));
+		for (const auto& window : windows)
+		{
+			REQUIRE(tree.summarize(window) == expected(reference.query(window)));
+			REQUIRE(looseTree.summarize(window) == expected(reference.query(window)));
+		}
+	};
+	check();
+	REQUIRE(tree.summarize().count == bodies.size());
+
+	// Values change in place, some of them without moving
+	auto changed = std::vector<std::size_t>();
+	for (auto i = std::size_t(0); i < 3000; i += 3)
+	{
+		auto& body = tree.get(handles[i]);
+		reference.remove(body);
+		body.id += 10000;
+		if (i % 2 == 0)
+			body.box.left = std::fmod(body.box.left + 300.f, 990.f);
+		looseTree.get(looseHandles[i]) = body;
+		reference.add(body);
+		changed.push_back(i);
+	}
+	tree.relocate(changed | std::views::transform([&handles](std::size_t i) { return handles[i]; }));
+	looseTree.relocate(changed | std::views::transform([&looseHandles](std::size_t i) { return looseHandles[i]; }));
+	check();
+
+	for (auto i = std::size_t(0); i < 3000; i += 2)
+	{
+		reference.remove(tree.get(handles[i]));
+		tree.remove(handles[i]);
+		looseTree.remove(looseHandles[i]);
+	}
+	check();
+
+	// The root grows towards a far value
+	tree.add(Body { 5000, { 5000.f, -3000.f, 10.f, 10.f } });
+	looseTree.add(Body { 5000, { 5000.f, -3000.f, 10.f, 10.f } });
+	reference.add(Body { 5000, { 5000.f, -3000.f, 10.f, 10.f } });
+	check();
+
+	tree.build(bodies);
+	looseTree.build(bodies);
+	reference.build(bodies);
+	check();
+
+	// Far subtrees are approximated by their summary
+	auto count = std::size_t(0);
+	auto nbSummaries = std::size_t(0);
+	tree.approximate([](const quadtree::Box<float>& box, const IdAggregate::Summary&) { return box.width > 200.f; },
+		[&](const quadtree::Box<float>&, const IdAggregate::Summary& summary) {
+			count += summary.count;
+			++nbSummaries;
+		});
+	REQUIRE(count == bodies.size());
+	REQUIRE(nbSummaries < bodies.size() / 4);
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree bounds the values below each node", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType, quadtree::CountStats> tree { WORLD, getBodyBox };
+	// A cluster in the north west corner and a few bodies in the east
+	auto bodies = makeBodies(400, 40.f, 2.f);
+	for (auto i = 0; i < 20; ++i)
+	{
+		bodies.push_back(Body { 1000 + i, { 600.f + 20.f * static_cast<float>(i), 100.f, 4.f, 4.f } });
+	}
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	REQUIRE(boundsValues(tree));
+
+	// The north west quadrant is not entered away from the cluster
+	tree.resetStats();
+	REQUIRE(tree.count({ 300.f, 300.f, 100.f, 100.f }) == 0);
+	REQUIRE(tree.getStats().nodesVisited == 1);
+	REQUIRE(tree.count({ 10.f, 10.f, 5.f, 5.f }) > 0);
+
+	// Moves within and across nodes keep the contents bounding the values
+	auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	for (auto* body : tree.access(tree.getBox()))
+	{
+		if (body->id % 3 == 0)
+		{
+			const auto oldBox = body->box;
+			body->box.left = body->id % 2 == 0 ? body->box.left + 1.f : std::fmod(body->box.left + 450.f, 1000.f);
+			moved.emplace_back(*body, oldBox);
+		}
+	}
+	tree.relocate(moved);
+	REQUIRE(boundsValues(tree));
+	auto pairs = std::size_t(0);
+	for (const auto& body : tree.query(tree.getBox()))
+	{
+		for (const auto& other : tree.query(body.box))
+			pairs += body.id < other.id;
+	}
+	REQUIRE(tree.findAllIntersections().size() == pairs);
+
+	// Removing the bodies of the east half empties the content of its quadrants
+	for (const auto& body : tree.query({ 512.f, 0.f, 512.f, 1024.f }))
+	{
+		tree.remove(body);
+	}
+	REQUIRE(boundsValues(tree));
+	tree.resetStats();
+	REQUIRE(tree.count({ 600.f, 0.f, 400.f, 400.f }) == 0);
+	REQUIRE(tree.getStats().nodesVisited <= 1);
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree bounds the values moved in one batch", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	BodyTree<TestType> tree { WORLD, getBodyBox };
+	auto bodies = makeBodies(100, 100.f, 2.f);
+	bodies.push_back(Body { 100, { 5.f, 5.f, 2.f, 2.f } });
+	bodies.push_back(Body { 101, { 6.f, 6.f, 2.f, 2.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+
+	// The first body stays in the north west quadrant but beyond the cluster, the second one
+	// leaves it and its nodes are made exact again while the first is waiting to be added back
+	auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+	moved.emplace_back(Body { 100, { 200.f, 5.f, 2.f, 2.f } }, bodies[100].box);
+	moved.emplace_back(Body { 101, { 800.f, 800.f, 2.f, 2.f } }, bodies[101].box);
+	tree.relocate(moved);
+	REQUIRE(boundsValues(tree));
+	REQUIRE(tree.count({ 199.f, 4.f, 4.f, 4.f }) == 1);
+	REQUIRE(tree.count({ 799.f, 799.f, 4.f, 4.f }) == 1);
+
+	// The same holds for many values moving at once
+	moved.clear();
+	for (const auto& body : tree.query(tree.getBox()))
+	{
+		auto box = body.box;
+		box.left = std::fmod(box.left * 3.f + static_cast<float>(body.id), 1000.f);
+		box.top = std::fmod(box.top * 5.f + 7.f, 1000.f);
+		moved.emplace_back(Body { body.id, box }, body.box);
+	}
+	tree.relocate(moved);
+	REQUIRE(boundsValues(tree));
+	for (const auto& [body, oldBox] : moved)
+	{
+		auto found = tree.query(body.box);
+		REQUIRE(std::find(std::begin(found), std::end(found), body) != std::end(found));
+	}
+}
+
+TEMPLATE_TEST_CASE("quadtree::Quadtree views its values lazily", "[quadtree]", quadtree::PointerStorage, quadtree::FlatStorage)
+{
+	static_assert(std::ranges::view<decltype(std::declval<BodyTree<TestType>&>().view(WORLD))>);
+	static_assert(std::ranges::input_range<decltype(std::declval<const BodyTree<TestType>&>().all())>);
+
+	const auto ids = [](auto&& values) {
+		auto ids = std::vector<int>();
+		for (const auto& body : values)
+			ids.push_back(body.id);
+		return ids;
+	};
+	BodyTree<TestType, quadtree::CountStats> tree { WORLD, getBodyBox };
+	REQUIRE(tree.all().begin() == std::default_sentinel);
+	auto bodies = makeBodies(2000);
+	// A body outside of the world and a non finite one
+	bodies.push_back(Body { 2000, { 1500.f, -200.f, 10.f, 10.f } });
+	bodies.push_back(Body { 2001, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+
+	// The same values as forEach, in the same order
+	for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { 0.f, 0.f, 1e30f, 1e30f }, quadtree::Box<float> { 500.f, 500.f, 24.f, 24.f }, quadtree::Box<float> { -20.f, -20.f, 15.f, 15.f } })
+	{
+		auto expected = std::vector<int>();
+		tree.forEach(window, [&expected](const Body& body) { expected.push_back(body.id); });
+		REQUIRE(ids(tree.view(window)) == expected);
+		REQUIRE(ids(std::as_const(tree).view(window)) == expected);
+	}
+	auto all = ids(tree.all());
+	std::sort(all.begin(), all.end());
+	auto expected = std::vector<int>(bodies.size());
+	std::iota(expected.begin(), expected.end(), 0);
+	REQUIRE(all == expected);
+
+	// Nothing is walked before the range is iterated, and only as far as it is
+	tree.resetStats();
+	auto even = tree.view(WORLD) | std::views::filter([](const Body& body) { return body.id % 2 == 0; });
+	REQUIRE(tree.getStats().queries == 0);
+	REQUIRE((*std::ranges::begin(even)).id % 2 == 0);
+	const auto firstVisited = tree.getStats().nodesVisited;
+	REQUIRE(std::ranges::distance(even) == 1000);
+	REQUIRE(firstVisited < tree.getStats().nodesVisited / 2);
+
+	// Values are modified in place
+	const auto window = quadtree::Box<float> { 100.f, 100.f, 200.f, 200.f };
+	for (auto& body : tree.view(window) | std::views::take(10))
+	{
+		body.box.width /= 2.f;
+	}
+	auto accessed = tree.access(window);
+	for (auto i = std::size_t(0); i < 10; ++i)
+	{
+		REQUIRE(accessed[i]->box.width == 5.f);
+	}
+	REQUIRE(accessed[10]->box.width == 10.f);
+}
@@ -0,0 +1,152 @@
+#include <catch2/catch.hpp>
+
+#include "Bodies.hpp"
+#include "sap/sap.h"
+#include <cmath>
+#include <set>
+
+namespace
+{
+using BodySweep = sap::SweepAndPrune<Body, decltype(&getBodyBox)>;
+
+// The pairs as a set to apply the reported changes to, each pair found once
+std::set<std::pair<int, int>> pairSet(const std::vector<std::pair<Body, Body>>& pairs)
+{
+	const auto ids = normalized(pairs);
+	REQUIRE(std::adjacent_find(ids.begin(), ids.end()) == ids.end());
+	return { ids.begin(), ids.end() };
+}
+}
+
+TEST_CASE("sap::SweepAndPrune matches the quadtree", "[sap]")
+{
+	BodySweep sweep { getBodyBox };
+	BodyTree<> tree { { 0.f, 0.f, 1024.f, 1024.f }, getBodyBox };
+	auto bodies = makeBodies(2000);
+	// Touching, empty and non finite boxes
+	bodies.push_back(Body { 2000, { 100.f, 100.f, 300.f, 300.f } });
+	bodies.push_back(Body { 2001, { 400.f, 100.f, 10.f, 10.f } });
+	bodies.push_back(Body { 2002, { 50.f, 50.f, 0.f, 10.f } });
+	bodies.push_back(Body { 2003, { 60.f, 60.f, std::numeric_limits<float>::infinity(), 10.f } });
+	sweep.build(bodies);
+	bodies.push_back(Body { 2004, { 55.f, 55.f, 10.f, 10.f } });
+	sweep.add(bodies.back());
+	for (const auto& body : bodies)
+	{
+		tree.add(body);
+	}
+	REQUIRE(sweep.mLoose.size() == 1);
+
+	for (const auto& window : { quadtree::Box<float> { 100.f, 200.f, 300.f, 150.f }, quadtree::Box<float> { 0.f, 0.f, 1e30f, 1e30f }, quadtree::Box<float> { 55.f, 55.f, 1.f, 1.f }, quadtree::Box<float> { 405.f, 105.f, 10.f, 10.f } })
+	{
+		REQUIRE(sortedIds(sweep.query(window)) == sortedIds(tree.query(window)));
+		REQUIRE(sweep.count(window) == tree.count(window));
+	}
+	REQUIRE(normalized(sweep.findAllIntersections()) == normalized(tree.findAllIntersections()));
+
+	// Move bodies in place and relocate them like ElementTree::update, the reported changes lead
+	// from the previous pairs to the new ones
+	for (auto step = 0; step < 4; ++step)
+	{
+		auto pairs = pairSet(sweep.findAllIntersections());
+		auto moved = std::vector<std::pair<Body, quadtree::Box<float>>>();
+		for (auto* body : sweep.access(sweep.getBox()))
+		{
+			if (body->id % 3 == step % 3)
+			{
+				const auto old_box = body->box;
+				body->box.left = std::fmod(body->box.left + 7.f, 990.f);
+				body->box.top += step % 2 == 0 ? 3.f : -3.f;
+				bodies[static_cast<std::size_t>(body->id)] = *body;
+				moved.emplace_back(*body, old_box);
+				tree.update(*body, old_box);
+			}
+		}
+		sweep.relocate(moved);
+		for (const auto& [lhs, rhs] : normalized(sweep.getRemovedPairs()))
+		{
+			REQUIRE(pairs.erase({ lhs, rhs }) == 1);
+		}
+		for (const auto& pair : normalized(sweep.getAddedPairs()))
+		{
+			REQUIRE(pairs.insert(pair).second);
+		}
+		const auto expected = pairSet(tree.findAllIntersections());
+		REQUIRE(pairSet(sweep.findAllIntersections()) == expected);
+		// The loose body only takes part in the search
+		std::erase_if(pairs, [](const auto& pair) { return pair.first == 2003 || pair.second == 2003; });
+		REQUIRE(pairs.size() + tree.count(bodies[2003].box) - 1 == expected.size());
+	}
+
+	// Boxes becoming non finite and back
+	auto body = bodies[2001];
+	sweep.update(Body { body.id, { 400.f, 100.f, std::numeric_limits<float>::infinity(), 10.f } }, body.box);
+	REQUIRE(sweep.mLoose.size() == 2);
+	sweep.update(body, { 400.f, 100.f, std::numeric_limits<float>::infinity(), 10.f });
+	REQUIRE(sweep.mLoose.size() == 1);
+	REQUIRE(normalized(sweep.findAllIntersections()) == normalized(tree.findAllIntersections()));
+
+	// Removing every other value keeps the endpoints and pairs consistent
+	for (const auto& value : tree.query(tree.getBox()))
+	{
+		if (value.id % 2 == 0)
+		{
+			sweep.remove(value);
+			tree.remove(value);
+		}
+	}
+	REQUIRE(sweep.count(sweep.getBox()) == tree.count(tree.getBox()));
+	REQUIRE(sweep.size() == tree.size());
+	REQUIRE(normalized(sweep.findAllIntersections()) == normalized(tree.findAllIntersections()));
+	REQUIRE(!sweep.any({ 2000.f, 2000.f, 10.f, 10.f }));
+
+	sweep.clear();
+	REQUIRE(sweep.size() == 0);
+	REQUIRE(sweep.findAllIntersections().empty());
+	sweep.add(bodies[2000]);
+	sweep.add(Body { 3000, { 110.f, 110.f, 5.f, 5.f } });
+	REQUIRE(sweep.getAddedPairs().size() == 1);
+}
+
+TEST_CASE("sap::SweepAndPrune finds wide values right after build", "[sap]")
+{
+	BodySweep sweep { getBodyBox };
+	sweep.build(std::vector<Body> { Body { 0, { 0.f, 0.f, 100.f, 10.f } }, Body { 1, { 200.f, 0.f, 10.f, 10.f } } });
+	// The wide value starts far left of the query
+	REQUIRE(sweep.count({ 50.f, 0.f, 10.f, 10.f }) == 1);
+	REQUIRE(sweep.any({ 95.f, 5.f, 1.f, 1.f }));
+	REQUIRE(sortedIds(sweep.query({ 90.f, 0.f, 115.f, 10.f })) == std::vector<int> { 0, 1 });
+	sweep.remove(Body { 0, { 0.f, 0.f, 100.f, 10.f } });
+	REQUIRE(sweep.count({ 50.f, 0.f, 10.f, 10.f }) == 0);
+}
+
+TEST_CASE("sap::SweepAndPrune reports the pairs of touching boxes", "[sap]")
+{
+	BodySweep sweep { getBodyBox };
+	sweep.add(Body { 0, { 0.f, 0.f, 10.f, 10.f } });
+	sweep.add(Body { 1, { 10.f, 0.f, 10.f, 10.f } });
+	REQUIRE(sweep.getAddedPairs().empty());
+	REQUIRE(sweep.findAllIntersections().empty());
+
+	// Moving past the shared edge starts the overlap, moving back ends it
+	sweep.update(Body { 1, { 9.f, 0.f, 10.f, 10.f } }, { 10.f, 0.f, 10.f, 10.f });
+	REQUIRE(normalized(sweep.getAddedPairs()) == std::vector<std::pair<int, int>> { { 0, 1 } });
+	sweep.update(Body { 1, { 10.f, 0.f, 10.f, 10.f } }, { 9.f, 0.f, 10.f, 10.f });
+	REQUIRE(sweep.getAddedPairs().empty());
+	REQUIRE(normalized(sweep.getRemovedPairs()) == std::vector<std::pair<int, int>> { { 0, 1 } });
+	// Overlapping on x while touching on y is no pair
+	sweep.update(Body { 1, { 5.f, 10.f, 10.f, 10.f } }, { 10.f, 0.f, 10.f, 10.f });
+	REQUIRE(sweep.getAddedPairs().empty());
+	REQUIRE(sweep.findAllIntersections().empty());
+
+	// The pairs of the last value follow it to the index of a removed one
+	sweep.add(Body { 2, { 12.f, 15.f, 10.f, 10.f } });
+	REQUIRE(normalized(sweep.getAddedPairs()) == std::vector<std::pair<int, int>> { { 1, 2 } });
+	sweep.remove(Body { 0, { 0.f, 0.f, 10.f, 10.f } });
+	REQUIRE(sweep.getRemovedPairs().empty());
+	REQUIRE(normalized(sweep.findAllIntersections()) == std::vector<std::pair<int, int>> { { 1, 2 } });
+	sweep.remove(Body { 1, { 5.f, 10.f, 10.f, 10.f } });
+	REQUIRE(normalized(sweep.getRemovedPairs()) == std::vector<std::pair<int, int>> { { 1, 2 } });
+	REQUIRE(sweep.findAllIntersections().empty());
+	REQUIRE(sweep.size() == 1);
+}